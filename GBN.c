@@ -1,1089 +1,1898 @@
-/* File: GBN.c
- * Authors: Kim Svedberg, Zebastian Thorsén
- * Description: File containing all function for the GBN protocol like connection setup & teardown.
- */
-
-#include "GBN.h"
-
-
-state_t state;
-
-int sender_connection(int sockfd, const struct sockaddr* serverName, socklen_t socklen) {
-	char buffer[MAXMSG];
-	fd_set activeFdSet;
-	srand(time(NULL));
-	int nOfBytes = 0;
-	int result = 0;
-
-	s_state = CLOSED;
-
-	/* Timeout */
-	struct timeval timeout;
-	timeout.tv_sec = 5;
-	timeout.tv_usec = 0;
-
-
-	/* Initialize SYN_packet */
-	rtp* SYN_packet = malloc(sizeof(*SYN_packet));
-	if (SYN_packet == NULL) {
-		perror("malloc");
-		exit(EXIT_FAILURE);
-	}
-	SYN_packet->flags = SYN;    //SYN packet                     
-	SYN_packet->seq = (rand() % (MAX_SEQ_NUM - MIN_SEQ_NUM + 1)) + MIN_SEQ_NUM;    //Chose a random seq_number between 5 & 99
-	SYN_packet->windowsize = windowSize;
-	memset(SYN_packet->data, '\0', sizeof(SYN_packet->data));
-	SYN_packet->checksum = checksum(SYN_packet);
-
-
-	/* Initilize SYNACK_packet */
-	rtp* SYNACK_packet = malloc(sizeof(*SYNACK_packet));
-	if (SYNACK_packet == NULL) {
-		perror("malloc");
-		exit(EXIT_FAILURE);
-	}
-	memset(SYNACK_packet->data, '\0', sizeof(SYNACK_packet->data));
-	struct sockaddr from;
-	socklen_t from_len = sizeof(from);
-
-
-	/* Initialize ACK_packet */
-	rtp* ACK_packet = malloc(sizeof(*ACK_packet));
-	if (ACK_packet == NULL) {
-		perror("malloc");
-		exit(EXIT_FAILURE);
-	}
-	ACK_packet->flags = ACK;
-	memset(ACK_packet->data, '\0', sizeof(ACK_packet->data));
-
-
-	FD_ZERO(&activeFdSet);
-	FD_SET(sockfd, &activeFdSet);
-
-	/* State machine */
-	while (1) {
-		switch (s_state) {
-
-			/* Start state, begins with a closed connection. Send SYN */
-		case CLOSED:
-			printf("Sending SYN packet\n");
-
-			/* Send SYN_packet to receiver */
-			nOfBytes = sendto(sockfd, SYN_packet, sizeof(*SYN_packet), 0, serverName, socklen);
-
-			/* Failed to send SYN_packet to the receiver */
-			if (nOfBytes < 0) {
-				perror("Sender connection - Could not send SYN packet\n");
-				exit(EXIT_FAILURE);
-			}
-
-			/* If all went well, switch to next state */
-			s_state = WAIT_SYNACK;
-			break;
-
-			/* Wait for an ACK (SYNACK) for the SYN */
-		case WAIT_SYNACK:
-
-			timeout.tv_sec = 5;
-			timeout.tv_usec = 0;
-
-			result = select(sockfd + 1, &activeFdSet, NULL, NULL, &timeout);
-
-			if (result == -1) {   //Select fails
-				perror("WAIT_SYN select failed");
-				exit(EXIT_FAILURE);
-
-			}
-			else if (result == 0) { //If a timeout occurs that means the packet was lost
-				printf("TIMEOUT: SYN packet lost\n");
-				s_state = CLOSED;
-				break;
-
-			}
-			else { /* Receives a packet */
-				if (recvfrom(sockfd, SYNACK_packet, sizeof(*SYNACK_packet), 0, &from, &from_len) != -1) {
-					printf("New packet arrived!\n");
-
-
-					/* If the packet is a SYNACK and have a valid checksum*/
-					if (SYNACK_packet->flags == SYNACK && SYNACK_packet->checksum == checksum(SYNACK_packet)) {
-						printf("Valid SYNACK packet!\n");
-						printf("Packet info - Type: %d\tSeq: %d\n", SYNACK_packet->flags, SYNACK_packet->seq);
-
-						/* Finalize the ACK_packet */
-						ACK_packet->seq = SYNACK_packet->seq + 1;
-						ACK_packet->checksum = checksum(ACK_packet);
-
-						/* Switch to next state */
-						s_state = RCVD_SYNACK;
-
-					}
-					else { /* If the packet is not a SYNACK or a mismatch of checksum detected */
-						printf("Invalid SYNACK packet!\n");
-						printf("Retransmitting SYN packet\n");
-						s_state = CLOSED;
-					}
-				}
-				else { /* Couldn't read from socket */
-					perror("Can't from read socket");
-					exit(EXIT_FAILURE);
-				}
-			}
-			break;
-
-			/* Received SYNACK, send an ACK for that*/
-		case RCVD_SYNACK:
-			nOfBytes = sendto(sockfd, ACK_packet, sizeof(*ACK_packet), 0, serverName, socklen);
-
-			/* Failed to send ACK to the receiver */
-			if (nOfBytes < 0) {
-				perror("Sender connection - Could not send SYN packet\n");
-				exit(EXIT_FAILURE);
-			}
-
-			printf("ACK sent!\n");
-
-			/* If successfully sent, switch to next state */
-			s_state = ESTABLISHED;
-			break;
-
-			/* Sent an ACK for the SYNACK, wait for retransmissions */
-		case ESTABLISHED:
-
-			timeout.tv_sec = 5;
-			timeout.tv_usec = 0;
-
-			result = select(sockfd + 1, &activeFdSet, NULL, NULL, &timeout);
-
-			if (result == -1) {   //Select fails
-				perror("ESTABLISHED select failed");
-				exit(EXIT_FAILURE);
-
-			}
-			else if (result == 0) { //Timeout occurs, no packet loss
-				printf("TIMEOUT occured\n");
-				printf("Connection succeccfully established\n\n");
-
-				/* Free all allocated memory */
-				free(SYN_packet);
-				free(SYNACK_packet);
-				free(ACK_packet);
-				return 1;   /* Return that connection was made (maybe the seq of client) */
-
-			}
-			else { //Receives SYNACK again, ACK packet was lost
-				printf("SYNACK arrived again\n");
-
-				/* Swith to the previous state */
-				s_state = RCVD_SYNACK;
-			}
-			break;
-
-		default:
-			break;
-		}
-	}
-}
-
-
-receiver_connection(int sockfd, const struct sockaddr* client, socklen_t* socklen) {
-	fd_set activeFdSet;
-	int nOfBytes = 0;
-	int result = 0;
-	r_state = LISTENING;
-
-	/* Timeout */
-	struct timeval timeout;
-	timeout.tv_sec = 5;
-	timeout.tv_usec = 0;
-
-
-	/* Initilize SYN packet*/
-	rtp* SYN_packet = malloc(sizeof(*SYN_packet));
-	if (SYN_packet == NULL) {
-		perror("malloc");
-		exit(EXIT_FAILURE);
-	}
-	memset(SYN_packet->data, '\0', sizeof(SYN_packet->data));
-
-
-	/* Initilize SYNACK packet */
-	rtp* SYNACK_packet = malloc(sizeof(*SYNACK_packet));
-	if (SYNACK_packet == NULL) {
-		perror("malloc");
-		exit(EXIT_FAILURE);
-	}
-	SYNACK_packet->flags = SYNACK;
-	memset(SYNACK_packet->data, '\0', sizeof(SYNACK_packet->data));
-
-
-	/* Initilize ACK packet */
-	rtp* ACK_packet = malloc(sizeof(*ACK_packet));
-	if (ACK_packet == NULL) {
-		perror("malloc");
-		exit(EXIT_FAILURE);
-	}
-
-
-	FD_ZERO(&activeFdSet);
-	FD_SET(sockfd, &activeFdSet);
-
-	while (1) {
-		switch (r_state) {
-
-			/* Listen for a vaild SYN packet */
-		case LISTENING:
-			printf("Current state: LISTENING\n");
-
-			/* Check if a SYN packet has arrived */
-			if (recvfrom(sockfd, SYN_packet, sizeof(*SYN_packet), 0, client, socklen) != -1) {
-				printf("New packet arrived!\n");
-
-				/* Check if packet is vaild*/
-				if (SYN_packet->flags == SYN && SYN_packet->checksum == checksum(SYN_packet)) {
-					printf("Valid SYN packet!\n");
-					printf("Packet info - Type: %d\tseq: %d\tWindowSize: %d\n", SYN_packet->flags, SYN_packet->seq, SYN_packet->windowsize);
-
-					/* Finilize SYNACK packet */
-					SYNACK_packet->seq = SYN_packet->seq + 1;
-					SYNACK_packet->windowsize = SYN_packet->windowsize;
-					SYNACK_packet->checksum = checksum(SYNACK_packet);
-
-					/* Switch to next state */
-					r_state = RCVD_SYN;
-
-				}
-				else { /* Packet is not vaild, not SYN or wrong checksum */
-					printf("Invalid SYN packet!\n");
-
-					/* Continue to listen for SYN*/
-					r_state = LISTENING;
-				}
-			}
-			else {
-				perror("Can't receive SYN packet");
-				exit(EXIT_FAILURE);
-			}
-			break;
-
-			/* Send a SYNACK after a vaild SYN packet*/
-		case RCVD_SYN:
-
-			/* Send back a SYNACK to sender */
-			nOfBytes = sendto(sockfd, SYNACK_packet, sizeof(*SYNACK_packet), 0, client, *socklen);
-
-			/* Failed to send SYNACK to sender */
-			if (nOfBytes < 0) {
-				perror("Can't send SYNACK packet");
-				exit(EXIT_FAILURE);
-
-			}
-			else { /* Successfully sent SYNACK */
-				printf("SYNACK sent!\n");
-				r_state = WAIT_ACK;
-			}
-			break;
-
-		case WAIT_ACK:
-
-			timeout.tv_sec = 5;
-			timeout.tv_usec = 0;
-
-			result = select(sockfd + 1, &activeFdSet, NULL, NULL, &timeout);
-
-			if (result == -1) {   /* Select failed */
-				perror("Select failed");
-				exit(EXIT_FAILURE);
-
-			}
-			else if (result == 0) { /* timeout occurs, SYNACK packet lost */
-				printf("TIMEOUT: SYNACK packet lost\n");
-				r_state = RCVD_SYN;
-
-			}
-			else { /* Receives a packet */
-				if (recvfrom(sockfd, ACK_packet, sizeof(*ACK_packet), 0, client, socklen) != -1) {
-					printf("New packet arrived!\n");
-
-
-					/* If the packet is a ACK and have a valid checksum */
-					if (ACK_packet->flags == ACK && ACK_packet->checksum == checksum(ACK_packet)) {
-						printf("Valid ACK packet!\n");
-						printf("Packet info - Type: %d\tseq: %d\n", ACK_packet->flags, ACK_packet->seq);
-
-						/* Switch to next state */
-						r_state = ESTABLISHED;
-
-					}
-					else { /* Invalid packet */
-						printf("Invalid ACK packet\n");
-
-						/* Switch to previous state */
-						r_state = RCVD_SYN;
-					}
-				}
-				else {
-					perror("Can't read from socket");
-					exit(EXIT_FAILURE);
-				}
-			}
-			break;
-
-		case ESTABLISHED:
-			printf("Connection successfully established!\n\n");
-
-			/* Free allocated memory */
-			free(SYN_packet);
-			free(SYNACK_packet);
-			free(ACK_packet);
-
-			return sockfd; /* Retrun that the connecton was made*/
-			break;
-
-		default:
-			break;
-		}
-	}
-	return -1;
-}
-
-
-int sender_teardown(int sockfd, const struct sockaddr* serverName, socklen_t socklen) {
-	struct sockaddr_in from;
-	socklen_t fromlen = sizeof(from);
-	fd_set activeFdSet;
-	int nOfBytes;
-	int result;
-
-	/* Timeout */
-	struct timeval timeout;
-	timeout.tv_sec = 5;
-	timeout.tv_usec = 0;
-
-	/* Initilize FIN packet */
-	rtp* FIN_packet = malloc(sizeof(*FIN_packet));
-	FIN_packet->flags = FIN;
-	memset(FIN_packet->data, '\0', sizeof(FIN_packet->data));
-	FIN_packet->checksum = checksum(FIN_packet);
-
-	/* Initilize FINACK packet */
-	rtp* FINACK_packet = malloc(sizeof(*FINACK_packet));
-	memset(FINACK_packet->data, '\0', sizeof(FINACK_packet));
-
-	/* Initilize ACK packet */
-	rtp* ACK_packet = malloc(sizeof(*ACK_packet));
-	ACK_packet->flags = ACK;
-	memset(ACK_packet->data, '\0', sizeof(ACK_packet));
-
-	FD_ZERO(&activeFdSet);
-	FD_SET(sockfd, &activeFdSet);
-
-	/* State machine */
-	while (1) {
-		switch (s_state) {
-
-			/* Start state. The connection is established, send FIN */
-		case ESTABLISHED:
-			printf("Sending FIN packet\n");
-			nOfBytes = sendto(sockfd, FIN_packet, sizeof(*FIN_packet), 0, serverName, socklen);
-
-			/* Failed to send FIN_packet to receiver */
-			if (nOfBytes < 0) {
-				perror("Send FIN packet fail\n");
-				exit(EXIT_FAILURE);
-			}
-
-			/* Successfully sent FIN_packet, switch to next state */
-			s_state = WAIT_FINACK;
-			break;
-
-			/* Wait for an ACK (FINACK) for the FIN*/
-		case WAIT_FINACK:
-			/* Look if a packet has arrived */
-			result = select(sockfd + 1, &activeFdSet, NULL, NULL, &timeout);
-
-			if (result == -1) {   /* Select failed */
-				perror("select failed");
-				exit(EXIT_FAILURE);
-
-			}
-			else if (result == 0) { /* Timeout occurs, packet was lost */
-				printf("TIMEOUT - FIN packet loss\n");
-				s_state = ESTABLISHED;
-
-			}
-			else { /* Receives a packet */
-				/* Can read from socket */
-				if (recvfrom(sockfd, FINACK_packet, sizeof(*FINACK_packet), 0, &from, &fromlen) != -1) {
-					printf("New packet arrived!\n");
-
-					/* Correct packet type and checksum */
-					if (FINACK_packet->flags == FINACK && FINACK_packet->checksum == checksum(FINACK_packet)) {
-
-						printf("Valid FINACK packet!\n");
-						printf("Packet info - Type: %d\tSeq: %d\n", FINACK_packet->flags, FINACK_packet->seq);
-
-						/* Finalize the ACK_packet */
-						ACK_packet->seq = FINACK_packet->seq + 1;
-						ACK_packet->checksum = checksum(ACK_packet);
-
-						/* Switch to next state */
-						s_state = RCVD_FINACK;
-
-					}
-					else { /* Invalid packet type or checksum */
-						printf("Invalid FINACK packet\n");
-						printf("Retransmitting FIN packet\n");
-						/* Switch to previous state */
-						s_state = ESTABLISHED;
-					}
-
-				}
-				else { /* Can't read from socket */
-					perror("Can't read socket");
-					exit(EXIT_FAILURE);
-				}
-			}
-			break;
-
-		case RCVD_FINACK:
-			result = sendto(sockfd, ACK_packet, sizeof(*ACK_packet), 0, serverName, socklen);
-
-			/* Failed to send ACK */
-			if (result < 0) {
-				perror("Send ACK-packet failed");
-				exit(EXIT_FAILURE);
-			}
-
-			/* Sent ACK, switch to next state */
-			printf("ACK sent!\n");
-			s_state = WAIT_TIME;
-			break;
-
-		case WAIT_TIME:
-			/* Look if a packet has arrived */
-			result = select(sockfd + 1, &activeFdSet, NULL, NULL, &timeout);
-
-			if (result == -1) {   /* Select failed */
-				perror("select failed");
-				exit(EXIT_FAILURE);
-
-			}
-			else if (result == 0) { /* Timeout occurs, packet arrived */
-				printf("TIMEOUT occurred\n");
-
-				/* Switch to next state */
-				s_state = CLOSED;
-				break;
-
-			}
-			else { /* Receives a new packet, ACK was lost */
-				printf("Packet arrived again!\n");
-
-				if (recvfrom(sockfd, FINACK_packet, sizeof(*FINACK_packet), 0, &from, &fromlen) != -1) {
-					printf("New packet arrived!\n");
-
-					/* Correct packet type and checksum */
-					if (FINACK_packet->flags == FINACK && FINACK_packet->checksum == checksum(FINACK_packet)) {
-
-						printf("Valid FINACK arrived!\n");
-						printf("Packet info - Type: %d\tSeq: %d\n", FINACK_packet->flags, FINACK_packet->seq);
-
-						/* Finalize ACK_packet */
-						ACK_packet->seq = FINACK_packet->seq + 1;
-						ACK_packet->checksum = checksum(ACK_packet);
-
-						/* Switch to previous state */
-						s_state = RCVD_FINACK;
-
-					}
-					else { /* Invalid packet type or checksum */
-						printf("Invalid FINACK packet\n");
-						printf("Retransmitting FIN\n");
-
-						/* Switch to begining state */
-						s_state = ESTABLISHED;
-					}
-
-				}
-				else { /* Can't read from socket */
-					perror("Can't read socket");
-					exit(EXIT_FAILURE);
-				}
-			}
-			break;
-
-			/* Timeout occurred, close connection */
-		case CLOSED:
-
-			printf("Connection successfully closed!\n");
-
-			/* Free allocated memory */
-			free(FIN_packet);
-			free(FINACK_packet);
-			free(ACK_packet);
-
-			return 1;   /* Return that connection was closed */
-			break;
-
-		default:
-			break;
-		}
-	}
-}
-
-
-int receiver_teardown(int sockfd, const struct sockaddr* client, socklen_t socklen) {
-	fd_set activeFdSet;
-	int nOfBytes;
-	int result;
-
-	r_state = ESTABLISHED;
-
-	/* Timeout */
-	struct timeval timeout;
-	timeout.tv_sec = 5;
-	timeout.tv_usec = 0;
-
-	/* Initilize FIN packet */
-	rtp* FIN_packet = malloc(sizeof(*FIN_packet));
-	memset(FIN_packet->data, '\0', sizeof(FIN_packet->data));
-
-	/* Initilize FINACK packet */
-	rtp* FINACK_packet = malloc(sizeof(*FINACK_packet));
-	FINACK_packet->flags = FINACK;
-	memset(FINACK_packet->data, '\0', sizeof(FINACK_packet));
-
-	/* Initilize ACK packet */
-	rtp* ACK_packet = malloc(sizeof(*ACK_packet));
-	memset(ACK_packet->data, '\0', sizeof(ACK_packet));
-
-	FD_ZERO(&activeFdSet);
-	FD_SET(sockfd, &activeFdSet);
-
-	while (1) {
-		switch (r_state) {
-
-			/* FIN received */
-		case ESTABLISHED:
-			if (recvfrom(sockfd, FIN_packet, sizeof(*FIN_packet), 0, client, &socklen) != -1) {
-
-				printf("New packet arrived!\n");
-
-				/* Check if packet is FIN and have a valid checksum */
-				if (FIN_packet->flags == FIN && FIN_packet->checksum == checksum(FIN_packet)) {
-					printf("Valid FIN packet!\n");
-					printf("Packet info - Type: %d\tseq: %d\n", FIN_packet->flags, FIN_packet->seq);
-
-					/* Finilize FINACK packet */
-					FINACK_packet->seq = FIN_packet->seq + 1;
-					FINACK_packet->checksum = checksum(FINACK_packet);
-
-					/* Switch to next state */
-					r_state = RCVD_FIN;
-
-				}
-				else {
-					printf("Invalid FIN packet!\n");
-
-					/* Stay in current state */
-					r_state = ESTABLISHED;
-				}
-
-			}
-			else {
-				perror("Can't read from socket");
-				exit(EXIT_FAILURE);
-			}
-			break;
-
-			/* Received FIN, send FINACK */
-		case RCVD_FIN:
-			nOfBytes = sendto(sockfd, FINACK_packet, sizeof(*FINACK_packet), 0, client, socklen);
-
-			/* Failed to send FINACK */
-			if (nOfBytes < 0) {
-				perror("Send FINACK failed");
-				exit(EXIT_FAILURE);
-			}
-
-			printf("FINACK sent!\n");
-
-			/* Switch to next state */
-			r_state = WAIT_TIME;
-			break;
-
-			/* Sent FINACK, waiting if another packet arrives */
-		case WAIT_TIME:
-
-			timeout.tv_sec = 5;
-			timeout.tv_usec = 0;
-
-			result = select(sockfd + 1, &activeFdSet, NULL, NULL, &timeout);
-
-			if (result == -1) {
-				perror("Select failed");
-				exit(EXIT_FAILURE);
-
-			}
-			else if (result == 0) { /* Timeout occurs, FINACK was lost */
-				printf("TIMEOUT occurred\n");
-
-				/* Retransmit FINACK, switch to previous state */
-				r_state = RCVD_FIN;
-			}
-			else {
-				if (recvfrom(sockfd, ACK_packet, sizeof(*ACK_packet), 0, client, &socklen) != -1) {
-					printf("New packet arrived!\n");
-
-					/* valid ACK */
-					if (ACK_packet->flags == ACK && ACK_packet->checksum == checksum(ACK_packet)) {
-						printf("Valid ACK packet!\n");
-						printf("Packet info - Type: %d\tseq: %d\n", ACK_packet->flags, ACK_packet->seq);
-
-						/* Switch to next state */
-						r_state = CLOSED;
-
-					}
-					else {
-						printf("Invalid ACK packet!\n");
-
-						/* Switch to previous state */
-						r_state = RCVD_FIN;
-					}
-				}
-				else {
-					perror("Can't read from socket");
-					exit(EXIT_FAILURE);
-				}
-			}
-			break;
-
-			/* Received ACK, close connection */
-		case CLOSED:
-
-			printf("Connection successfully closed!\n");
-
-			/* Free allocated memory */
-			free(FIN_packet);
-			free(FINACK_packet);
-			free(ACK_packet);
-
-			return 1; /* Return that connection was closed */
-			break;
-
-		default:
-			break;
-		}
-	}
-}
-
-
-void sendFunc(struct rtp client)
-{
-	client.checksum = checkSumCalc(client);	// checksum before sending packet 
-
-	if(client.flags == SENDING)
-	{
-		if(client.seq == 1) //&&
-		{
-			//corrupt_header(&client, 2);
-			//testcorrupt++;
-		}
-		if(outoforder == 1 && client.seq == 10) //(windowsize 10)
-		{
-			printf("Test of out of order\n");
-			outoforder++;
-			return;	// Return instead of sending packet (thus skipping seq = 10)
-		}
-	}
-
-	if(client.flags == SYN && testcorrupt == 5)
-	{
-		strcpy(client.data, "Test of corrupt ACK");
-		corrupt_header(&client, 2);
-		testcorrupt++;
-	}
-
-
-	int rc = sendto(sockfd, &client, sizeof(struct rtp), 0, (const struct sockaddr*)&serveradress, sizeof(serveradress));
-	if(rc < 0)
-		perror("Failed to send message");
-}
-
-ssize_t sender_gbn(int sockfd, const void* buf, size_t len, int flags) // receives array of strings as buf
-{
-	int attempts = 0; // attempts made to send packet, if exceeds limit then throw away and go in to closed state
-
-	/* Initialize DATA packet */
-	rtp* DATA_packet = malloc(sizeof(*DATA_packet)); // allocate memory for datapacket of rtp type
-	DATA_packet->flags = DATA; // indicate that it is data
-	memset(DATA_packet->data, '\0', sizeof(DATA_packet->data));
-
-	/* Initialize ACK packet */
-	rtp* ACK_packet = malloc(sizeof(*ACK_packet));
-	memset(ACK_packet->data, '\0', sizeof(ACK_packet->data));
-
-	struct sockaddr client_sockaddr;
-	socklen_t client_socklen = sizeof(client_sockaddr);
-
-	int num_UNACK_packet = 0; //number of unacknowledged packets
-	size_t DATA_offset = 0;
-
-
-	int base = 0;                   /* Base sequence number of the window */
-	int next_seq_num = 0;           /* Next sequence number to be sent */
-	size_t total_packets = len;
-
-	const char** data_array = (const char**)buf;
-
-
-
-	while (base < total_packets)
-	{
-		int window_sizei = 0;        /* Initialize window size for each iteration */
-
-		switch (state.state) { //state.state because of state_t struct
-
-		case ESTABLISHED:
-
-			int num_UNACK_packet = 0;
-			size_t DATA_offset = 0;
-
-			// Send packets for current window
-			while (window_sizei < state.window_size && next_seq_num < total_packets) // as long as windows size is smaller than 
-			{
-				//int data_packet_count = 0;
-				
-				// Prepare DATA packet
-				DATA_packet->seq = next_seq_num;
-				strncpy(DATA_packet->data, data_array[next_seq_num], sizeof(DATA_packet->data) - 1); // Copy data to packet, buf+next_seq_num
-				DATA_packet->checksum = checksum(DATA_packet);
-
-				// Send DATA packet
-                        if (attempts > MAX_ATTEMPTS) {
-                            // If the max attempts are reached
-                            printf("ERROR: Max attempts are reached.\n");
-                            errno = 0;
-                            state.state = CLOSED;
-                            break;
-                        } else if (maybe_sendto(sockfd, DATA_packet, sizeof(*DATA_packet), 0, &state.address, state.sck_len) == -1) {
-                            // If error in sending DATA packet
-                            printf("ERROR: Unable to send DATA packet.\n");
-                            state.state = CLOSED;
-                            break;
-                        } else {
-                            // If successfully sent a DATA packet
-                            printf("SUCCESS: Sent DATA packet (%d)...\n", DATA_packet->seqnum);
-                            printf("type: %d\t%dseqnum: %d\tchecksum(received): %d\tchecksum(calculated): \n", DATA_packet->type, DATA_packet->seqnum, DATA_packet->checksum, checksum(DATA_packet));
-
-                            if (window_sizei == 0) {
-                                // If first packet, set time out before FIN
-				    alarm(5);
-                                //timeout using select
-                            }
-                            UNACKed_packets_counter++;
-			    next_seq_num++;
-                        }
-                    }
-			windowsizei++;
-                }
-                attempts++;
-				
-		
-				//sendto(sockfd, DATA_packet, sizeof(*DATA_packet), 0, (struct sockaddr*)&client_sockaddr, client_socklen); //sizeof
-
-
-
-
-				
-// Start timer for the first packet in the window
-                   /* if (window_sizei == 0) {
-                      //  gettimeofday(&start, NULL);
-		    }
-
-				// Increment window variables
-				window_sizei++;
-				next_seq_num++;
-			}*/
-	    // Wait for ACKs
-                while (base < next_seq_num)
-		{
-                    fd_set readfds;
-                    FD_ZERO(&readfds);
-                    FD_SET(sockfd, &readfds);
-
-                 struct timeval timeout;
-                 timeout.timeout_sec = 5;
-		 timeout.timeout_usec = 0;
-
-		int result = select(sockfd + 1, &readfds, NULL, NULL, &timeout);
-
-                    if (result == -1) {
-                        perror("select");
-                        free(DATA_packet);
-			free(ACK_packet);
-                        return -1;
-                    } else if (result == 0) {
-                        // Timeout occurred, change state to PACKET_LOSS to retransmit packets
-                        state.state = PACKET_LOSS;
-                        break;
-                    } else { //received ACK
-			    ssize_t recv_len = recvfrom(sockfd, ACK_packet, sizeof(*ACK_packet), 0, (struct sockaddr*)&client_sockaddr, &client_socklen);
-                        if (recv_len > 0 && ACK_packet->flags == DATA && ACK_packet->checksum == checksum(ACK_packet)) {
-                            base = ACK_packet->seq + 1;
-
-                           if (base == next_seq_num) {
-				  // All packets in the window are acknowledged
-                                state.state = ESTABLISHED; ////////state_t ???
-                                break;
-                            } else {
-                                // More packets are in-flight
-                                state.state = RCVD_ACK;
-                            }
-			   } 
-		  } 
-		} 
-			    
-			
-			break;
-
-		case PACKET_LOSS:
-                for (int i = base; i < next_seq_num; i++) {
-                    DATA_packet->seq = i;
-                    strncpy(DATA_packet->data, data_array[i], sizeof(DATA_packet->data) - 1);
-                    DATA_packet->checksum = checksum(DATA_packet);
-                    DATA_packet->flags = DATA;
-
-                    //sendto(sockfd, DATA_packet, sizeof(*DATA_packet), 0, (struct sockaddr*)&client_sockaddr, client_socklen);
-			if(maybesendto(sockfd, DATA_packet, sizeof(*DATA_packet), 0, &state.address, state.sck_len) == -1)
-			{
-	            printf("ERROR: Unable to retransmit DATA packet.\n");
-                    state.state = CLOSED;
-                    break;
-			}
-			else {
-                    printf("SUCCESS: Retransmitted DATA packet (%d)...\n", DATA_packet->seq);
-                }	
-                }
-            // Restart timeout for retransmissions
-            fd_set readfds;
-            FD_ZERO(&readfds);
-            FD_SET(sockfd, &readfds);
-
-            struct timeval timeout;
-            timeout.tv_sec = 5;
-            timeout.tv_usec = 0;
-
-            int result = select(sockfd + 1, &readfds, NULL, NULL, &timeout);
-
-            if (result == -1) {
-                perror("select");
-                free(DATA_packet);
-                free(ACK_packet);
-                return -1;
-            } else if (result == 0) {
-                // Timeout occurred again, handle appropriately
-                printf("ERROR: Timeout occurred during retransmission.\n");
-                state.state = PACKET_LOSS;
-            } else {
-                ssize_t recv_len = recvfrom(sockfd, ACK_packet, sizeof(*ACK_packet), 0, (struct sockaddr*)&client_sockaddr, &client_socklen);
-                if (recv_len > 0 && ACK_packet->flags == ACK && ACK_packet->checksum == checksum(ACK_packet)) {
-                    base = ACK_packet->seq + 1;
-
-                    if (base == next_seq_num) {
-                        // All packets in the window are acknowledged
-                        state.state = ESTABLISHED;
-                    } else {
-                        // More packets are in-flight
-                        state.state = RCVD_ACK;
-                    }
-                }
-            }
-            break;
-		
-                //restart timer for the first packet in the window
-                //gettimeofday(&start, NULL);
-		/*alarm(5);
-                state.state = ESTABLISHED;
-			break;*/
-
-		case RCVD_ACK: // continue sending packages within window
-			state.state = ESTABLISHED;
-			break;
-
-		default:
-			break;
-		}
-	}
-
-	/* Free allocated memory */
-	free(DATA_packet);
-	free(ACK_packet);
-	return 1;
-
-}
-
-
-ssize_t receiver_gbn(int sockfd, void* buf, size_t len, int flags) {
-
-	int expSeq;
-
-	/* Initialize DATA packet */
-	rtp* DATA_packet = malloc(sizeof(*DATA_packet));
-	memset(DATA_packet->data, '\0', sizeof(DATA_packet->data));
-
-	/* Initilaze ACK packet */
-	rtp* ACK_packet = malloc(sizeof(*ACK_packet));
-	ACK_packet->flags = ACK;
-	memset(ACK_packet->data, '\0', sizeof(ACK_packet->data));
-
-	struct sockaddr client_addr;
-	socklen_t client_len = sizeof(client_addr);
-
-	while (r_state == ESTABLISHED) {
-		if (recvfrom(sockfd, DATA_packet, sizeof(*DATA_packet), 0, &client_addr, &client_len) != -1) {
-			printf("Received a packet!\n");
-
-			/* If the packet is a FIN */
-			if (DATA_packet->flags == FIN && DATA_packet->checksum == checksum(DATA_packet)) {
-				printf("Received a valid FIN packet!\n");
-				return 0;
-
-			}
-			else { /* If the packet is not FIN*/
-				if (DATA_packet->flags == DATA && DATA_packet->checksum == checksum(DATA_packet)) {
-					printf("Received a valid DATA packet!\n");
-
-					/* If the data packet has expected sequence number */
-					if (DATA_packet->seq == expSeq) {
-						printf("Data packet has expected sequence number!\n");
-
-						/* Finilize ACK packet */
-						ACK_packet->seq = DATA_packet->seq + 1;
-						ACK_packet->checksum = checksum(ACK_packet);
-
-					}
-					else { /* wrong sequence number, resend old ACK*/
-						printf("DATA packet has wrong sequence number!\n");
-
-						/* Finialize ACK packet */
-						ACK_packet->seq = expSeq;
-						ACK_packet->checksum = checksum(ACK_packet);
-					}
-
-					/* Regardless of sequence number, send ACK */
-					if (maybe_sendto(sockfd, ACK_packet, sizeof(*ACK_packet), 0, &client_addr, &client_len) == -1) {
-						perror("maybe_sendto");
-						exit(EXIT_FAILURE);
-
-					}
-					else {
-						printf("Successfully sent ACK!\n");
-					}
-				}
-			}
-
-		}
-		else {
-			r_state = CLOSED;
-			perror("Can't read from socket\n");
-			exit(EXIT_FAILURE);
-		}
-	}
-
-	/* free allocated memory */
-	free(DATA_packet);
-	free(ACK_packet);
-	return 0;
-}
-
-
-/* Checksum calculator */
-uint16_t checksum(rtp* packet) {
-	/* Calculate the number of 16-bit words in the packet */
-	int nwords = (sizeof(packet->flags) + sizeof(packet->seq) + sizeof(packet->data)) / sizeof(uint16_t);
-
-	/* Create an array to hold the data for checksum calculation */
-	uint16_t buffer_array[nwords];
-
-	/* Combine seq and flags fields of the packet into the first element of the buffer_array */
-	buffer_array[0] = (uint16_t)packet->seq + ((uint16_t)packet->flags << 8);
-
-	/* Loop through each byte of the data field */
-	for (int byte_index = 1; byte_index <= sizeof(packet->data); byte_index++) {
-
-		/* Calculate the index of the word where the byte will be stored */
-		int word_index = (byte_index + 1) / 2;
-
-		if (byte_index % 2 == 1) {
-			/* If byte_index is odd, store the byte in the lower byte of the word */
-			buffer_array[word_index] = packet->data[byte_index - 1];
-		}
-		else {
-			/* If byte_index is even, shift the previously stored byte to the higher byte
-			 * of the word and add the new byte */
-			buffer_array[word_index] = buffer_array[word_index] << 8;
-			buffer_array[word_index] += packet->data[byte_index - 1];
-		}
-	}
-
-	/* create a pointer to buffer_array and initialize a 32-bit sum*/
-	uint16_t* buffer = buffer_array;
-	uint32_t sum;
-
-	/*Iterate through each 16-bit word in buffer_array and sum them up*/
-	for (sum = 0; nwords > 0; nwords--) {
-		sum += *buffer++;
-	}
-
-	/* Reduce the sum to a 16-bit value by adding the carry from the high
-	 * 16 bits to the low 16 bits */
-	sum = (sum >> 16) + (sum & 0xffff);
-
-	sum += (sum >> 16);  /* Add any carry from the previous step */
-	return ~sum;    /* Return the one's complement of the sum */
-
-}
-
-
-/* ERROR generator */
-ssize_t maybe_sendto(int sockfd, const void* buf, size_t len, int flags, const struct sockaddr* to, socklen_t tolen) {
-	char* buffer = malloc(len);
-	memcpy(buffer, buf, len);
-
-	/* Packet not lost */
-	if (rand() > LOSS_PROB * RAND_MAX) {
-
-		/* Packet corrupted */
-		if (rand() < CORR_PROB * RAND_MAX) {
-
-			/* Selecting a random byte inside the packet */
-			int index = (int)((len - 1) * rand() / (RAND_MAX + 1.0));
-
-			/* Inverting a bit */
-			char c = buffer[index];
-			if (c & 0x01) {
-				c &= 0xFE;
-			}
-			else {
-				c |= 0x01;
-			}
-			buffer[index] = c;
-		}
-
-		/* Sending the packet */
-		int result = sendto(sockfd, buffer, len, flags, to, tolen);
-		if (result == -1) {
-			perror("maybe_sendto problem");
-			exit(EXIT_FAILURE);
-		}
-		/* Free buffer and return the bytes sent */
-		free(buffer);
-		return result;
-
-	}
-	else { /* Packet lost */
-		return(len);
-	}
-}
+/* File: GBN.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: File containing all function for the GBN protocol like connection setup & teardown.
+ */
+
+#include "GBN.h"
+
+
+__thread int s_state;
+__thread int r_state;
+__thread state_t state;     /* Per thread, so striped flows can run one connection each */
+
+static __thread rtp handshake_ack;  /* Last handshake ACK sent, see resend_handshake_ack */
+static __thread rtp resume_answer;  /* Receiver: answer to a resumed transfer's handshake ACK */
+
+int sender_connection(int sockfd, const struct sockaddr* serverName, socklen_t socklen) {
+	char buffer[MAXMSG];
+	srand(time(NULL));
+	int nOfBytes = 0;
+	int result = 0;
+	int resuming = 0;   /* The receiver took our transfer id, it answers the ACK with where to resume */
+
+	s_state = CLOSED;
+	state.options = 0;  /* Handshake packets always use the 16-bit checksum */
+	state.conn_id = 0;  /* and have no connection id before the SYNACK gives one */
+
+	/* Timeout */
+	struct timeval timeout;
+	timeout.tv_sec = 5;
+	timeout.tv_usec = 0;
+
+
+	/* Initialize SYN_packet */
+	rtp* SYN_packet = calloc(1, sizeof(*SYN_packet));
+	if (SYN_packet == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	SYN_packet->flags = SYN;    //SYN packet                     
+	SYN_packet->seq = (rand() % (MAX_SEQ_NUM - MIN_SEQ_NUM + 1)) + MIN_SEQ_NUM;    //Chose a random seq_number between 5 & 99
+	SYN_packet->windowsize = windowSize;
+	SYN_packet->options = LOCAL_OPTIONS;   //Options we ask the receiver for
+	SYN_packet->conn_id = 0;
+	syn_params* params = (syn_params*)SYN_packet->data;
+	params->fec_k = FEC_K;
+	params->transfer_id = state.transfer_id;   /* Non-zero to resume a checkpointed transfer */
+	params->mss = gbn_path_mss(serverName, socklen);
+	SYN_packet->checksum = checksum(SYN_packet);
+
+
+	/* Initilize SYNACK_packet */
+	rtp* SYNACK_packet = calloc(1, sizeof(*SYNACK_packet));
+	if (SYNACK_packet == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	struct sockaddr from;
+	socklen_t from_len = sizeof(from);
+
+
+	/* Initialize ACK_packet */
+	rtp* ACK_packet = calloc(1, sizeof(*ACK_packet));
+	if (ACK_packet == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	ACK_packet->flags = ACK;
+
+
+
+	/* State machine */
+	while (1) {
+		switch (s_state) {
+
+			/* Start state, begins with a closed connection. Send SYN */
+		case CLOSED:
+			printf("Sending SYN packet\n");
+
+			/* Send SYN_packet to receiver */
+			nOfBytes = gbn_sendto(sockfd, SYN_packet, gbn_packet_size(SYN_packet), 0, serverName, socklen);
+
+			/* Failed to send SYN_packet to the receiver */
+			if (nOfBytes < 0) {
+				perror("Sender connection - Could not send SYN packet\n");
+				exit(EXIT_FAILURE);
+			}
+
+			/* If all went well, switch to next state */
+			s_state = WAIT_SYNACK;
+			break;
+
+			/* Wait for an ACK (SYNACK) for the SYN */
+		case WAIT_SYNACK:
+
+			timeout.tv_sec = 5;
+			timeout.tv_usec = 0;
+
+			result = gbn_wait(sockfd, &timeout);
+
+			if (result == -1) {   //Select fails
+				perror("WAIT_SYN select failed");
+				exit(EXIT_FAILURE);
+
+			}
+			else if (result == 0) { //If a timeout occurs that means the packet was lost
+				printf("TIMEOUT: SYN packet lost\n");
+				s_state = CLOSED;
+				break;
+
+			}
+			else { /* Receives a packet */
+				if (gbn_recvfrom(sockfd, SYNACK_packet, sizeof(*SYNACK_packet), 0, &from, &from_len) != -1) {
+					printf("New packet arrived!\n");
+
+
+					/* If the packet is a SYNACK and have a valid checksum*/
+					if (SYNACK_packet->flags == SYNACK && SYNACK_packet->checksum == checksum(SYNACK_packet)) {
+						printf("Valid SYNACK packet!\n");
+						printf("Packet info - Type: %d\tSeq: %d\n", SYNACK_packet->flags, SYNACK_packet->seq);
+
+						/* Options accepted by the receiver, used from the ACK onwards */
+						state.options = SYNACK_packet->options & LOCAL_OPTIONS;
+						syn_params* agreed = (syn_params*)SYNACK_packet->data;
+						state.fec_k = (state.options & OPT_FEC) ? agreed->fec_k : 0;
+						printf("Negotiated options: 0x%02x\tFEC k: %d\n", state.options, state.fec_k);
+
+						/* How much of the transfer the receiver has comes in its answer to the ACK */
+						state.resume_offset = 0;
+						resuming = state.transfer_id != 0 && agreed->transfer_id == state.transfer_id;
+
+						/* Segments start at a size any path takes, sender_gbn probes for more */
+						state.mss_max = agreed->mss > 0 ? agreed->mss : BASE_MSS;
+						state.mss = state.mss_max < BASE_MSS ? state.mss_max : BASE_MSS;
+						printf("Segment size: %d\tLargest agreed: %d\n", state.mss, state.mss_max);
+
+						/* Window and peer used by sender_gbn */
+						state.window_size = SYNACK_packet->windowsize;
+						memcpy(&state.address, serverName, socklen);
+						state.sck_len = socklen;
+
+						/* In every packet from now on, the ACK too */
+						state.conn_id = agreed->conn_id;
+
+						/* Finalize the ACK_packet, it echoes the agreement and its cookie */
+						ACK_packet->seq = SYNACK_packet->seq + 1;
+						ACK_packet->options = state.options;
+						ACK_packet->windowsize = SYNACK_packet->windowsize;
+						ACK_packet->conn_id = state.conn_id;
+						memcpy(ACK_packet->data, SYNACK_packet->data, sizeof(syn_params));
+						ACK_packet->checksum = checksum(ACK_packet);
+
+						/* Kept for sender_gbn, the receiver has no connection until it gets it */
+						memcpy(&handshake_ack, ACK_packet, sizeof(handshake_ack));
+						state.handshake_unconfirmed = 1;
+
+						/* Switch to next state */
+						s_state = RCVD_SYNACK;
+
+					}
+					else { /* If the packet is not a SYNACK or a mismatch of checksum detected */
+						printf("Invalid SYNACK packet!\n");
+						printf("Retransmitting SYN packet\n");
+						s_state = CLOSED;
+					}
+				}
+				else { /* Couldn't read from socket */
+					perror("Can't from read socket");
+					exit(EXIT_FAILURE);
+				}
+			}
+			break;
+
+			/* Received SYNACK, send an ACK for that*/
+		case RCVD_SYNACK:
+			nOfBytes = gbn_sendto(sockfd, ACK_packet, gbn_packet_size(ACK_packet), 0, serverName, socklen);
+
+			/* Failed to send ACK to the receiver */
+			if (nOfBytes < 0) {
+				perror("Sender connection - Could not send SYN packet\n");
+				exit(EXIT_FAILURE);
+			}
+
+			printf("ACK sent!\n");
+
+			/* If successfully sent, switch to next state */
+			s_state = ESTABLISHED;
+			break;
+
+			/* Sent an ACK for the SYNACK. A lost one is resent by the data transfer
+			 * (resend_handshake_ack), only a resumed transfer waits for the answer here */
+		case ESTABLISHED:
+			if (!resuming) {
+				printf("Connection succeccfully established\n\n");
+
+				/* Free all allocated memory */
+				free(SYN_packet);
+				free(SYNACK_packet);
+				free(ACK_packet);
+				return 1;   /* Return that connection was made (maybe the seq of client) */
+			}
+
+			timeout.tv_sec = 5;
+			timeout.tv_usec = 0;
+
+			result = gbn_wait(sockfd, &timeout);
+
+			if (result == -1) {   //Select fails
+				perror("ESTABLISHED select failed");
+				exit(EXIT_FAILURE);
+
+			}
+			else if (result == 0) { //Timeout occurs, the ACK or the answer was lost
+				printf("TIMEOUT: no answer to resume\n");
+				s_state = RCVD_SYNACK;
+				break;
+			}
+
+			from_len = sizeof(from);
+			if (gbn_recvfrom(sockfd, SYNACK_packet, sizeof(*SYNACK_packet), 0, &from, &from_len) == -1) {
+				perror("Can't from read socket");
+				exit(EXIT_FAILURE);
+			}
+
+			/* The receiver tells how much of the transfer it already has */
+			syn_params* answer = (syn_params*)SYNACK_packet->data;
+			if (SYNACK_packet->flags == ACK && SYNACK_packet->checksum == checksum(SYNACK_packet) && answer->transfer_id == state.transfer_id) {
+				state.resume_offset = answer->resume_offset;
+				state.handshake_unconfirmed = 0;
+				if (state.resume_offset > 0) {
+					printf("Resuming transfer at byte %llu\n", (unsigned long long)state.resume_offset);
+				}
+				printf("Connection succeccfully established\n\n");
+
+				/* Free all allocated memory */
+				free(SYN_packet);
+				free(SYNACK_packet);
+				free(ACK_packet);
+				return 1;
+			}
+			else { //Receives SYNACK again, ACK packet was lost
+				printf("SYNACK arrived again\n");
+
+				/* Swith to the previous state */
+				s_state = RCVD_SYNACK;
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+
+/* Turn a valid SYN into the SYNACK answering it, accepting only the given options and
+ * giving the connection conn_id. Everything agreed is in the SYNACK and its cookie, nothing
+ * is kept here */
+void make_synack(rtp* packet, const struct sockaddr* client, int options, uint32_t conn_id) {
+	syn_params offer;
+	memcpy(&offer, packet->data, sizeof(offer));
+
+	syn_params* agreed = (syn_params*)packet->data;
+	memset(packet->data, '\0', sizeof(syn_params));
+	packet->flags = SYNACK;
+	packet->seq = packet->seq + 1;
+	packet->options = packet->options & options;
+
+	/* Window, the smaller of what both ends want. Sequence numbers are 8 bits, a window of
+	 * half the space or more would make old packets look new */
+	if (packet->windowsize > windowSize) {
+		packet->windowsize = windowSize;
+	}
+	if (packet->windowsize < 1) {
+		packet->windowsize = 1;
+	}
+
+	/* FEC group size, the smaller of what both ends want */
+	agreed->fec_k = offer.fec_k < FEC_K ? offer.fec_k : FEC_K;
+	if (agreed->fec_k > FEC_MAX_K) {
+		agreed->fec_k = FEC_MAX_K;
+	}
+	if (!(packet->options & OPT_FEC) || agreed->fec_k < FEC_MIN_K) {
+		packet->options &= ~OPT_FEC;
+		agreed->fec_k = 0;
+	}
+
+	/* Largest segment, what the sender's route takes and we can receive */
+	agreed->mss = offer.mss > 0 && offer.mss < MAXMSG ? offer.mss : MAXMSG;
+
+	/* The transfer to resume. Its checkpoint is looked up when the ACK shows the sender is
+	 * real, not for every SYN */
+	agreed->transfer_id = offer.transfer_id;
+
+	/* The sender puts it in every packet, it knows the connection when the address does not */
+	agreed->conn_id = conn_id;
+	packet->conn_id = 0;
+
+	state.options = 0;
+	cookie_make(packet, client);
+	packet->checksum = checksum(packet);
+}
+
+/* 1 if packet is a handshake ACK echoing one of our SYNACKs, state.options is then the agreed options */
+int accept_ack(rtp* packet, const struct sockaddr* client) {
+	/* The sender already uses the options it echoes, the cookie proves they were ours */
+	state.options = packet->options & LOCAL_OPTIONS;
+
+	if (packet->flags == ACK && packet->checksum == checksum(packet) && cookie_check(packet, client)) {
+		return 1;
+	}
+	state.options = 0;
+	return 0;
+}
+
+
+receiver_connection(int sockfd, const struct sockaddr* client, socklen_t* socklen) {
+	int nOfBytes = 0;
+	socklen_t client_size = *socklen;   /* Room for the peer address */
+	r_state = LISTENING;
+	state.options = 0;  /* Handshake packets always use the 16-bit checksum */
+
+	/* No state is kept per SYN, one packet is received and answered at a time */
+	rtp* packet = calloc(1, sizeof(*packet));
+	if (packet == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+
+	while (1) {
+		switch (r_state) {
+
+			/* Listen for a vaild SYN, or an ACK with a cookie */
+		case LISTENING:
+			printf("Current state: LISTENING\n");
+
+			*socklen = client_size;
+			if (gbn_recvfrom(sockfd, packet, sizeof(*packet), 0, client, socklen) == -1) {
+				perror("Can't receive SYN packet");
+				exit(EXIT_FAILURE);
+			}
+			printf("New packet arrived!\n");
+
+			/* Check if packet is vaild*/
+			if (packet->flags == SYN && packet->checksum == checksum(packet)) {
+				printf("Valid SYN packet!\n");
+				printf("Packet info - Type: %d\tseq: %d\tWindowSize: %d\n", packet->flags, packet->seq, packet->windowsize);
+				r_state = RCVD_SYN;
+			}
+			else if (packet->flags == ACK) {
+				if (accept_ack(packet, client)) {
+					printf("Valid ACK packet!\n");
+					printf("Packet info - Type: %d\tseq: %d\n", packet->flags, packet->seq);
+					r_state = RCVD_ACK;
+				}
+				else {
+					printf("Invalid ACK packet\n");
+				}
+			}
+			else { /* Packet is not vaild, not SYN or wrong checksum */
+				printf("Invalid SYN packet!\n");
+			}
+			break;
+
+			/* Answer a vaild SYN with a SYNACK, the agreement is kept in its cookie only */
+		case RCVD_SYN:
+			make_synack(packet, client, LOCAL_OPTIONS, path_conn_id(0));
+
+			/* Send back a SYNACK to sender, a lost one is handled by the sender resending its SYN */
+			nOfBytes = gbn_sendto(sockfd, packet, gbn_packet_size(packet), 0, client, *socklen);
+
+			/* Failed to send SYNACK to sender */
+			if (nOfBytes < 0) {
+				perror("Can't send SYNACK packet");
+				exit(EXIT_FAILURE);
+			}
+			printf("SYNACK sent!\n");
+			r_state = LISTENING;
+			break;
+
+			/* A valid cookie came back, only now is the connection set up */
+		case RCVD_ACK: {
+			syn_params agreed;
+			memcpy(&agreed, packet->data, sizeof(agreed));
+
+			/* Window and peer used by the data transfer */
+			state.window_size = packet->windowsize;
+			memcpy(&state.address, client, *socklen);
+			state.sck_len = *socklen;
+			state.conn_id = agreed.conn_id;
+			memset(&state.path, 0, sizeof(state.path));
+
+			state.fec_k = (state.options & OPT_FEC) ? agreed.fec_k : 0;
+			printf("Negotiated options: 0x%02x\tFEC k: %d\n", state.options, state.fec_k);
+
+			state.mss_max = agreed.mss;
+			state.mss = state.mss_max < BASE_MSS ? state.mss_max : BASE_MSS;
+
+			/* Resume a transfer we have a checkpoint for, the sender waits to hear from where */
+			state.transfer_id = agreed.transfer_id;
+			state.resume_offset = agreed.transfer_id != 0 ? checkpoint_load(agreed.transfer_id) : 0;
+			state.transfer_done = state.checkpoint_at = state.resume_offset;
+			if (state.resume_offset > 0) {
+				printf("Resuming transfer at byte %llu\n", (unsigned long long)state.resume_offset);
+			}
+			if (state.transfer_id != 0) {
+				memset(&resume_answer, 0, sizeof(resume_answer));
+				resume_answer.flags = ACK;
+				resume_answer.seq = 0;  /* Also a valid ACK, nothing has been received */
+				resume_answer.conn_id = state.conn_id;
+				syn_params* answer = (syn_params*)resume_answer.data;
+				answer->transfer_id = state.transfer_id;
+				answer->resume_offset = state.resume_offset;
+				resume_answer.checksum = checksum(&resume_answer);
+				send_resume_answer(sockfd);
+			}
+
+			r_state = ESTABLISHED;
+			break;
+		}
+
+		case ESTABLISHED:
+			printf("Connection successfully established!\n\n");
+
+			/* Free allocated memory */
+			free(packet);
+
+			return sockfd; /* Retrun that the connecton was made*/
+			break;
+
+		default:
+			break;
+		}
+	}
+	return -1;
+}
+
+
+/* Receiver: tell the sender of a resumed transfer how much of it we have, again if its
+ * handshake ACK comes again */
+void send_resume_answer(int sockfd) {
+	if (gbn_sendto(sockfd, &resume_answer, gbn_packet_size(&resume_answer), 0, (struct sockaddr*)&state.address, state.sck_len) < 0) {
+		perror("Could not send resume answer");
+		return;
+	}
+	printf("Resume answer sent (byte %llu)\n", (unsigned long long)state.resume_offset);
+}
+
+/* Resend the handshake ACK if nothing has come back since. The receiver keeps no state
+ * before it, so a lost ACK would otherwise leave it listening while we send data */
+void resend_handshake_ack(int sockfd) {
+	if (!state.handshake_unconfirmed) {
+		return;
+	}
+	if (gbn_sendto(sockfd, &handshake_ack, gbn_packet_size(&handshake_ack), 0, (struct sockaddr*)&state.address, state.sck_len) < 0) {
+		perror("Could not resend handshake ACK");
+		return;
+	}
+	printf("Handshake ACK resent\n");
+}
+
+
+int sender_teardown(int sockfd, const struct sockaddr* serverName, socklen_t socklen) {
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	int nOfBytes;
+	int result;
+
+	/* Timeout */
+	struct timeval timeout;
+	timeout.tv_sec = 5;
+	timeout.tv_usec = 0;
+
+	/* Initilize FIN packet, zeroed so no heap bytes go out in the unused fields */
+	rtp* FIN_packet = calloc(1, sizeof(*FIN_packet));
+	if (FIN_packet == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	FIN_packet->flags = FIN;
+	FIN_packet->conn_id = state.conn_id;
+	FIN_packet->checksum = checksum(FIN_packet);
+
+	/* Initilize FINACK packet */
+	rtp* FINACK_packet = calloc(1, sizeof(*FINACK_packet));
+	if (FINACK_packet == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Initilize ACK packet */
+	rtp* ACK_packet = calloc(1, sizeof(*ACK_packet));
+	if (ACK_packet == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	ACK_packet->flags = ACK;
+	ACK_packet->conn_id = state.conn_id;
+
+
+	/* State machine */
+	while (1) {
+		switch (s_state) {
+
+			/* Start state. The connection is established, send FIN */
+		case ESTABLISHED:
+			printf("Sending FIN packet\n");
+			nOfBytes = gbn_sendto(sockfd, FIN_packet, gbn_packet_size(FIN_packet), 0, serverName, socklen);
+
+			/* Failed to send FIN_packet to receiver */
+			if (nOfBytes < 0) {
+				perror("Send FIN packet fail\n");
+				exit(EXIT_FAILURE);
+			}
+
+			/* Successfully sent FIN_packet, switch to next state */
+			s_state = WAIT_FINACK;
+			break;
+
+			/* Wait for an ACK (FINACK) for the FIN*/
+		case WAIT_FINACK:
+			timeout.tv_sec = 5;
+			timeout.tv_usec = 0;
+
+			/* Look if a packet has arrived */
+			result = gbn_wait(sockfd, &timeout);
+
+			if (result == -1) {   /* Select failed */
+				perror("select failed");
+				exit(EXIT_FAILURE);
+
+			}
+			else if (result == 0) { /* Timeout occurs, packet was lost */
+				printf("TIMEOUT - FIN packet loss\n");
+				s_state = ESTABLISHED;
+
+			}
+			else { /* Receives a packet */
+				/* Can read from socket */
+				if (gbn_recvfrom(sockfd, FINACK_packet, sizeof(*FINACK_packet), 0, (struct sockaddr*)&from, &fromlen) != -1) {
+					printf("New packet arrived!\n");
+
+					/* Correct packet type and checksum */
+					if (FINACK_packet->flags == FINACK && FINACK_packet->checksum == checksum(FINACK_packet)) {
+
+						printf("Valid FINACK packet!\n");
+						printf("Packet info - Type: %d\tSeq: %d\n", FINACK_packet->flags, FINACK_packet->seq);
+
+						/* Finalize the ACK_packet */
+						ACK_packet->seq = FINACK_packet->seq + 1;
+						ACK_packet->checksum = checksum(ACK_packet);
+
+						/* Switch to next state */
+						s_state = RCVD_FINACK;
+
+					}
+					else { /* Invalid packet type or checksum */
+						printf("Invalid FINACK packet\n");
+						printf("Retransmitting FIN packet\n");
+						/* Switch to previous state */
+						s_state = ESTABLISHED;
+					}
+
+				}
+				else { /* Can't read from socket */
+					perror("Can't read socket");
+					exit(EXIT_FAILURE);
+				}
+			}
+			break;
+
+		case RCVD_FINACK:
+			result = gbn_sendto(sockfd, ACK_packet, gbn_packet_size(ACK_packet), 0, serverName, socklen);
+
+			/* Failed to send ACK */
+			if (result < 0) {
+				perror("Send ACK-packet failed");
+				exit(EXIT_FAILURE);
+			}
+
+			/* Sent ACK, switch to next state */
+			printf("ACK sent!\n");
+			s_state = WAIT_TIME;
+			break;
+
+		case WAIT_TIME:
+			timeout.tv_sec = 5;
+			timeout.tv_usec = 0;
+
+			/* Look if a packet has arrived */
+			result = gbn_wait(sockfd, &timeout);
+
+			if (result == -1) {   /* Select failed */
+				perror("select failed");
+				exit(EXIT_FAILURE);
+
+			}
+			else if (result == 0) { /* Timeout occurs, packet arrived */
+				printf("TIMEOUT occurred\n");
+
+				/* Switch to next state */
+				s_state = CLOSED;
+				break;
+
+			}
+			else { /* Receives a new packet, ACK was lost */
+				printf("Packet arrived again!\n");
+
+				if (gbn_recvfrom(sockfd, FINACK_packet, sizeof(*FINACK_packet), 0, (struct sockaddr*)&from, &fromlen) != -1) {
+					printf("New packet arrived!\n");
+
+					/* Correct packet type and checksum */
+					if (FINACK_packet->flags == FINACK && FINACK_packet->checksum == checksum(FINACK_packet)) {
+
+						printf("Valid FINACK arrived!\n");
+						printf("Packet info - Type: %d\tSeq: %d\n", FINACK_packet->flags, FINACK_packet->seq);
+
+						/* Finalize ACK_packet */
+						ACK_packet->seq = FINACK_packet->seq + 1;
+						ACK_packet->checksum = checksum(ACK_packet);
+
+						/* Switch to previous state */
+						s_state = RCVD_FINACK;
+
+					}
+					else { /* Invalid packet type or checksum */
+						printf("Invalid FINACK packet\n");
+						printf("Retransmitting FIN\n");
+
+						/* Switch to begining state */
+						s_state = ESTABLISHED;
+					}
+
+				}
+				else { /* Can't read from socket */
+					perror("Can't read socket");
+					exit(EXIT_FAILURE);
+				}
+			}
+			break;
+
+			/* Timeout occurred, close connection */
+		case CLOSED:
+
+			printf("Connection successfully closed!\n");
+
+			/* Free allocated memory, the connection's arena in one go */
+			free(FIN_packet);
+			free(FINACK_packet);
+			free(ACK_packet);
+			arena_destroy(arena_thread());
+
+			return 1;   /* Return that connection was closed */
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+
+int receiver_teardown(int sockfd, const struct sockaddr* client, socklen_t socklen) {
+	int nOfBytes;
+	int result;
+
+	r_state = ESTABLISHED;
+
+	/* Timeout */
+	struct timeval timeout;
+	timeout.tv_sec = 5;
+	timeout.tv_usec = 0;
+
+	/* Initilize FIN packet, zeroed so no heap bytes go out in the unused fields */
+	rtp* FIN_packet = calloc(1, sizeof(*FIN_packet));
+	if (FIN_packet == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Initilize FINACK packet */
+	rtp* FINACK_packet = calloc(1, sizeof(*FINACK_packet));
+	if (FINACK_packet == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	FINACK_packet->flags = FINACK;
+	FINACK_packet->conn_id = state.conn_id;
+
+	/* Initilize ACK packet */
+	rtp* ACK_packet = calloc(1, sizeof(*ACK_packet));
+	if (ACK_packet == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+
+	while (1) {
+		switch (r_state) {
+
+			/* FIN received */
+		case ESTABLISHED:
+			if (gbn_recvfrom(sockfd, FIN_packet, sizeof(*FIN_packet), 0, client, &socklen) != -1) {
+
+				printf("New packet arrived!\n");
+
+				/* Check if packet is FIN and have a valid checksum */
+				if (FIN_packet->flags == FIN && FIN_packet->checksum == checksum(FIN_packet)) {
+					printf("Valid FIN packet!\n");
+					printf("Packet info - Type: %d\tseq: %d\n", FIN_packet->flags, FIN_packet->seq);
+
+					/* Finilize FINACK packet */
+					FINACK_packet->seq = FIN_packet->seq + 1;
+					FINACK_packet->checksum = checksum(FINACK_packet);
+
+					/* Switch to next state */
+					r_state = RCVD_FIN;
+
+				}
+				else {
+					printf("Invalid FIN packet!\n");
+
+					/* Stay in current state */
+					r_state = ESTABLISHED;
+				}
+
+			}
+			else {
+				perror("Can't read from socket");
+				exit(EXIT_FAILURE);
+			}
+			break;
+
+			/* Received FIN, send FINACK */
+		case RCVD_FIN:
+			nOfBytes = gbn_sendto(sockfd, FINACK_packet, gbn_packet_size(FINACK_packet), 0, client, socklen);
+
+			/* Failed to send FINACK */
+			if (nOfBytes < 0) {
+				perror("Send FINACK failed");
+				exit(EXIT_FAILURE);
+			}
+
+			printf("FINACK sent!\n");
+
+			/* Switch to next state */
+			r_state = WAIT_TIME;
+			break;
+
+			/* Sent FINACK, waiting if another packet arrives */
+		case WAIT_TIME:
+
+			timeout.tv_sec = 5;
+			timeout.tv_usec = 0;
+
+			result = gbn_wait(sockfd, &timeout);
+
+			if (result == -1) {
+				perror("Select failed");
+				exit(EXIT_FAILURE);
+
+			}
+			else if (result == 0) { /* Timeout occurs, FINACK was lost */
+				printf("TIMEOUT occurred\n");
+
+				/* Retransmit FINACK, switch to previous state */
+				r_state = RCVD_FIN;
+			}
+			else {
+				if (gbn_recvfrom(sockfd, ACK_packet, sizeof(*ACK_packet), 0, client, &socklen) != -1) {
+					printf("New packet arrived!\n");
+
+					/* valid ACK */
+					if (ACK_packet->flags == ACK && ACK_packet->checksum == checksum(ACK_packet)) {
+						printf("Valid ACK packet!\n");
+						printf("Packet info - Type: %d\tseq: %d\n", ACK_packet->flags, ACK_packet->seq);
+
+						/* Switch to next state */
+						r_state = CLOSED;
+
+					}
+					else {
+						printf("Invalid ACK packet!\n");
+
+						/* Switch to previous state */
+						r_state = RCVD_FIN;
+					}
+				}
+				else {
+					perror("Can't read from socket");
+					exit(EXIT_FAILURE);
+				}
+			}
+			break;
+
+			/* Received ACK, close connection */
+		case CLOSED:
+
+			printf("Connection successfully closed!\n");
+
+			/* Free allocated memory, the connection's arena in one go */
+			free(FIN_packet);
+			free(FINACK_packet);
+			free(ACK_packet);
+			arena_destroy(arena_thread());
+
+			return 1; /* Return that connection was closed */
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+
+/* Number of segments this end sends or receives, with striping only every stripe_count:th */
+size_t gbn_segments(size_t len) {
+	size_t total = (len + state.mss - 1) / state.mss;
+	int flows = state.stripe_count > 0 ? state.stripe_count : 1;
+
+	if (total <= (size_t)state.stripe_index) {
+		return 0;
+	}
+	return (total - state.stripe_index + flows - 1) / flows;
+}
+
+/* Byte offset of this end's n:th segment in the application buffer */
+size_t gbn_segment_offset(size_t n) {
+	int flows = state.stripe_count > 0 ? state.stripe_count : 1;
+
+	return (state.stripe_index + n * flows) * (size_t)state.mss;
+}
+
+/* Bytes of packet to send, and to checksum. Packets go without the unused data: DATA and
+ * PROBE carry len bytes, PARITY its longest member and the rest room for syn_params.
+ * A PROBEACK only names the size in len */
+size_t gbn_packet_size(const rtp* packet) {
+	size_t used;
+
+	switch (packet->flags) {
+	case DATA:
+		used = packet->len & ~LEN_COMPRESSED;
+		break;
+	case PROBE:
+		used = packet->len;
+		break;
+	case PARITY:
+		used = packet->parity_len;
+		break;
+	default:
+		used = sizeof(syn_params);
+		break;
+	}
+	return offsetof(rtp, data) + (used < MAXMSG ? used : MAXMSG);
+}
+
+/* Segments of a GBN_BYTES transfer by packet number % 256, cut when first sent */
+static __thread size_t seg_offset[256];
+static __thread uint16_t seg_size[256];
+
+/* Cut segment n of a len byte buffer, the one before it ended at offset. Each segment gets
+ * the segment size in use when it is cut and keeps it when resent, so a change of size
+ * never moves data the receiver may already have. Striped flows have fixed segments.
+ * Returns where the next segment starts */
+static size_t cut_segment(size_t n, size_t offset, size_t len) {
+	if (state.stripe_count > 0) {
+		offset = gbn_segment_offset(n);
+	}
+	size_t left = len - offset;
+
+	seg_offset[n % 256] = offset;
+	seg_size[n % 256] = left < (size_t)state.mss ? left : (size_t)state.mss;
+	return offset + seg_size[n % 256];
+}
+
+/* Packets in a GBN_BYTES transfer when the segments from next_seq_num on are cut at the
+ * segment size in use, starting at offset */
+static size_t count_segments(size_t next_seq_num, size_t offset, size_t len) {
+	if (state.stripe_count > 0) {
+		return gbn_segments(len);
+	}
+	return next_seq_num + (len - offset + state.mss - 1) / state.mss;
+}
+
+/* Timestamp option clock, microseconds. 0 means no timestamp so it is never used */
+static uint32_t tstamp_us(int64_t ns) {
+	uint32_t us = (uint32_t)(ns / 1000);
+	return us != 0 ? us : 1;
+}
+
+/* Fill DATA_packet with packet number n of buf */
+static void make_data_packet(rtp* DATA_packet, const void* buf, int flags, size_t n) {
+	const uint8_t* segment;
+	size_t size;
+
+	DATA_packet->flags = DATA;
+	DATA_packet->stream = 0;
+	DATA_packet->seq = (uint8_t)n;
+
+	if (flags & GBN_BYTES) { /* buf is len bytes, segment n was cut by cut_segment */
+		segment = (const uint8_t*)buf + seg_offset[n % 256];
+		size = seg_size[n % 256];
+	}
+	else if (flags & GBN_MESSAGES) { /* buf is an array of len messages, one per packet */
+		const gbn_message* msg = (const gbn_message*)buf + n;
+
+		segment = msg->data;
+		size = msg->len < (size_t)state.mss ? msg->len : (size_t)state.mss;
+	}
+	else { /* buf is an array of len strings, one per packet */
+		const char** data_array = (const char**)buf;
+
+		segment = (const uint8_t*)data_array[n];
+		size = strnlen(data_array[n], state.mss);
+	}
+	data_packet_fill(DATA_packet, segment, size);
+}
+
+/* Payload of a DATA packet whose flags and seq are set: compressed if agreed, stamped
+ * and checksummed */
+void data_packet_fill(rtp* DATA_packet, const uint8_t* segment, size_t size) {
+	/* Compress if agreed, segments that do not shrink are sent as they are */
+	const gbn_codec* codec = gbn_codec_get(state.options);
+	size_t packed = codec != NULL ? codec->compress(segment, size, DATA_packet->data, sizeof(DATA_packet->data)) : 0;
+
+	if (packed > 0) {
+		DATA_packet->len = packed | LEN_COMPRESSED;
+	}
+	else {
+		DATA_packet->len = size;
+		memcpy(DATA_packet->data, segment, size);
+	}
+
+	if (codec != NULL) {
+		state.bytes_raw += size;
+		state.bytes_wire += packed > 0 ? packed : size;
+	}
+
+	/* Stamped with when it will leave the pacer, every retransmission gets its own */
+	DATA_packet->tstamp = (state.options & OPT_TSTAMP) ? tstamp_us(gbn_departure_ns()) : 0;
+	DATA_packet->conn_id = state.conn_id;
+	DATA_packet->checksum = checksum(DATA_packet);
+}
+
+/* Pacing rate: one window per smoothed RTT, capped by PACING_RATE */
+void pace_update(void) {
+	uint64_t rate = PACING_RATE;
+
+	if (state.srtt_ns > 0) {
+		uint64_t window_rate = (uint64_t)state.window_size * (offsetof(rtp, data) + state.mss) * 1000000000ULL / state.srtt_ns;
+		if (rate == 0 || window_rate < rate) {
+			rate = window_rate;
+		}
+	}
+	gbn_pace_rate(rate);
+}
+
+/* A message past its deadline, or resent as often as it may be */
+static int message_expired(const gbn_message* msg, int retransmits, int64_t now) {
+	return (msg->deadline_ns > 0 && now >= msg->deadline_ns) ||
+		(msg->max_retransmits >= 0 && retransmits >= msg->max_retransmits);
+}
+
+/* Retransmission timer, cut short if the oldest message expires before it runs out */
+static void start_timer(struct timeval* timeout, const void* buf, int flags, size_t head, size_t total) {
+	int64_t ns = 5 * 1000000000LL;
+
+	if ((flags & GBN_MESSAGES) && head < total) {
+		const gbn_message* msg = (const gbn_message*)buf + head;
+		if (msg->deadline_ns > 0 && msg->deadline_ns - gbn_now_ns() < ns) {
+			ns = msg->deadline_ns - gbn_now_ns();
+			if (ns < 0) {
+				ns = 0;
+			}
+		}
+	}
+	timeout->tv_sec = ns / 1000000000;
+	timeout->tv_usec = ns % 1000000000 / 1000;
+}
+
+/* Tell the receiver to skip to packet skip_to, the ones before it were dropped */
+static int send_skip(int sockfd, rtp* SKIP_packet, size_t skip_to) {
+	SKIP_packet->flags = SKIP;
+	SKIP_packet->stream = 0;
+	SKIP_packet->seq = (uint8_t)skip_to;
+	SKIP_packet->len = 0;
+	SKIP_packet->conn_id = state.conn_id;
+	SKIP_packet->checksum = checksum(SKIP_packet);
+
+	if (maybe_sendto(sockfd, SKIP_packet, gbn_packet_size(SKIP_packet), 0, (struct sockaddr*)&state.address, state.sck_len) == -1) {
+		printf("ERROR: Unable to send SKIP packet.\n");
+		return -1;
+	}
+	printf("SUCCESS: Sent SKIP packet (%d)...\n", SKIP_packet->seq);
+	return 0;
+}
+
+/* Ask the receiver which packet it expects, before the packets from base on are cut again.
+ * A SKIP to base is answered with an ACK at once, also if the receiver got further and its
+ * ACKs were lost. Returns that packet, from base to next, or -1 if there is no answer */
+ssize_t gbn_resync(int sockfd, rtp* packet, size_t base, size_t next) {
+	struct sockaddr_storage from;
+	socklen_t from_len;
+	int64_t timeout = 0;
+
+	/* ACKs already here were sent before the question */
+	while (gbn_wait_ns(sockfd, &timeout) > 0) {
+		from_len = sizeof(from);
+		gbn_recvfrom(sockfd, packet, sizeof(*packet), 0, (struct sockaddr*)&from, &from_len);
+	}
+
+	for (int attempts = 0; attempts <= MAX_ATTEMPTS; attempts++) {
+		if (send_skip(sockfd, packet, base) == -1) {
+			return -1;
+		}
+
+		timeout = 5 * 1000000000LL;
+		while (gbn_wait_ns(sockfd, &timeout) > 0) {
+			from_len = sizeof(from);
+			if (gbn_recvfrom(sockfd, packet, sizeof(*packet), 0, (struct sockaddr*)&from, &from_len) == -1) {
+				perror("Can't read from socket");
+				exit(EXIT_FAILURE);
+			}
+
+			if (packet->flags == ACK && packet->checksum == checksum(packet)) {
+				size_t expected = base + (uint8_t)(packet->seq - (uint8_t)base);
+				if (expected <= next) {
+					printf("Receiver expects packet (%d)\n", packet->seq);
+					return (ssize_t)expected;
+				}
+			}
+			else if (packet->flags == CHALLENGE) {
+				path_respond(sockfd, packet);
+			}
+		}
+		printf("TIMEOUT: SKIP packet (%d) lost\n", (uint8_t)base);
+	}
+	printf("ERROR: Max attempts are reached.\n");
+	return -1;
+}
+
+/* Fold an RTT sample into the smoothed RTT (RFC 6298 gain) and re-pace */
+void rtt_sample(int64_t rtt) {
+	if (state.srtt_ns == 0) {
+		state.srtt_ns = rtt;
+	}
+	else {
+		state.srtt_ns += (rtt - state.srtt_ns) / 8;
+	}
+	pace_update();
+}
+
+/* RTT sample from the timestamp an ACK echoes. The echo names the transmission it answers,
+ * so resent packets and duplicate ACKs give samples too. Returns 1 if there was one */
+int echo_rtt_sample(const rtp* ACK_packet) {
+	if (!(state.options & OPT_TSTAMP) || ACK_packet->tstamp == 0) {
+		return 0;
+	}
+
+	int32_t rtt_us = (int32_t)(tstamp_us(gbn_rx_time()) - ACK_packet->tstamp);
+	if (rtt_us < 0) {
+		return 0;
+	}
+	rtt_sample((rtt_us > 0 ? rtt_us : 1) * 1000LL);
+	return 1;
+}
+
+ssize_t sender_gbn(int sockfd, const void* buf, size_t len, int flags) // receives array of strings as buf
+{
+	int attempts = 0;   /* Timeouts in a row, at MAX_ATTEMPTS the connection is given up */
+	int result;
+
+	/* A byte buffer can be built, sent and acknowledged on three threads, not with io_uring
+	 * though, its receives belong to the calling thread */
+	if ((flags & GBN_PIPELINE) && (flags & GBN_BYTES)) {
+		if (io_backend == IO_SOCKET) {
+			return sender_pipelined(sockfd, buf, len);
+		}
+		printf("GBN_PIPELINE ignored, io_uring is in use. Sending on one thread...\n");
+	}
+
+	/* Buffers of this transfer come from the connection's arena, all released on return */
+	gbn_arena* arena = arena_thread();
+	arena_mark mark = arena_get_mark(arena);
+
+	/* Initialize DATA packet */
+	rtp* DATA_packet = arena_alloc(arena, sizeof(*DATA_packet));
+	memset(DATA_packet->data, '\0', sizeof(DATA_packet->data));
+
+	/* Initialize ACK packet */
+	rtp* ACK_packet = arena_alloc(arena, sizeof(*ACK_packet));
+	memset(ACK_packet->data, '\0', sizeof(ACK_packet->data));
+
+	struct sockaddr_storage from;
+	socklen_t from_len;
+
+	size_t base = 0;                /* Oldest unacknowledged packet */
+	size_t next_seq_num = 0;        /* Next packet to be sent */
+	size_t next_offset = 0;         /* GBN_BYTES: where the next new segment starts */
+	size_t total_packets = (flags & GBN_BYTES) ? count_segments(0, 0, len) : len;
+
+	/* Retransmission timer for the oldest packet in the window */
+	struct timeval timeout;
+
+	/* Send time of each packet in the window for RTT samples, -1 once retransmitted */
+	int64_t sent_at[256];
+
+	/* GBN_MESSAGES: times each packet was resent, and the first packet not dropped.
+	 * While base is behind skip_to the receiver has not confirmed the skip yet */
+	int retransmits[256];
+	size_t skip_to = 0;
+	size_t dropped = 0;
+
+	/* FEC: base when a loss was last counted. Duplicate ACKs and the timeout that follow
+	 * one gap are a single loss, so it counts once */
+	size_t loss_base = SIZE_MAX;
+
+	/* Spread the window over the RTT instead of sending it back to back */
+	gbn_pace_init(sockfd);
+	pace_update();
+
+	/* ACK arrival times from the kernel, for the timestamp echo */
+	if (state.options & OPT_TSTAMP) {
+		gbn_timestamps_init(sockfd);
+	}
+
+	/* Parity packets, if negotiated */
+	fec_t fec;
+	memset(&fec, 0, sizeof(fec));
+	if (state.fec_k > 0) {
+		fec_init(&fec, state.fec_k);
+	}
+
+	/* Bigger segments, if the path takes them. Only plain byte transfers are probed,
+	 * messages and strings are one per packet anyway and striped flows share fixed segments */
+	pmtu_t pmtu;
+	pmtu_init(&pmtu, sockfd, (flags & GBN_BYTES) && state.stripe_count == 0);
+
+	/* Compression statistics */
+	int64_t started = gbn_now_ns();
+	state.bytes_raw = 0;
+	state.bytes_wire = 0;
+
+	state.state = ESTABLISHED;
+
+	while (base < total_packets) {
+		switch (state.state) {
+
+			/* Send the packets that fit in the window */
+		case ESTABLISHED:
+			pmtu_probe(sockfd, &pmtu);
+
+			while (next_seq_num < base + state.window_size && next_seq_num < total_packets) {
+				if (flags & GBN_BYTES) {
+					next_offset = cut_segment(next_seq_num, next_offset, len);
+				}
+				make_data_packet(DATA_packet, buf, flags, next_seq_num);
+
+				if (maybe_sendto(sockfd, DATA_packet, gbn_packet_size(DATA_packet), 0, (struct sockaddr*)&state.address, state.sck_len) == -1) {
+					printf("ERROR: Unable to send DATA packet.\n");
+					state.state = CLOSED;
+					break;
+				}
+				printf("SUCCESS: Sent DATA packet (%d)...\n", DATA_packet->seq);
+				sent_at[DATA_packet->seq] = gbn_now_ns();
+				retransmits[DATA_packet->seq] = 0;
+
+				/* A parity packet closes every group of k, only on first transmission */
+				if (state.fec_k > 0 && fec_add(&fec, DATA_packet, next_seq_num, next_seq_num + 1 == total_packets)) {
+					if (maybe_sendto(sockfd, &fec.parity, gbn_packet_size(&fec.parity), 0, (struct sockaddr*)&state.address, state.sck_len) == -1) {
+						printf("ERROR: Unable to send PARITY packet.\n");
+						state.state = CLOSED;
+						break;
+					}
+					printf("SUCCESS: Sent PARITY packet (%d, k: %d)...\n", fec.parity.seq, fec.parity.options);
+				}
+				next_seq_num++;
+			}
+
+			if (state.state == ESTABLISHED) {
+				start_timer(&timeout, buf, flags, skip_to > base ? skip_to : base, total_packets);
+				state.state = WAIT;
+			}
+			break;
+
+			/* Wait for ACKs until the timer runs out */
+		case WAIT:
+			result = gbn_wait(sockfd, &timeout);
+
+			if (result == -1) {
+				perror("select");
+				fec_free(&fec);
+				pmtu_free(&pmtu);
+				arena_release(arena, mark);
+				return -1;
+
+			}
+			else if (result == 0) { /* Timeout, retransmit the whole window */
+				printf("TIMEOUT: DATA packet (%d) lost\n", (uint8_t)base);
+				state.state = PACKET_LOSS;
+
+			}
+			else { /* Received a packet */
+				from_len = sizeof(from);
+				if (gbn_recvfrom(sockfd, ACK_packet, sizeof(*ACK_packet), 0, (struct sockaddr*)&from, &from_len) == -1) {
+					perror("Can't read from socket");
+					exit(EXIT_FAILURE);
+				}
+
+				if (ACK_packet->flags == ACK && ACK_packet->checksum == checksum(ACK_packet)) {
+					/* Cumulative ACK, seq is the next packet the receiver expects */
+					size_t acked = (uint8_t)(ACK_packet->seq - (uint8_t)base);
+
+					echo_rtt_sample(ACK_packet);
+
+					if (acked > 0 && acked <= next_seq_num - base) {
+						printf("Valid ACK packet! (seq: %d)\n", ACK_packet->seq);
+
+						/* Without timestamps, RTT from the newest packet acknowledged unless it was resent (Karn) */
+						int64_t sent = sent_at[(uint8_t)(ACK_packet->seq - 1)];
+						if (!(state.options & OPT_TSTAMP) && sent > 0) {
+							rtt_sample(gbn_now_ns() - sent);
+						}
+						base += acked;
+						attempts = 0;
+						state.handshake_unconfirmed = 0;
+						state.state = RCVD_ACK;
+					}
+					else {
+						printf("Duplicate ACK (seq: %d)\n", ACK_packet->seq);
+
+						/* The receiver saw a gap, count it towards the loss rate */
+						if (state.fec_k > 0 && base != loss_base) {
+							fec_loss(&fec, 1);
+							loss_base = base;
+						}
+					}
+				}
+				else if (ACK_packet->flags == PROBEACK && ACK_packet->checksum == checksum(ACK_packet)) {
+					/* New segments get the bigger size, the ones already cut keep theirs */
+					if (pmtu_ack(&pmtu, ACK_packet) && (flags & GBN_BYTES)) {
+						total_packets = count_segments(next_seq_num, next_offset, len);
+					}
+				}
+				else if (ACK_packet->flags == CHALLENGE) {
+					/* The receiver saw us from a new address, show it we are there */
+					path_respond(sockfd, ACK_packet);
+				}
+				else {
+					printf("Invalid ACK packet\n");
+				}
+			}
+			break;
+
+			/* Window moved, send what now fits and restart the timer */
+		case RCVD_ACK:
+			state.state = ESTABLISHED;
+			break;
+
+			/* Go back N, resend every unacknowledged packet */
+		case PACKET_LOSS:
+			if (state.fec_k > 0 && base != loss_base) {
+				fec_loss(&fec, 1);
+				loss_base = base;
+			}
+
+			/* Drop expired messages at the head of the window instead of resending them */
+			if (flags & GBN_MESSAGES) {
+				const gbn_message* msgs = buf;
+				int64_t now = gbn_now_ns();
+				size_t head = skip_to > base ? skip_to : base;
+				size_t first = head;
+
+				/* Unsent messages only expire by deadline, and the receiver can skip less than half the sequence space */
+				while (head < total_packets && head - base < 128 &&
+					message_expired(&msgs[head], head < next_seq_num ? retransmits[(uint8_t)head] : -1, now)) {
+					head++;
+				}
+
+				if (head > first) {
+					printf("Dropped %zu expired message(s)\n", head - first);
+					dropped += head - first;
+					skip_to = head;
+					attempts = 0;
+
+					/* Never send the unsent ones, a parity group must not have a hole */
+					if (next_seq_num < skip_to) {
+						if (state.fec_k > 0 && fec_flush(&fec)) {
+							maybe_sendto(sockfd, &fec.parity, gbn_packet_size(&fec.parity), 0, (struct sockaddr*)&state.address, state.sck_len);
+						}
+						next_seq_num = skip_to;
+					}
+				}
+
+				/* Repeated until the receiver's ACK confirms it */
+				if (skip_to > base && send_skip(sockfd, DATA_packet, skip_to) == -1) {
+					state.state = CLOSED;
+					break;
+				}
+			}
+
+			if (++attempts > MAX_ATTEMPTS) {
+				printf("ERROR: Max attempts are reached.\n");
+				state.state = CLOSED;
+				break;
+			}
+			resend_handshake_ack(sockfd);
+
+			/* Segments bigger than the path takes would never get through, cut the
+			 * unacknowledged ones again at the smaller size. Only from the packet the
+			 * receiver expects, it may have more than the ACKs that came back said */
+			if (pmtu_blackhole(&pmtu, attempts) && (flags & GBN_BYTES)) {
+				ssize_t expected = gbn_resync(sockfd, DATA_packet, base, next_seq_num);
+				if (expected < 0) {
+					state.state = CLOSED;
+					break;
+				}
+				if ((size_t)expected < next_seq_num) {
+					next_offset = seg_offset[expected % 256];
+				}
+				base = next_seq_num = expected;
+				total_packets = count_segments(next_seq_num, next_offset, len);
+
+				/* The open parity group has members that are cut again */
+				if (state.fec_k > 0) {
+					fec_restart(&fec);
+				}
+				attempts = 0;
+				state.state = ESTABLISHED;
+				break;
+			}
+			pmtu_probe(sockfd, &pmtu);
+
+			for (size_t i = skip_to > base ? skip_to : base; i < next_seq_num; i++) {
+				make_data_packet(DATA_packet, buf, flags, i);
+
+				if (maybe_sendto(sockfd, DATA_packet, gbn_packet_size(DATA_packet), 0, (struct sockaddr*)&state.address, state.sck_len) == -1) {
+					printf("ERROR: Unable to retransmit DATA packet.\n");
+					state.state = CLOSED;
+					break;
+				}
+				printf("SUCCESS: Retransmitted DATA packet (%d)...\n", DATA_packet->seq);
+				sent_at[DATA_packet->seq] = -1;
+				retransmits[DATA_packet->seq]++;
+			}
+
+			if (state.state == PACKET_LOSS) {
+				start_timer(&timeout, buf, flags, skip_to > base ? skip_to : base, total_packets);
+				state.state = WAIT;
+			}
+			break;
+
+			/* Gave up on the connection */
+		case CLOSED:
+			s_state = CLOSED;
+			fec_free(&fec);
+			pmtu_free(&pmtu);
+			arena_release(arena, mark);
+			return -1;
+
+		default:
+			break;
+		}
+	}
+
+	if (state.options & OPT_LZ) {
+		double seconds = (gbn_now_ns() - started) / 1e9;
+		printf("Compression: %llu payload bytes sent as %llu (ratio %.2f), %.1f MB/s\n",
+			(unsigned long long)state.bytes_raw, (unsigned long long)state.bytes_wire,
+			state.bytes_wire > 0 ? (double)state.bytes_raw / state.bytes_wire : 1.0,
+			seconds > 0 ? len / 1e6 / seconds : 0.0);
+	}
+
+	/* Free allocated memory */
+	fec_free(&fec);
+	pmtu_free(&pmtu);
+	arena_release(arena, mark);
+	return (ssize_t)(total_packets - dropped);
+}
+
+
+/* Timestamp for an ACK: the last DATA tstamp, moved on by the time it was held here so
+ * the sender measures the path and not our ACK delay */
+uint32_t ack_tstamp(int options, uint32_t ts_recent, int64_t ts_arrival) {
+	if (!(options & OPT_TSTAMP) || ts_recent == 0) {
+		return 0;
+	}
+	return ts_recent + (uint32_t)((gbn_now_ns() - ts_arrival) / 1000);
+}
+
+/* In-order packets an ACK may be held for: ACK_EVERY, fewer if the window is smaller.
+ * A sender with a full window waits for the ACK, more would only run out the delay timer */
+int ack_every(int window_size) {
+	if (window_size < 1) {
+		return 1;
+	}
+	return ACK_EVERY < window_size ? ACK_EVERY : window_size;
+}
+
+/* Send a cumulative ACK for everything before expSeq */
+static void send_ack(int sockfd, rtp* ACK_packet, uint8_t expSeq, const struct sockaddr* client, socklen_t client_len) {
+	ACK_packet->seq = expSeq;
+	ACK_packet->tstamp = ack_tstamp(state.options, state.ts_recent, state.ts_arrival);
+	ACK_packet->conn_id = state.conn_id;
+	ACK_packet->checksum = checksum(ACK_packet);
+
+	if (maybe_sendto(sockfd, ACK_packet, gbn_packet_size(ACK_packet), 0, client, client_len) == -1) {
+		perror("maybe_sendto");
+		exit(EXIT_FAILURE);
+	}
+	printf("Successfully sent ACK! (seq: %d)\n", ACK_packet->seq);
+}
+
+
+/* SYNs are checked with the handshake checksum, whatever options are in use */
+static int valid_syn(rtp* SYN_packet) {
+	int options = state.options;
+	int valid;
+
+	state.options = 0;
+	valid = SYN_packet->checksum == checksum(SYN_packet);
+	state.options = options;
+	return valid;
+}
+
+/* The payload of a DATA packet, decompressed into unpacked (MAXMSG bytes) if needed.
+ * Returns its length, or -1 if it does not decompress */
+ssize_t data_payload(const rtp* DATA_packet, const uint8_t** payload, uint8_t* unpacked) {
+	if (!(DATA_packet->len & LEN_COMPRESSED)) {
+		*payload = DATA_packet->data;
+		return DATA_packet->len <= MAXMSG ? DATA_packet->len : MAXMSG;
+	}
+
+	const gbn_codec* codec = gbn_codec_get(state.options);
+	size_t packed = DATA_packet->len & ~LEN_COMPRESSED;
+
+	if (codec == NULL || packed > MAXMSG) {
+		return -1;
+	}
+	*payload = unpacked;
+	return codec->decompress(DATA_packet->data, packed, unpacked, MAXMSG);
+}
+
+/* Hand an in-order payload to the application, right after the one before it or at the
+ * fixed offset of its segment in a striped transfer. Written straight to the file for GBN_FILE.
+ * Returns -1 and delivers nothing if the payload does not decompress */
+static int deliver_data(const rtp* DATA_packet, void* buf, size_t len, int flags, size_t* received, size_t* nSegments) {
+	size_t offset = state.stripe_count > 0 ? gbn_segment_offset(*nSegments) : *received;
+	size_t plen = DATA_packet->len <= MAXMSG ? DATA_packet->len : MAXMSG;
+	const uint8_t* payload;
+	uint8_t unpacked[MAXMSG];
+
+	if (DATA_packet->len & LEN_COMPRESSED) {
+		ssize_t size = data_payload(DATA_packet, &payload, unpacked);
+		if (size < 0) {
+			printf("ERROR: Can't decompress DATA packet (%d)\n", DATA_packet->seq);
+			return -1;
+		}
+		plen = size;
+	}
+	else {
+		payload = DATA_packet->data;
+	}
+
+	if (flags & GBN_FILE) {
+		int fd = *(int*)buf;
+
+		/* A resumed transfer starts where the checkpoint left off */
+		offset += state.resume_offset;
+		if (pwrite(fd, payload, plen, offset) != (ssize_t)plen) {
+			perror("pwrite");
+			exit(EXIT_FAILURE);
+		}
+		state.transfer_done = offset + plen;
+
+		/* Record progress once it is on disk */
+		if (state.transfer_id != 0 && state.transfer_done - state.checkpoint_at >= CHECKPOINT_EVERY) {
+			fdatasync(fd);
+			checkpoint_save(state.transfer_id, state.transfer_done);
+			state.checkpoint_at = state.transfer_done;
+		}
+	}
+	else if (offset < len) {
+		memcpy((uint8_t*)buf + offset, payload, plen < len - offset ? plen : len - offset);
+	}
+	*received += plen;
+	(*nSegments)++;
+	return 0;
+}
+
+
+ssize_t receiver_gbn(int sockfd, void* buf, size_t len, int flags) {
+	int result;
+
+	uint8_t expSeq = 0;     /* Next in-order sequence number */
+	int pending = 0;        /* In-order packets received but not yet acknowledged */
+	int ackArmed = 0;       /* ackTimer runs for the held ACK */
+	int ackEvery = ack_every(state.window_size);
+	int outOfOrder = 0;     /* Set when a gap has been seen, the next in-order packet fills it */
+	size_t nSegments = 0;   /* Segments delivered to buf */
+	size_t received = 0;    /* Bytes delivered to buf */
+
+	/* ACK delay timer */
+	struct timeval ackTimer;
+
+	/* Buffers of this transfer come from the connection's arena, all released on return */
+	gbn_arena* arena = arena_thread();
+	arena_mark mark = arena_get_mark(arena);
+
+	/* Initialize DATA packet */
+	rtp* DATA_packet = arena_alloc(arena, sizeof(*DATA_packet));
+	memset(DATA_packet->data, '\0', sizeof(DATA_packet->data));
+
+	/* Initilaze ACK packet */
+	rtp* ACK_packet = arena_alloc(arena, sizeof(*ACK_packet));
+	ACK_packet->flags = ACK;
+	memset(ACK_packet->data, '\0', sizeof(ACK_packet->data));
+
+	/* Where the last packet came from, replies go to state.address, the validated peer */
+	struct sockaddr_storage client_addr;
+	socklen_t client_len;
+
+	/* Buffered and rebuilt packets, if FEC was negotiated */
+	fec_t fec;
+	memset(&fec, 0, sizeof(fec));
+	if (state.fec_k > 0) {
+		fec_init(&fec, state.fec_k);
+	}
+
+	/* DATA arrival times from the kernel, the ACK delay is taken out of the echo */
+	state.ts_recent = 0;
+	if (state.options & OPT_TSTAMP) {
+		gbn_timestamps_init(sockfd);
+	}
+
+	while (r_state == ESTABLISHED) {
+
+		/* An ACK is being held back, wait no longer than ACK_DELAY for the next packet */
+		if (pending > 0) {
+
+			result = gbn_wait(sockfd, &ackTimer);
+
+			if (result == -1) {
+				perror("Select failed");
+				exit(EXIT_FAILURE);
+
+			}
+			else if (result == 0) { /* Delay timer expired, flush the held ACK */
+				printf("ACK delay expired\n");
+				send_ack(sockfd, ACK_packet, expSeq, (struct sockaddr*)&state.address, state.sck_len);
+				pending = 0;
+				ackArmed = 0;
+				continue;
+			}
+		}
+
+		client_len = sizeof(client_addr);
+		ssize_t nbytes = gbn_recvfrom(sockfd, DATA_packet, sizeof(*DATA_packet), 0, (struct sockaddr*)&client_addr, &client_len);
+		if (nbytes != -1) {
+			printf("Received a packet!\n");
+
+			/* Cut short on the way, whatever it claims to be */
+			if ((size_t)nbytes < gbn_packet_size(DATA_packet)) {
+				printf("Short packet (%zd bytes)\n", nbytes);
+				continue;
+			}
+
+			/* Our connection id from a new address, the peer may be behind a NAT that rebound */
+			result = path_check(sockfd, &state.path, DATA_packet, (struct sockaddr*)&client_addr, client_len, &state.address, &state.sck_len);
+			if (result == 0) {
+				continue;
+			}
+			else if (result == 2) { /* Moved, ACKs sent to the old address were lost */
+				send_ack(sockfd, ACK_packet, expSeq, (struct sockaddr*)&state.address, state.sck_len);
+				pending = 0;
+				ackArmed = 0;
+				continue;
+			}
+
+			/* If the packet is a FIN */
+			if (DATA_packet->flags == FIN && DATA_packet->checksum == checksum(DATA_packet)) {
+				printf("Received a valid FIN packet!\n");
+
+				/* Do not leave the sender waiting for a held ACK */
+				if (pending > 0) {
+					send_ack(sockfd, ACK_packet, expSeq, (struct sockaddr*)&state.address, state.sck_len);
+				}
+
+				fec_free(&fec);
+				arena_release(arena, mark);
+				return received;
+
+			}
+			else if (DATA_packet->flags == SYN && valid_syn(DATA_packet)) {
+				/* The sender gave up and is connecting again, its SYN is retransmitted for receiver_connection */
+				printf("Received a SYN, sender is reconnecting\n");
+				r_state = CLOSED;
+
+				fec_free(&fec);
+				arena_release(arena, mark);
+				return -1;
+
+			}
+			else { /* If the packet is not FIN*/
+				int advanced = 0;   /* expSeq moved forward */
+
+				if (DATA_packet->flags == DATA && DATA_packet->checksum == checksum(DATA_packet)) {
+					printf("Received a valid DATA packet!\n");
+
+					/* Echoed by the next ACK, rebuilt packets never arrived and are not */
+					if (DATA_packet->tstamp != 0) {
+						state.ts_recent = DATA_packet->tstamp;
+						state.ts_arrival = gbn_rx_time();
+					}
+
+					/* If the data packet has expected sequence number */
+					if (DATA_packet->seq == expSeq) {
+						printf("Data packet has expected sequence number!\n");
+						if (state.fec_k > 0) {
+							fec_store(&fec, DATA_packet, nSegments);
+						}
+						if (deliver_data(DATA_packet, buf, len, flags, &received, &nSegments) == 0) {
+							expSeq++;
+							pending++;
+							advanced = 1;
+						}
+						else if (state.fec_k > 0) { /* Not acknowledged, it comes again */
+							fec_forget(&fec, nSegments);
+						}
+
+					}
+					else { /* wrong sequence number, resend old ACK at once */
+						printf("DATA packet has wrong sequence number!\n");
+
+						/* With FEC, keep packets ahead of the gap for when it is repaired */
+						uint8_t ahead = DATA_packet->seq - expSeq;
+						if (state.fec_k > 0 && ahead < 128) {
+							fec_store(&fec, DATA_packet, nSegments + ahead);
+						}
+
+						send_ack(sockfd, ACK_packet, expSeq, (struct sockaddr*)&state.address, state.sck_len);
+						outOfOrder = 1;
+						pending = 0;
+						ackArmed = 0;
+					}
+				}
+				else if (DATA_packet->flags == SKIP && DATA_packet->checksum == checksum(DATA_packet)) {
+					/* The sender dropped expired packets, continue after them and ACK at once */
+					uint8_t ahead = DATA_packet->seq - expSeq;
+					if (ahead < 128) {
+						if (ahead > 0) {
+							printf("Sender dropped %d packet(s), skipping to (%d)\n", ahead, DATA_packet->seq);
+						}
+						expSeq = DATA_packet->seq;
+						nSegments += ahead;
+						outOfOrder = 1;
+						advanced = 1;
+					}
+					else { /* We already got past the dropped packets, the sender missed our ACK */
+						send_ack(sockfd, ACK_packet, expSeq, (struct sockaddr*)&state.address, state.sck_len);
+					}
+
+					/* The sender may cut what follows again (pmtu_blackhole), buffered
+					 * packets from before could belong to other segments */
+					if (state.fec_k > 0) {
+						fec_forget(&fec, nSegments);
+					}
+				}
+				else if (DATA_packet->flags == PARITY && state.fec_k > 0 && DATA_packet->checksum == checksum(DATA_packet)) {
+					printf("Received a valid PARITY packet! (%d, k: %d)\n", DATA_packet->seq, DATA_packet->options);
+
+					/* Packet number of the first member of the group */
+					uint8_t ahead = DATA_packet->seq - expSeq;
+					size_t start = ahead < 128 ? nSegments + ahead : nSegments - (uint8_t)(expSeq - DATA_packet->seq);
+					fec_parity(&fec, DATA_packet, start);
+				}
+				else if (DATA_packet->flags == PROBE && DATA_packet->checksum == checksum(DATA_packet)) {
+					/* It got here at this size, tell the sender */
+					printf("Received a PMTU probe (%d bytes)\n", DATA_packet->len);
+					pmtu_answer(sockfd, DATA_packet, (struct sockaddr*)&state.address, state.sck_len);
+				}
+				else if (DATA_packet->flags == KEEPALIVE && DATA_packet->checksum == checksum(DATA_packet)) {
+					printf("Received a KEEPALIVE\n");
+					path_keepalive_answer(sockfd, DATA_packet, (struct sockaddr*)&state.address, state.sck_len);
+				}
+				else if (DATA_packet->flags == ACK && state.transfer_id != 0 && nSegments == 0 && DATA_packet->checksum == checksum(DATA_packet)) {
+					/* The handshake ACK again, the sender of a resumed transfer missed our answer */
+					send_resume_answer(sockfd);
+				}
+
+				/* Deliver packets buffered ahead of a gap, or rebuilt from parity */
+				if (state.fec_k > 0) {
+					rtp* next;
+					while ((next = fec_next(&fec, nSegments)) != NULL) {
+						if (deliver_data(next, buf, len, flags, &received, &nSegments) < 0) {
+							fec_forget(&fec, nSegments);
+							break;
+						}
+						expSeq++;
+						pending++;
+						advanced = 1;
+					}
+				}
+
+				if (advanced) {
+					/* ACK at once if this fills a gap, otherwise only every ackEvery packets */
+					if (outOfOrder || pending >= ackEvery) {
+						send_ack(sockfd, ACK_packet, expSeq, (struct sockaddr*)&state.address, state.sck_len);
+						outOfOrder = 0;
+						pending = 0;
+						ackArmed = 0;
+					}
+					else if (!ackArmed) { /* First held packet(s), start the delay timer */
+						ackTimer.tv_sec = 0;
+						ackTimer.tv_usec = ACK_DELAY;
+						ackArmed = 1;
+					}
+				}
+			}
+
+		}
+		else {
+			r_state = CLOSED;
+			perror("Can't read from socket\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* free allocated memory */
+	fec_free(&fec);
+	arena_release(arena, mark);
+	return received;
+}
+
+/* Checksum calculator, CRC32C if negotiated otherwise the 16-bit ones' complement sum */
+uint32_t checksum(rtp* packet) {
+	/* Only the bytes that are sent, packets go without the unused data */
+	size_t used = gbn_packet_size(packet) - offsetof(rtp, data);
+
+	if (state.options & OPT_CRC32C) {
+		/* The header in two runs, flags to len and the union to conn_id, the two
+		 * padding bytes between them are not set by every packet */
+		uint32_t crc = crc32c(0, &packet->flags, offsetof(rtp, len) + sizeof(packet->len));
+		crc = crc32c(crc, &packet->tstamp, offsetof(rtp, checksum) - offsetof(rtp, tstamp));
+		return crc32c(crc, packet->data, used);
+	}
+
+	/* Combine seq and flags fields of the packet into the first word, stream and options
+	 * into the second, then len, the window size, timestamp or parity length that shares
+	 * its place and the connection id */
+	uint32_t sum = (uint16_t)packet->seq + ((uint16_t)packet->flags << 8);
+	sum += ((uint16_t)packet->stream << 8) + packet->options;
+	sum += packet->len;
+	sum += (packet->tstamp >> 16) + (packet->tstamp & 0xffff);
+	sum += (packet->conn_id >> 16) + (packet->conn_id & 0xffff);
+
+	/* The data as 16-bit words, first byte in the higher byte. An odd last byte
+	 * is a word of its own */
+	for (size_t i = 0; i < used; i += 2) {
+		uint16_t word = (uint16_t)packet->data[i] << 8;
+
+		if (i + 1 < used) {
+			word += packet->data[i + 1];
+		}
+		sum += word;
+	}
+
+	/* Reduce the sum to a 16-bit value by adding the carry from the high
+	 * 16 bits to the low 16 bits */
+	sum = (sum >> 16) + (sum & 0xffff);
+
+	sum += (sum >> 16);  /* Add any carry from the previous step */
+	return ~sum;    /* Return the one's complement of the sum */
+
+}
+
+
+/* CRC32C (Castagnoli), table used when the CPU has no crc32 instruction */
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static uint32_t (*crc32c_impl)(uint32_t crc, const uint8_t* p, size_t len);   /* Chosen once by crc32c_init */
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t* p, size_t len) {
+	while (len--) {
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+/* SSE4.2 crc32 instruction, eight bytes at a time */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t len) {
+	uint64_t c = crc;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		c = __builtin_ia32_crc32di(c, word);
+	}
+	crc = (uint32_t)c;
+	while (len--) {
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+	}
+	return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/* ARMv8 CRC32C instructions, eight bytes at a time */
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t len) {
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		crc = __crc32cd(crc, word);
+	}
+	while (len--) {
+		crc = __crc32cb(crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+/* Build the table and pick the instruction or the table, once per process */
+static void crc32c_init(void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) {
+			c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+		}
+		crc32c_table[i] = c;
+	}
+
+	crc32c_impl = crc32c_sw;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc32c_impl = crc32c_hw;
+	}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	crc32c_impl = crc32c_hw;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len) {
+	pthread_once(&crc32c_once, crc32c_init);
+	return ~crc32c_impl(~crc, buf, len);
+}
+
+
+/* ERROR generator */
+ssize_t maybe_sendto(int sockfd, const void* buf, size_t len, int flags, const struct sockaddr* to, socklen_t tolen) {
+	const char* buffer = buf;
+	char corrupted[sizeof(rtp)];
+
+	/* Packet not lost */
+	if (rand() > LOSS_PROB * RAND_MAX) {
+
+		/* Packet corrupted, only then is a copy needed */
+		if (rand() < CORR_PROB * RAND_MAX && len <= sizeof(corrupted)) {
+			memcpy(corrupted, buf, len);
+
+			/* Selecting a random byte inside the packet */
+			int index = (int)((len - 1) * rand() / (RAND_MAX + 1.0));
+
+			/* Inverting a bit */
+			char c = corrupted[index];
+			if (c & 0x01) {
+				c &= 0xFE;
+			}
+			else {
+				c |= 0x01;
+			}
+			corrupted[index] = c;
+			buffer = corrupted;
+
+			/* The packet as it should have been, gbn_sendto records what went out */
+			gbn_pcap_packet(PCAP_CORRUPTED, sockfd, buf, len, to, gbn_now_ns());
+		}
+
+		/* Sending the packet */
+		int result = gbn_sendto(sockfd, buffer, len, flags, to, tolen);
+		if (result == -1 && errno == EMSGSIZE) {
+			/* Bigger than the path takes with don't-fragment set, lost as it would be on the way */
+			gbn_pcap_packet(PCAP_DROPPED, sockfd, buf, len, to, gbn_now_ns());
+			return len;
+		}
+		if (result == -1) {
+			perror("maybe_sendto problem");
+			exit(EXIT_FAILURE);
+		}
+		/* Return the bytes sent */
+		return result;
+
+	}
+	else { /* Packet lost */
+		gbn_pcap_packet(PCAP_DROPPED, sockfd, buf, len, to, gbn_now_ns());
+		return(len);
+	}
+}
@@ -1,95 +1,486 @@
-/* File: GBN.h
- * Authors: Kim Svedberg, Zebastian Thorsn
- * Description: File containing protocol varibles and states.
- */
-
-#ifndef gbn_h
-#define gbn_h
-
-#include <stdio.h>
-#include <errno.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h>
-#include <arpa/inet.h>
-#include <sys/time.h>
-
-
- /* Protocal parameters */
-#define hostNameLength 50   /* The lenght of host name*/
-#define windowSize 1        /* Sliding window size */
-#define MAXMSG 1024         /* Maximun data to be sent once*/
-#define LOSS_PROB 1e-2      /* Packet loss probability */
-#define CORR_PROB 1e-3      /* Packet corrution probability */
-#define MAX_SEQ_NUM 100     /* The maximum random sequence number */
-#define MIN_SEQ_NUM 5       /* The minimum random sequence number */
-
-/* Packet flags */
-#define SYN 0                  
-#define SYNACK 1
-#define DATA 2
-#define ACK 3
-#define FIN 4
-#define FINACK 5
-
-int s_state;            /* Sender state */
-int r_state;            /* Receiver state */
-
-/* All possible states */
-enum states {
-    CLOSED,
-    WAIT_SYNACK,
-    RCVD_SYNACK,
-    ESTABLISHED,
-    WAIT,
-    SEND_DATA,
-    PACKET_LOSS,
-    RCVD_ACK,
-    WAIT_FINACK,
-    RCVD_FINACK,
-    WAIT_TIME,
-    LISTENING,
-    RCVD_SYN,
-    WAIT_ACK,
-    READ_DATA,
-    DEFAULT,
-    RCVD_FIN,
-};
-
-/* Transport protocol header */
-typedef struct rtp_struct {
-    uint8_t flags;
-    //int id; If there are more then one connections
-    uint8_t seq;
-    int windowsize; /////////////////////////////////
-    uint16_t checksum;
-    uint8_t  data[MAXMSG];
-} rtp;
-
-/* State information (Maybe not needed)*/
-typedef struct states_t {
-    int state;
-    int seqnum;
-    int window_size;
-} state_t;
-
-
-/* All function for the protocol */
-int sender_connection(int sockfd, const struct sockaddr* serverName, socklen_t socklen);
-int receiver_connection(int sockfd, const struct sockaddr* client, socklen_t* socklen);
-
-ssize_t sender_gbn(int sockfd, const void* buf, size_t len, int flags);
-ssize_t receiver_gbn(int sockfd, void* buf, size_t len, int flags);
-ssize_t maybe_sendto(int sockfd, const void* buf, size_t len, int flags,
-    const struct sockaddr* to, socklen_t tolen);
-
-int sender_teardown(int sockfd, const struct sockaddr* serverName, socklen_t socklen);
-int receiver_teardown(int sockfd, const struct sockaddr* client, socklen_t socklen);
-
-uint16_t checksum(rtp* packet);
-
+/* File: GBN.h
+ * Authors: Kim Svedberg, Zebastian Thorsn
+ * Description: File containing protocol varibles and states.
+ */
+
+#ifndef gbn_h
+#define gbn_h
+
+#include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+
+ /* Protocal parameters */
+#define hostNameLength 50   /* The lenght of host name*/
+#define windowSize 32       /* Largest sliding window, offered in the SYN and accepted in the SYNACK, under 128 */
+#define MAXMSG 8952         /* Largest segment, the payload of a 9000 byte IPv4 frame */
+#define BASE_MSS 1024       /* Segment size before the path has been probed */
+#define LOSS_PROB 1e-2      /* Packet loss probability */
+#define CORR_PROB 1e-3      /* Packet corrution probability */
+#define MAX_SEQ_NUM 100     /* The maximum random sequence number */
+#define MIN_SEQ_NUM 5       /* The minimum random sequence number */
+#define ACK_EVERY 2         /* Receiver acknowledges every Nth in-order packet */
+#define ACK_DELAY 40000     /* Longest an ACK may be held back (usec) */
+#define MAX_ATTEMPTS 10     /* Timeouts in a row before the sender gives up */
+#define MAX_STREAMS 16      /* Streams in one connection */
+#define FEC_K 8             /* DATA packets per PARITY packet we ask for */
+#define FEC_MIN_K 2         /* Smallest group when adapting to loss */
+#define FEC_MAX_K 64        /* Largest group accepted */
+#define PACING_RATE 0       /* Send rate limit (bytes/s), 0 = one window per RTT */
+#define PACING_BURST 4      /* Packets that may leave back to back */
+#define PACE_TXTIME 0       /* 1 = let the fq qdisc pace with SO_TXTIME (needs fq on the interface) */
+#define CHECKPOINT_DIR "."  /* Where the receiver keeps transfer checkpoints */
+#define CHECKPOINT_EVERY (4 << 20) /* Bytes written between checkpoints */
+#define COMPRESS 1          /* 1 = offer payload compression in the SYN */
+#define COOKIE_LIFETIME 30  /* Seconds a SYNACK cookie can be answered */
+#define SERVER_MAX_CONNS 1024   /* Connections per server worker, power of two */
+#define SERVER_BATCH 32     /* Packets received per system call by a server worker */
+#define SERVER_IDLE 30      /* Seconds before a silent server connection is dropped */
+#define TIMESTAMPS 1        /* 1 = offer timestamp echo in the SYN, for RTT samples of resent packets */
+#define PMTU_PROBES 3       /* Probes of one size lost before the path is taken not to carry it */
+#define PMTU_STEP 64        /* Path MTU search stops when the range is smaller than this */
+#define PMTU_BLACKHOLE 2    /* Timeouts in a row before the segment size falls back to BASE_MSS */
+#define QUEUE_WRITES 1024   /* Writes an async send queue holds, more fail with EAGAIN */
+#define QUEUE_POLL 200      /* Longest the queue's sender waits for ACKs while the window has room (usec) */
+#define ARENA_CHUNK (2 << 20)   /* Arena memory is mapped in multiples of this, one huge page */
+#define ARENA_HUGEPAGES 1   /* 1 = back arenas with huge pages where the system has them */
+#define KEEPALIVE_IDLE 15   /* Seconds an idle connection waits before it sends a KEEPALIVE, below SERVER_IDLE and NAT timeouts */
+#define KEEPALIVE_TRIES 3   /* KEEPALIVEs without an answer before the peer is taken to be gone */
+#define PATH_RETRY 200000   /* Least time between CHALLENGEs to a new peer address (usec) */
+#define PIPELINE_SLOTS 128  /* Packets the pipelined sender builds ahead of the window, power of two, caps the window */
+#define PIPELINE_CPU -1     /* CPU of the pipelined sender's first stage, the others on the next ones, -1 = not pinned */
+
+/* I/O backends */
+#define IO_SOCKET 0             /* sendto/recvfrom/select, one syscall per packet */
+#define IO_URING 1              /* Batched io_uring submissions, Linux only */
+
+/* Capture events (GBN_pcap.c) */
+#define PCAP_SENT 0             /* Handed to the socket or transport */
+#define PCAP_RECEIVED 1
+#define PCAP_DROPPED 2          /* Lost on purpose by maybe_sendto, never sent */
+#define PCAP_CORRUPTED 3        /* Corrupted by maybe_sendto, the packet before it was, a PCAP_SENT with the damage follows */
+
+/* sender_gbn/receiver_gbn flags */
+#define GBN_BYTES 0x01          /* buf is a byte buffer cut in segments of state.mss, not an array of strings */
+#define GBN_FILE 0x02           /* receiver_gbn: buf points to a file descriptor, segments are written with pwrite */
+#define GBN_MESSAGES 0x04       /* sender_gbn: buf is an array of len gbn_message, expired ones are dropped */
+#define GBN_PIPELINE 0x08       /* sender_gbn with GBN_BYTES: build, send and take ACKs on three threads (GBN_pipeline.c) */
+
+/* Packet flags */
+#define SYN 0                  
+#define SYNACK 1
+#define DATA 2
+#define ACK 3
+#define FIN 4
+#define FINACK 5
+#define PARITY 6
+#define SKIP 7                  /* Sender dropped expired packets, seq is the next one it sends */
+#define PROBE 8                 /* Path MTU probe, len bytes of padding, sent with DF set */
+#define PROBEACK 9              /* Answer to a PROBE, seq and len as in the probe */
+#define CHALLENGE 10            /* Path validation, to a new address of the peer, the data starts with a token */
+#define RESPONSE 11             /* Answer to a CHALLENGE with its token, from the address that was challenged */
+#define KEEPALIVE 12            /* Sent by an idle connection, keeps NAT bindings and shows the peer is there */
+#define KEEPALIVEACK 13         /* Answer to a KEEPALIVE */
+
+/* DATA len: the payload is compressed, the rest of len is its compressed size */
+#define LEN_COMPRESSED 0x8000
+
+/* Options negotiated in the SYN, the SYNACK carries the agreed subset */
+#define OPT_CRC32C 0x01         /* CRC32C instead of the 16-bit checksum */
+#define OPT_FEC 0x02            /* XOR parity packets, group size in syn_params */
+#define OPT_LZ 0x04             /* LZ compressed DATA payloads, sent without the unused data */
+#define OPT_TSTAMP 0x08         /* DATA carries its send time, ACKs echo it */
+#define LOCAL_OPTIONS (OPT_CRC32C | OPT_FEC | (COMPRESS ? OPT_LZ : 0) | (TIMESTAMPS ? OPT_TSTAMP : 0)) /* Options this end asks for or accepts */
+
+extern __thread int s_state;     /* Sender state */
+extern __thread int r_state;     /* Receiver state */
+extern __thread int io_backend;  /* I/O backend of this thread (GBN_io.c) */
+
+/* All possible states */
+enum states {
+    CLOSED,
+    WAIT_SYNACK,
+    RCVD_SYNACK,
+    ESTABLISHED,
+    WAIT,
+    SEND_DATA,
+    PACKET_LOSS,
+    RCVD_ACK,
+    WAIT_FINACK,
+    RCVD_FINACK,
+    WAIT_TIME,
+    LISTENING,
+    RCVD_SYN,
+    WAIT_ACK,
+    READ_DATA,
+    DEFAULT,
+    RCVD_FIN,
+};
+
+/* Transport protocol header */
+typedef struct rtp_struct {
+    uint8_t flags;
+    uint8_t seq;
+    uint8_t options;
+    uint8_t stream; /* Stream the packet belongs to, 0 if not multiplexed */
+    uint16_t len;   /* Bytes of data used */
+    union {
+        int windowsize;     /* SYN, SYNACK and handshake ACK */
+        uint32_t tstamp;    /* OPT_TSTAMP, DATA: send time (us), ACK: a DATA tstamp plus the time it was held, 0 for none */
+        uint32_t parity_len;    /* PARITY: bytes of data used, the longest member's */
+    };
+    uint32_t conn_id;   /* Given by the receiver in the handshake, 0 before. Identifies the connection when the peer's address changes */
+    uint32_t checksum;
+    uint8_t  data[MAXMSG];
+} rtp;
+
+/* Parameters carried in the data of SYN and SYNACK */
+typedef struct __attribute__((packed)) syn_params_t {
+    uint8_t fec_k;  /* DATA packets per PARITY packet, the SYNACK holds the agreed value */
+    uint64_t transfer_id;   /* File transfer to resume, 0 for none */
+    uint64_t resume_offset; /* Receiver's answer to the ACK: bytes of the transfer it already has */
+    uint16_t mss;           /* Largest segment the sender's route takes, the SYNACK holds the agreed one */
+    uint32_t conn_id;       /* SYNACK and ACK: the connection id the receiver gave */
+    uint32_t cookie_time;   /* SYNACK and ACK: when the receiver made the cookie */
+    uint64_t cookie;        /* SYNACK and ACK: keyed hash of the above, see GBN_cookie.c */
+} syn_params;
+
+/* A new address of the peer being validated (GBN_path.c) */
+typedef struct gbn_path_t {
+    struct sockaddr_storage address;    /* Where packets with our connection id came from */
+    socklen_t len;          /* 0 while no address is being validated */
+    uint64_t token;         /* In the CHALLENGE sent there, the RESPONSE must echo it */
+    int64_t sent_at;
+} gbn_path;
+
+/* State information (Maybe not needed)*/
+typedef struct states_t {
+    int state;
+    int seqnum;
+    int window_size;
+    int options;    /* Options agreed in the handshake */
+    struct sockaddr_storage address;   /* Peer */
+    socklen_t sck_len;
+    uint32_t conn_id;   /* Connection id, in every packet after the handshake */
+    gbn_path path;      /* Receiver: a new address of the peer, not validated yet */
+    int stripe_index;   /* This flow's number in a striped transfer */
+    int stripe_count;   /* Flows in a striped transfer, 0 if not striped */
+    int fec_k;          /* Agreed FEC group size, 0 without FEC */
+    int mss;            /* Segment size in use */
+    int mss_max;        /* Agreed largest segment, the sender probes up to it */
+    int64_t srtt_ns;    /* Smoothed round trip time, 0 before the first sample */
+    uint64_t transfer_id;   /* Resumable transfer, set before the handshake */
+    uint64_t resume_offset; /* Byte the transfer continues from */
+    uint64_t transfer_done; /* Receiver: bytes of the file written in order */
+    uint64_t checkpoint_at; /* Receiver: transfer_done at the last checkpoint */
+    uint64_t bytes_raw;     /* Sender: payload bytes handed to the codec */
+    uint64_t bytes_wire;    /* Sender: payload bytes after compression */
+    int handshake_unconfirmed;  /* Sender: nothing heard since the handshake ACK, it may have been lost */
+    uint32_t ts_recent;     /* Receiver: tstamp of the last DATA packet, echoed in ACKs */
+    int64_t ts_arrival;     /* Receiver: when that packet arrived */
+} state_t;
+
+extern __thread state_t state;  /* Connection driven by this thread */
+
+/* XOR parity state (GBN_fec.c) */
+typedef struct fec_t {
+    /* Sender */
+    int k;                  /* Group size for the next group */
+    int max_k;              /* Negotiated group size */
+    int group_k;            /* Group size of the open group */
+    size_t group_start;
+    int count;              /* Packets in the open group */
+    size_t sent;            /* Packets and losses since k was last adjusted */
+    size_t lost;
+    rtp parity;
+
+    /* Receiver, slots indexed by packet number % 256 */
+    rtp* slots;
+    size_t* slot_abs;
+    rtp* par_slots;
+    size_t* par_abs;
+} fec_t;
+
+/* Path MTU search of a sender (GBN_pmtu.c) */
+typedef struct pmtu_t {
+    int lo;                 /* Largest segment known to get through */
+    int hi;                 /* Largest segment not ruled out */
+    int size;               /* Segment size of the probe in flight, 0 for none */
+    int tries;              /* Probes of that size lost */
+    int failed;             /* A probe size was given up, search by halving from now on */
+    uint8_t seq;            /* Sequence number of the probe in flight */
+    int64_t sent_at;
+    rtp* probe;
+    int sockfd;
+    int df_mode;            /* The socket's don't-fragment mode before probing, see gbn_df_set */
+} pmtu_t;
+
+/* One stream of a multiplexed connection (GBN_stream.c) */
+typedef struct gbn_stream_t {
+    const void* send_buf;   /* Bytes to send */
+    void* recv_buf;         /* Room for received bytes */
+    size_t len;
+    size_t done;            /* Bytes acknowledged (sender) or delivered (receiver) */
+    void (*deliver)(int stream, const void* data, size_t len);  /* In-order data, may be NULL */
+
+    /* Sender side Go-Back-N state */
+    size_t base;
+    size_t next;
+    int attempts;
+    int64_t deadline;
+} gbn_stream;
+/* A message with partial reliability, one DATA packet each (sender_gbn with GBN_MESSAGES,
+ * which returns the number of messages not dropped) */
+typedef struct gbn_message_t {
+    const void* data;
+    size_t len;             /* At most state.mss */
+    int64_t deadline_ns;    /* Dropped at this gbn_now_ns() time, 0 for no deadline */
+    int max_retransmits;    /* Dropped instead of being resent more often, -1 for no limit */
+} gbn_message;
+
+/* A connection served by a server worker (GBN_server.c) */
+typedef struct gbn_conn_t {
+    uint32_t id;            /* Connection id, owning worker << 24 | random bits */
+    struct sockaddr_storage peer;
+    socklen_t peer_len;
+    int state;              /* ESTABLISHED, RCVD_FIN, or CLOSED when the entry is free */
+    int options;
+    int window_size;
+    size_t received;        /* Bytes handed to on_data */
+    void* user;             /* Free for the application */
+
+    /* Receiver side Go-Back-N state */
+    uint8_t expSeq;
+    uint8_t fin_seq;
+    int pending;
+    int outOfOrder;
+    int attempts;
+    int64_t ack_at;         /* Held ACK is sent at this time, 0 while none is held */
+    int64_t fin_at;         /* FINACK is resent at this time */
+    int64_t last_seen;
+    uint32_t ts_recent;     /* Timestamp echo, as in state_t */
+    int64_t ts_arrival;
+    gbn_path path;          /* New peer address being validated, as in state_t */
+
+    /* Owned by the worker */
+    struct gbn_conn_t* hash_next;
+    struct gbn_conn_t* id_next;     /* Chain of the id table, NULL if the id is not in it */
+    struct gbn_conn_t* timer_next;
+    struct gbn_conn_t* timer_prev;
+    int64_t timer_at;
+    int timer_slot;
+} gbn_conn;
+
+typedef struct gbn_server_config_t {
+    int port;
+    int workers;            /* 0 for one per online CPU */
+    int pin_cpus;           /* Pin worker i to CPU i */
+    void (*on_data)(gbn_conn* conn, const void* data, size_t len);  /* In-order data, called by the owning worker */
+    void (*on_close)(gbn_conn* conn);   /* May be NULL */
+} gbn_server_config;
+
+typedef struct gbn_server_t gbn_server;
+
+/* Bump allocator over huge page chunks, released in bulk (GBN_arena.c) */
+typedef struct gbn_arena_t {
+    struct arena_chunk_t* chunks;   /* In use, newest first */
+    struct arena_chunk_t* spare;    /* Released, kept for reuse */
+    size_t used;                    /* Bytes used of the newest chunk */
+    int node;                       /* NUMA node of the chunks, -1 unknown, -2 not looked up yet */
+} gbn_arena;
+
+typedef struct arena_mark_t {
+    struct arena_chunk_t* chunk;
+    size_t used;
+} arena_mark;
+
+/* Header of a captured packet, the packet as it went on the wire follows (GBN_pcap.c) */
+typedef struct __attribute__((packed)) pcap_gbn_t {
+    uint8_t event;          /* PCAP_SENT, PCAP_RECEIVED, PCAP_DROPPED or PCAP_CORRUPTED */
+    uint8_t family;         /* Peer address family, 0 if unknown */
+    uint16_t port;          /* Peer port, network byte order */
+    uint8_t addr[16];       /* Peer address, IPv4 in the first 4 bytes */
+    int32_t sockfd;         /* Our end */
+} pcap_gbn;
+
+/* Async send queue, done is called by its sender thread when a write is acknowledged in
+ * full, with the write and where it starts in the connection's byte stream (GBN_queue.c) */
+typedef void (*gbn_queue_done)(void* arg, const void* buf, uint64_t offset, size_t len);
+typedef struct gbn_queue_t gbn_queue;
+
+/* Payload codec, selected by an option bit (GBN_compress.c) */
+typedef struct gbn_codec_t {
+    const char* name;
+    int option;
+    size_t (*compress)(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);       /* 0 if it does not shrink */
+    ssize_t (*decompress)(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);    /* -1 on bad input */
+} gbn_codec;
+
+/* Packet transport behind a descriptor, used instead of the socket calls (GBN_transport.c) */
+typedef struct gbn_transport_t {
+    const char* name;
+    ssize_t (*sendto)(void* ctx, const void* buf, size_t len, const struct sockaddr* to, socklen_t tolen);
+    ssize_t (*recvfrom)(void* ctx, void* buf, size_t len, struct sockaddr* from, socklen_t* fromlen);
+    int (*wait_ns)(void* ctx, int64_t* timeout_ns);     /* Like gbn_wait_ns */
+    int64_t (*now_ns)(void* ctx);   /* Virtual clock, NULL for the real one */
+    void (*close)(void* ctx);       /* May be NULL */
+    void* ctx;
+} gbn_transport;
+
+
+/* All function for the protocol */
+int sender_connection(int sockfd, const struct sockaddr* serverName, socklen_t socklen);
+int receiver_connection(int sockfd, const struct sockaddr* client, socklen_t* socklen);
+void make_synack(rtp* packet, const struct sockaddr* client, int options, uint32_t conn_id);
+int accept_ack(rtp* packet, const struct sockaddr* client);
+
+ssize_t sender_gbn(int sockfd, const void* buf, size_t len, int flags);
+ssize_t receiver_gbn(int sockfd, void* buf, size_t len, int flags);
+ssize_t maybe_sendto(int sockfd, const void* buf, size_t len, int flags,
+    const struct sockaddr* to, socklen_t tolen);
+
+size_t gbn_segments(size_t len);
+size_t gbn_segment_offset(size_t n);
+size_t gbn_packet_size(const rtp* packet);
+ssize_t data_payload(const rtp* DATA_packet, const uint8_t** payload, uint8_t* unpacked);
+void data_packet_fill(rtp* DATA_packet, const uint8_t* segment, size_t size);
+void rtt_sample(int64_t rtt);
+void pace_update(void);
+int echo_rtt_sample(const rtp* ACK_packet);
+
+void resend_handshake_ack(int sockfd);
+void send_resume_answer(int sockfd);
+ssize_t gbn_resync(int sockfd, rtp* packet, size_t base, size_t next);
+uint32_t ack_tstamp(int options, uint32_t ts_recent, int64_t ts_arrival);
+int ack_every(int window_size);
+
+int sender_teardown(int sockfd, const struct sockaddr* serverName, socklen_t socklen);
+int receiver_teardown(int sockfd, const struct sockaddr* client, socklen_t socklen);
+
+/* File transfers (GBN_file.c) */
+ssize_t sender_file(int sockfd, const char* path);
+ssize_t receiver_file(int sockfd, const char* path);
+uint64_t file_transfer_id(const char* path);
+uint64_t checkpoint_load(uint64_t id);
+void checkpoint_save(uint64_t id, uint64_t done);
+void checkpoint_clear(uint64_t id);
+
+/* Striped transfers (GBN_stripe.c) */
+int stripe_open(int port, int nflows, int* sockfds);
+ssize_t stripe_send(const int* sockfds, int nflows, const struct sockaddr_in* server, const void* buf, size_t len);
+ssize_t stripe_recv(const int* sockfds, int nflows, void* buf, size_t len);
+
+/* Multiplexed streams (GBN_stream.c) */
+ssize_t sender_streams(int sockfd, gbn_stream* streams, int nstreams);
+ssize_t receiver_streams(int sockfd, gbn_stream* streams, int nstreams);
+
+/* Asynchronous sending (GBN_queue.c) */
+gbn_queue* gbn_queue_open(int sockfd, gbn_queue_done done, void* arg);
+int64_t gbn_write_async(gbn_queue* queue, const void* buf, size_t len);
+int gbn_queue_fd(const gbn_queue* queue);
+int gbn_queue_close(gbn_queue* queue);
+
+/* Pipelined sending (GBN_pipeline.c) */
+ssize_t sender_pipelined(int sockfd, const void* buf, size_t len);
+
+/* Arena allocator (GBN_arena.c) */
+void arena_init(gbn_arena* arena);
+gbn_arena* arena_thread(void);
+void* arena_alloc(gbn_arena* arena, size_t size);
+arena_mark arena_get_mark(const gbn_arena* arena);
+void arena_release(gbn_arena* arena, arena_mark mark);
+void arena_destroy(gbn_arena* arena);
+
+/* Forward error correction (GBN_fec.c) */
+void fec_init(fec_t* fec, int k);
+void fec_free(fec_t* fec);
+int fec_add(fec_t* fec, const rtp* DATA_packet, size_t n, int last);
+int fec_flush(fec_t* fec);
+void fec_restart(fec_t* fec);
+void fec_loss(fec_t* fec, size_t lost);
+void fec_store(fec_t* fec, const rtp* DATA_packet, size_t abs);
+void fec_parity(fec_t* fec, const rtp* PARITY_packet, size_t abs_start);
+rtp* fec_next(fec_t* fec, size_t abs);
+void fec_forget(fec_t* fec, size_t abs);
+
+/* Path MTU discovery (GBN_pmtu.c) */
+void pmtu_init(pmtu_t* pmtu, int sockfd, int probing);
+void pmtu_free(pmtu_t* pmtu);
+int pmtu_probe(int sockfd, pmtu_t* pmtu);
+int pmtu_ack(pmtu_t* pmtu, const rtp* PROBEACK_packet);
+int pmtu_blackhole(pmtu_t* pmtu, int timeouts);
+void pmtu_answer(int sockfd, rtp* PROBE_packet, const struct sockaddr* peer, socklen_t peer_len);
+
+/* Connection ids, path validation and keepalives (GBN_path.c) */
+uint32_t path_conn_id(int owner);
+int path_same(const struct sockaddr* a, const struct sockaddr* b);
+int path_check(int sockfd, gbn_path* path, rtp* packet, const struct sockaddr* from, socklen_t from_len,
+    struct sockaddr_storage* peer, socklen_t* peer_len);
+int path_respond(int sockfd, rtp* packet);
+void path_keepalive_answer(int sockfd, rtp* packet, const struct sockaddr* peer, socklen_t peer_len);
+int gbn_keepalive(int sockfd);
+
+/* Server mode (GBN_server.c) */
+gbn_server* gbn_server_start(const gbn_server_config* config);
+void gbn_server_stop(gbn_server* server);
+
+/* Handshake cookies (GBN_cookie.c) */
+void cookie_make(rtp* SYNACK_packet, const struct sockaddr* peer);
+int cookie_check(const rtp* ACK_packet, const struct sockaddr* peer);
+uint64_t gbn_random(void);
+
+/* Compression (GBN_compress.c) */
+const gbn_codec* gbn_codec_get(int options);
+void gbn_codec_benchmark(const void* buf, size_t len);
+
+/* Packet capture (GBN_pcap.c) */
+int gbn_pcap_open(const char* path, size_t snaplen);
+void gbn_pcap_close(void);
+void gbn_pcap_packet(int event, int sockfd, const void* buf, size_t len, const struct sockaddr* peer, int64_t at);
+
+/* Transports (GBN_transport.c) */
+int gbn_transport_open(const gbn_transport* transport);
+void gbn_transport_close(int fd);
+const gbn_transport* gbn_transport_get(int fd);
+int gbn_sim_pair(int fds[2], double loss, int64_t delay_ns);
+int gbn_shm_open(const char* name, int create);
+
+/* Socket I/O (GBN_io.c) */
+int gbn_io_init(int sockfd, int backend);
+void gbn_io_close(int sockfd);
+ssize_t gbn_sendto(int sockfd, const void* buf, size_t len, int flags, const struct sockaddr* to, socklen_t tolen);
+ssize_t gbn_recvfrom(int sockfd, void* buf, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen);
+int gbn_flush(int sockfd);
+int gbn_pace_init(int sockfd);
+void gbn_pace_rate(uint64_t rate);
+int gbn_wait(int sockfd, struct timeval* timeout);
+int gbn_wait_ns(int sockfd, int64_t* timeout_ns);
+int64_t gbn_now_ns(void);
+int gbn_timestamps_init(int sockfd);
+int64_t gbn_rx_time(void);
+int64_t gbn_departure_ns(void);
+int gbn_df_set(int sockfd, const struct sockaddr* peer);
+void gbn_df_restore(int sockfd, const struct sockaddr* peer, int mode);
+ssize_t gbn_sendto_df(int sockfd, const void* buf, size_t len, const struct sockaddr* to, socklen_t tolen);
+int gbn_path_mss(const struct sockaddr* peer, socklen_t peer_len);
+
+uint32_t checksum(rtp* packet);
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len);
+
 #endif
\ No newline at end of file
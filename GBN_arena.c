@@ -0,0 +1,169 @@
+/* File: GBN_arena.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Arena allocator for the big per-connection buffers (packet buffers, FEC
+ *              reassembly slots, server receive pools). Memory is mapped in ARENA_CHUNK
+ *              chunks, 2 MB huge pages where the system has them, so a window of packets
+ *              takes a few TLB entries instead of hundreds. Chunks are placed on the NUMA node
+ *              of the thread that maps them, allocations are a pointer bump and everything is
+ *              given back at once: to a mark when a transfer ends (the chunks are kept for the
+ *              next one) and unmapped on teardown.
+ */
+
+#include "GBN.h"
+#include <sys/mman.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#define MPOL_PREFERRED 1        /* linux/mempolicy.h, without needing libnuma */
+#endif
+
+
+#define ARENA_ALIGN 64          /* Every allocation starts on its own cache line */
+
+
+/* Header at the start of every chunk */
+struct arena_chunk_t {
+    struct arena_chunk_t* next; /* Older chunk */
+    size_t size;                /* Mapped bytes, this header included */
+};
+
+#define CHUNK_HEADER ((sizeof(struct arena_chunk_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+
+static __thread gbn_arena thread_arena = { NULL, NULL, 0, -2 };
+
+
+void arena_init(gbn_arena* arena) {
+	memset(arena, 0, sizeof(*arena));
+	arena->node = -2;
+}
+
+/* The calling thread's arena, for buffers that live as long as its connection */
+gbn_arena* arena_thread(void) {
+	return &thread_arena;
+}
+
+/* NUMA node of the CPU the calling thread runs on, -1 if not known */
+static int current_node(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+	unsigned cpu;
+	unsigned node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+		return (int)node;
+	}
+#endif
+	return -1;
+}
+
+/* Map size bytes (a multiple of ARENA_CHUNK) on node, huge pages if possible */
+static void* chunk_map(size_t size, int node) {
+	void* p = MAP_FAILED;
+
+#if defined(MAP_HUGETLB)
+	/* Reserved huge pages (vm.nr_hugepages), fails if there are none left */
+	if (ARENA_HUGEPAGES) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+#endif
+
+	if (p == MAP_FAILED) {
+		/* Ordinary pages on a huge page boundary, transparent huge pages can then back them */
+		uint8_t* raw = mmap(NULL, size + ARENA_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED) {
+			return NULL;
+		}
+		uint8_t* aligned = (uint8_t*)(((uintptr_t)raw + ARENA_CHUNK - 1) & ~(uintptr_t)(ARENA_CHUNK - 1));
+		if (aligned > raw) {
+			munmap(raw, aligned - raw);
+		}
+		munmap(aligned + size, raw + ARENA_CHUNK - aligned);
+		p = aligned;
+#if defined(MADV_HUGEPAGE)
+		if (ARENA_HUGEPAGES) {
+			madvise(p, size, MADV_HUGEPAGE);
+		}
+#endif
+	}
+
+	/* Before the first touch, that is when the pages are placed */
+#if defined(__linux__) && defined(SYS_mbind)
+	if (node >= 0 && node < 64) {
+		unsigned long mask = 1UL << node;
+		syscall(SYS_mbind, p, size, MPOL_PREFERRED, &mask, 64, 0);
+	}
+#endif
+	return p;
+}
+
+/* size bytes, ARENA_ALIGN aligned and not zeroed, valid until the arena is released past
+ * them. Exits if the memory can't be mapped, as malloc failures do */
+void* arena_alloc(gbn_arena* arena, size_t size) {
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (arena->chunks == NULL || arena->used + size > arena->chunks->size) {
+		struct arena_chunk_t* chunk = NULL;
+		size_t need = CHUNK_HEADER + size;
+
+		/* A chunk given back by arena_release, if it is big enough */
+		if (arena->spare != NULL && arena->spare->size >= need) {
+			chunk = arena->spare;
+			arena->spare = chunk->next;
+		}
+		else {
+			size_t bytes = (need + ARENA_CHUNK - 1) & ~(size_t)(ARENA_CHUNK - 1);
+
+			if (arena->node == -2) {
+				arena->node = current_node();
+			}
+			chunk = chunk_map(bytes, arena->node);
+			if (chunk == NULL) {
+				perror("mmap");
+				exit(EXIT_FAILURE);
+			}
+			chunk->size = bytes;
+		}
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->used = CHUNK_HEADER;
+	}
+
+	void* p = (uint8_t*)arena->chunks + arena->used;
+	arena->used += size;
+	return p;
+}
+
+/* Where the arena is now, to release back to */
+arena_mark arena_get_mark(const gbn_arena* arena) {
+	arena_mark mark = { arena->chunks, arena->used };
+	return mark;
+}
+
+/* Free everything allocated since mark at once. The chunks stay mapped for the next
+ * transfer, its buffers then land on pages that are already faulted in */
+void arena_release(gbn_arena* arena, arena_mark mark) {
+	while (arena->chunks != mark.chunk) {
+		struct arena_chunk_t* chunk = arena->chunks;
+
+		arena->chunks = chunk->next;
+		chunk->next = arena->spare;
+		arena->spare = chunk;
+	}
+	arena->used = mark.used;
+}
+
+/* Unmap all of it, on teardown */
+void arena_destroy(gbn_arena* arena) {
+	struct arena_chunk_t* lists[2] = { arena->chunks, arena->spare };
+
+	for (int i = 0; i < 2; i++) {
+		while (lists[i] != NULL) {
+			struct arena_chunk_t* chunk = lists[i];
+			lists[i] = chunk->next;
+			munmap(chunk, chunk->size);
+		}
+	}
+	arena->chunks = NULL;
+	arena->spare = NULL;
+	arena->used = 0;
+}
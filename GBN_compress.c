@@ -0,0 +1,265 @@
+/* File: GBN_compress.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Payload compression. Every DATA segment is compressed on its own, so a lost or
+ *              rebuilt packet never depends on another one. Segments that do not shrink are
+ *              sent as they are. Codecs are looked up by the option bit agreed in the SYN.
+ *
+ *              LZ codec, LZ4 style sequences:
+ *              token (literal count << 4 | match length - 4), more literal count bytes if the
+ *              count is 15 (255 means another byte follows), the literals, 2-byte offset back,
+ *              more match length bytes if the length nibble is 15. The last sequence has only
+ *              literals.
+ */
+
+#include "GBN.h"
+
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 0xffff
+
+
+static uint32_t lz_read32(const uint8_t* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* Write a 15+ length as a run of 255s and the rest, returns NULL if it does not fit */
+static uint8_t* lz_put_length(uint8_t* op, const uint8_t* oend, size_t n) {
+	for (; n >= 255; n -= 255) {
+		if (op >= oend) {
+			return NULL;
+		}
+		*op++ = 255;
+	}
+	if (op >= oend) {
+		return NULL;
+	}
+	*op++ = (uint8_t)n;
+	return op;
+}
+
+/* One sequence: literals [anchor, ip) then a match of mlen at offset, mlen 0 for the last one */
+static uint8_t* lz_put_sequence(uint8_t* op, const uint8_t* oend, const uint8_t* anchor, size_t lits, size_t offset, size_t mlen) {
+	size_t ml = mlen > 0 ? mlen - LZ_MIN_MATCH : 0;
+
+	if (op >= oend) {
+		return NULL;
+	}
+	uint8_t* token = op++;
+	*token = (uint8_t)(((lits < 15 ? lits : 15) << 4) | (ml < 15 ? ml : 15));
+
+	if (lits >= 15 && (op = lz_put_length(op, oend, lits - 15)) == NULL) {
+		return NULL;
+	}
+	if ((size_t)(oend - op) < lits) {
+		return NULL;
+	}
+	memcpy(op, anchor, lits);
+	op += lits;
+
+	if (mlen == 0) {
+		return op;
+	}
+	if (oend - op < 2) {
+		return NULL;
+	}
+	*op++ = (uint8_t)offset;
+	*op++ = (uint8_t)(offset >> 8);
+
+	if (ml >= 15 && (op = lz_put_length(op, oend, ml - 15)) == NULL) {
+		return NULL;
+	}
+	return op;
+}
+
+/* Compress len bytes of src into dst, returns the compressed size or 0 if it is not smaller */
+static size_t lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+	uint16_t table[1 << LZ_HASH_BITS];
+	const uint8_t* ip = src;
+	const uint8_t* anchor = src;
+	const uint8_t* end = src + len;
+	uint8_t* op = dst;
+	const uint8_t* oend = dst + (cap < len ? cap : len - 1);
+
+	if (len <= LZ_MIN_MATCH || len > LZ_MAX_OFFSET) {
+		return 0;
+	}
+	memset(table, 0, sizeof(table));
+
+	/* Position 0 is a valid entry, an unused slot just fails the match check */
+	while (ip + LZ_MIN_MATCH <= end) {
+		uint32_t v = lz_read32(ip);
+		uint32_t h = lz_hash(v);
+		const uint8_t* ref = src + table[h];
+		table[h] = (uint16_t)(ip - src);
+
+		if (ref >= ip || lz_read32(ref) != v) {
+			ip++;
+			continue;
+		}
+
+		/* Extend the match as far as it goes */
+		const uint8_t* mp = ip + LZ_MIN_MATCH;
+		const uint8_t* rp = ref + LZ_MIN_MATCH;
+		while (mp < end && *mp == *rp) {
+			mp++;
+			rp++;
+		}
+
+		op = lz_put_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+		if (op == NULL) {
+			return 0;
+		}
+		ip = anchor = mp;
+	}
+
+	op = lz_put_sequence(op, oend, anchor, end - anchor, 0, 0);
+	if (op == NULL || op >= dst + len) {
+		return 0;
+	}
+	return op - dst;
+}
+
+/* Read a 15+ length, returns NULL on truncated input */
+static const uint8_t* lz_get_length(const uint8_t* ip, const uint8_t* iend, size_t* n) {
+	uint8_t b;
+
+	do {
+		if (ip >= iend) {
+			return NULL;
+		}
+		b = *ip++;
+		*n += b;
+	} while (b == 255);
+	return ip;
+}
+
+/* Decompress len bytes of src into dst, returns the size or -1 if the input is not valid */
+static ssize_t lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+	const uint8_t* ip = src;
+	const uint8_t* iend = src + len;
+	uint8_t* op = dst;
+	uint8_t* oend = dst + cap;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t lits = token >> 4;
+		size_t mlen = token & 0x0f;
+
+		if (lits == 15 && (ip = lz_get_length(ip, iend, &lits)) == NULL) {
+			return -1;
+		}
+		if ((size_t)(iend - ip) < lits || (size_t)(oend - op) < lits) {
+			return -1;
+		}
+		memcpy(op, ip, lits);
+		ip += lits;
+		op += lits;
+
+		if (ip == iend) { /* Last sequence */
+			break;
+		}
+
+		if (iend - ip < 2) {
+			return -1;
+		}
+		size_t offset = ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		if (mlen == 15 && (ip = lz_get_length(ip, iend, &mlen)) == NULL) {
+			return -1;
+		}
+		mlen += LZ_MIN_MATCH;
+
+		/* The last sequence has only literals, input that ends after a match was cut short */
+		if (ip == iend) {
+			return -1;
+		}
+		if (offset == 0 || offset > (size_t)(op - dst) || (size_t)(oend - op) < mlen) {
+			return -1;
+		}
+
+		/* Byte by byte, the match may overlap what it is producing */
+		const uint8_t* ref = op - offset;
+		while (mlen-- > 0) {
+			*op++ = *ref++;
+		}
+	}
+	return op - dst;
+}
+
+
+static const gbn_codec codecs[] = {
+	{ "lz", OPT_LZ, lz_compress, lz_decompress },
+};
+
+/* Codec for the agreed options, NULL if compression is off */
+const gbn_codec* gbn_codec_get(int options) {
+	for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		if (options & codecs[i].option) {
+			return &codecs[i];
+		}
+	}
+	return NULL;
+}
+
+
+/* Compare the codecs against the uncompressed path (a plain copy of every segment) on
+ * len bytes of buf, segment by segment as sender_gbn would send them */
+void gbn_codec_benchmark(const void* buf, size_t len) {
+	uint8_t packed[MAXMSG];
+	uint8_t unpacked[MAXMSG];
+	const uint8_t* src = buf;
+	int64_t start;
+	double copy_s;
+
+	/* Uncompressed path */
+	start = gbn_now_ns();
+	for (size_t off = 0; off < len; off += BASE_MSS) {
+		size_t n = len - off < BASE_MSS ? len - off : BASE_MSS;
+		memcpy(packed, src + off, n);
+	}
+	copy_s = (gbn_now_ns() - start) / 1e9;
+	printf("%-6s ratio 1.000  %8.1f MB/s\n", "none", len / 1e6 / (copy_s > 0 ? copy_s : 1e-9));
+
+	for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		const gbn_codec* codec = &codecs[i];
+		size_t wire = 0;
+		size_t bypassed = 0;
+		int64_t ctime = 0;
+		int64_t dtime = 0;
+
+		for (size_t off = 0; off < len; off += BASE_MSS) {
+			size_t n = len - off < BASE_MSS ? len - off : BASE_MSS;
+
+			start = gbn_now_ns();
+			size_t c = codec->compress(src + off, n, packed, sizeof(packed));
+			ctime += gbn_now_ns() - start;
+
+			if (c == 0) { /* Sent as is */
+				wire += n;
+				bypassed++;
+				continue;
+			}
+			wire += c;
+
+			start = gbn_now_ns();
+			ssize_t d = codec->decompress(packed, c, unpacked, sizeof(unpacked));
+			dtime += gbn_now_ns() - start;
+
+			if (d != (ssize_t)n || memcmp(unpacked, src + off, n) != 0) {
+				printf("%s: segment at %zu does not round trip\n", codec->name, off);
+			}
+		}
+
+		printf("%-6s ratio %.3f  %8.1f MB/s compress  %8.1f MB/s decompress  (%zu of %zu segments bypassed)\n",
+			codec->name, wire > 0 ? (double)len / wire : 1.0,
+			len / 1e6 / (ctime > 0 ? ctime / 1e9 : 1e-9), len / 1e6 / (dtime > 0 ? dtime / 1e9 : 1e-9),
+			bypassed, (len + BASE_MSS - 1) / BASE_MSS);
+	}
+}
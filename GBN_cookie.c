@@ -0,0 +1,136 @@
+/* File: GBN_cookie.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Handshake cookies. The receiver keeps no state for a SYN, everything it agreed
+ *              to goes out in the SYNACK together with a keyed hash (SipHash-2-4) of it, the
+ *              peer's address and the time. The sender echoes it in its ACK, and only an ACK
+ *              with a valid, fresh cookie creates a connection.
+ */
+
+#include "GBN.h"
+#include <fcntl.h>
+
+
+static uint64_t cookie_key[2];
+static pthread_once_t cookie_once = PTHREAD_ONCE_INIT;
+
+/* Secret key, new every time the process starts */
+static void cookie_init(void) {
+	int fd = open("/dev/urandom", O_RDONLY);
+
+	if (fd < 0 || read(fd, cookie_key, sizeof(cookie_key)) != sizeof(cookie_key)) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		cookie_key[0] = (uint64_t)ts.tv_nsec << 32 ^ (uint64_t)ts.tv_sec;
+		cookie_key[1] = (uint64_t)getpid() << 32 ^ (uint64_t)(uintptr_t)&ts;
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+		v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+	} while (0)
+
+static uint64_t siphash(const uint64_t key[2], const uint8_t* in, size_t len) {
+	uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+	uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+	uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+	uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+	uint64_t b = (uint64_t)len << 56;
+	const uint8_t* end = in + len - len % 8;
+	uint64_t m;
+
+	for (; in != end; in += 8) {
+		memcpy(&m, in, sizeof(m));
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	for (int i = len % 8 - 1; i >= 0; i--) {
+		b |= (uint64_t)in[i] << (8 * i);
+	}
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+/* Hash of a handshake packet's agreed parameters and the peer it was for */
+static uint64_t cookie_hash(const rtp* packet, uint8_t synack_seq, const struct sockaddr* peer) {
+	uint8_t msg[64];
+	size_t n = 0;
+
+	pthread_once(&cookie_once, cookie_init);
+
+	/* Peer, without padding that may differ between recvfrom calls */
+	if (peer->sa_family == AF_INET) {
+		const struct sockaddr_in* in4 = (const struct sockaddr_in*)peer;
+		memcpy(msg + n, &in4->sin_port, sizeof(in4->sin_port));
+		n += sizeof(in4->sin_port);
+		memcpy(msg + n, &in4->sin_addr, sizeof(in4->sin_addr));
+		n += sizeof(in4->sin_addr);
+	}
+	else if (peer->sa_family == AF_INET6) {
+		const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)peer;
+		memcpy(msg + n, &in6->sin6_port, sizeof(in6->sin6_port));
+		n += sizeof(in6->sin6_port);
+		memcpy(msg + n, &in6->sin6_addr, sizeof(in6->sin6_addr));
+		n += sizeof(in6->sin6_addr);
+	}
+
+	/* What was agreed, the cookie itself excluded */
+	msg[n++] = synack_seq;
+	msg[n++] = packet->options;
+	memcpy(msg + n, &packet->windowsize, sizeof(packet->windowsize));
+	n += sizeof(packet->windowsize);
+	memcpy(msg + n, packet->data, offsetof(syn_params, cookie));
+	n += offsetof(syn_params, cookie);
+
+	return siphash(cookie_key, msg, n);
+}
+
+/* Receiver: stamp a finished SYNACK with a cookie, before its checksum is computed */
+void cookie_make(rtp* SYNACK_packet, const struct sockaddr* peer) {
+	syn_params* params = (syn_params*)SYNACK_packet->data;
+
+	params->cookie_time = (uint32_t)time(NULL);
+	params->cookie = cookie_hash(SYNACK_packet, SYNACK_packet->seq, peer);
+}
+
+/* Receiver: 1 if the handshake ACK from peer echoes a SYNACK we sent in the last COOKIE_LIFETIME seconds */
+int cookie_check(const rtp* ACK_packet, const struct sockaddr* peer) {
+	const syn_params* params = (const syn_params*)ACK_packet->data;
+	uint32_t age = (uint32_t)time(NULL) - params->cookie_time;
+
+	if (age > COOKIE_LIFETIME) {
+		return 0;
+	}
+	return params->cookie == cookie_hash(ACK_packet, (uint8_t)(ACK_packet->seq - 1), peer);
+}
+
+/* Unpredictable 64 bits for connection ids and path tokens, the keyed hash of a counter */
+uint64_t gbn_random(void) {
+	static uint64_t counter;
+	uint64_t n = __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+
+	pthread_once(&cookie_once, cookie_init);
+	return siphash(cookie_key, (const uint8_t*)&n, sizeof(n));
+}
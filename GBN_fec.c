@@ -0,0 +1,207 @@
+/* File: GBN_fec.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Forward error correction with XOR parity. After every group of k DATA packets
+ *              the sender sends one PARITY packet, the XOR of the group. The receiver can then
+ *              rebuild one lost packet per group without waiting for a retransmission.
+ *
+ *              PARITY packet: seq is the first packet of the group, options the group size,
+ *              len the XOR of the members' len and data the XOR of their data.
+ */
+
+#include "GBN.h"
+
+
+#define FEC_SLOTS 256           /* One slot per sequence number */
+#define FEC_ADAPT 128           /* Packets between adjustments of k */
+
+
+/* The slots are a few MB, they come from the thread's arena and go back with the rest of
+ * the transfer's buffers (arena_release in sender_gbn/receiver_gbn) */
+void fec_init(fec_t* fec, int k) {
+	gbn_arena* arena = arena_thread();
+
+	memset(fec, 0, sizeof(*fec));
+	fec->k = k;
+	fec->max_k = k;
+
+	fec->slots = arena_alloc(arena, FEC_SLOTS * sizeof(*fec->slots));
+	fec->slot_abs = arena_alloc(arena, FEC_SLOTS * sizeof(*fec->slot_abs));
+	fec->par_slots = arena_alloc(arena, FEC_SLOTS * sizeof(*fec->par_slots));
+	fec->par_abs = arena_alloc(arena, FEC_SLOTS * sizeof(*fec->par_abs));
+
+	/* No slot holds a packet yet */
+	for (int i = 0; i < FEC_SLOTS; i++) {
+		fec->slot_abs[i] = SIZE_MAX;
+		fec->par_abs[i] = SIZE_MAX;
+	}
+}
+
+void fec_free(fec_t* fec) {
+	memset(fec, 0, sizeof(*fec));
+}
+
+
+/* Sender: add packet n, sent in order. Returns 1 when the group is complete and
+ * fec->parity is ready to be sent */
+int fec_add(fec_t* fec, const rtp* DATA_packet, size_t n, int last) {
+	size_t used = gbn_packet_size(DATA_packet) - offsetof(rtp, data);
+
+	if (fec->count == 0) {
+		fec->group_start = n;
+		fec->group_k = fec->k;
+		fec->parity.len = 0;
+		memset(fec->parity.data, 0, fec->parity.parity_len);
+		fec->parity.parity_len = 0;
+	}
+
+	/* Members are sent without their unused data, the parity is as long as the longest */
+	fec->parity.len ^= DATA_packet->len;
+	for (size_t i = 0; i < used; i++) {
+		fec->parity.data[i] ^= DATA_packet->data[i];
+	}
+	if (used > fec->parity.parity_len) {
+		fec->parity.parity_len = used;
+	}
+	fec->count++;
+	fec->sent++;
+
+	if (fec->count < fec->group_k && !last) {
+		return 0;
+	}
+	return fec_flush(fec);
+}
+
+/* Sender: close the open group early, returns 1 if fec->parity is ready to be sent */
+int fec_flush(fec_t* fec) {
+	if (fec->count == 0) {
+		return 0;
+	}
+
+	/* Group done, finish the parity packet */
+	fec->parity.flags = PARITY;
+	fec->parity.stream = 0;
+	fec->parity.seq = (uint8_t)fec->group_start;
+	fec->parity.options = fec->count;
+	fec->parity.conn_id = state.conn_id;
+	fec->parity.checksum = checksum(&fec->parity);
+	fec->count = 0;
+	return 1;
+}
+
+/* Sender: drop the open group, its packets are sent again cut another way */
+void fec_restart(fec_t* fec) {
+	fec->count = 0;
+}
+
+/* Sender: losses seen, one for each gap however many duplicate ACKs or timeouts it caused.
+ * Every FEC_ADAPT packets k is halved if the loss rate is above what one parity per group
+ * can repair, and doubled (up to the negotiated k) if loss is well below it */
+void fec_loss(fec_t* fec, size_t lost) {
+	fec->lost += lost;
+
+	if (fec->sent < FEC_ADAPT) {
+		return;
+	}
+
+	if (fec->lost * fec->k > fec->sent && fec->k > FEC_MIN_K) {
+		fec->k /= 2;
+		if (fec->k < FEC_MIN_K) {
+			fec->k = FEC_MIN_K;
+		}
+		printf("FEC: loss %zu/%zu, k lowered to %d\n", fec->lost, fec->sent, fec->k);
+	}
+	else if (fec->lost * fec->k * 4 < fec->sent && fec->k < fec->max_k) {
+		fec->k *= 2;
+		if (fec->k > fec->max_k) {
+			fec->k = fec->max_k;
+		}
+		printf("FEC: loss %zu/%zu, k raised to %d\n", fec->lost, fec->sent, fec->k);
+	}
+	fec->sent = 0;
+	fec->lost = 0;
+}
+
+
+/* Receiver: keep packet number abs, for delivery later or for rebuilding another one */
+void fec_store(fec_t* fec, const rtp* DATA_packet, size_t abs) {
+	int slot = abs % FEC_SLOTS;
+
+	memcpy(&fec->slots[slot], DATA_packet, gbn_packet_size(DATA_packet));
+	fec->slot_abs[slot] = abs;
+}
+
+/* Receiver: a PARITY packet for the group starting at packet abs_start */
+void fec_parity(fec_t* fec, const rtp* PARITY_packet, size_t abs_start) {
+	int slot = abs_start % FEC_SLOTS;
+
+	memcpy(&fec->par_slots[slot], PARITY_packet, gbn_packet_size(PARITY_packet));
+	fec->par_abs[slot] = abs_start;
+}
+
+/* Receiver: drop the packets buffered from packet number abs on, and the parity of every
+ * group with a member there. They are sent again, what is kept must not mix with that */
+void fec_forget(fec_t* fec, size_t abs) {
+	for (int i = 0; i < FEC_SLOTS; i++) {
+		if (fec->slot_abs[i] != SIZE_MAX && fec->slot_abs[i] >= abs) {
+			fec->slot_abs[i] = SIZE_MAX;
+		}
+		if (fec->par_abs[i] != SIZE_MAX && fec->par_abs[i] + fec->par_slots[i].options > abs) {
+			fec->par_abs[i] = SIZE_MAX;
+		}
+	}
+}
+
+/* Receiver: packet number abs if it was buffered or can be rebuilt from the parity of its
+ * group, otherwise NULL */
+rtp* fec_next(fec_t* fec, size_t abs) {
+	int slot = abs % FEC_SLOTS;
+
+	if (fec->slot_abs[slot] == abs) {
+		return &fec->slots[slot];
+	}
+
+	/* Find the parity of the group abs belongs to, it starts at most FEC_MAX_K packets back */
+	const rtp* parity = NULL;
+	size_t start = 0;
+	for (size_t back = 0; back < FEC_MAX_K && back <= abs; back++) {
+		int p = (abs - back) % FEC_SLOTS;
+		if (fec->par_abs[p] == abs - back && back < fec->par_slots[p].options) {
+			parity = &fec->par_slots[p];
+			start = abs - back;
+			break;
+		}
+	}
+	if (parity == NULL) {
+		return NULL;
+	}
+
+	/* Every other member of the group must be here */
+	for (size_t i = start; i < start + parity->options; i++) {
+		if (i != abs && fec->slot_abs[i % FEC_SLOTS] != i) {
+			return NULL;
+		}
+	}
+
+	/* The missing packet is the XOR of the parity and the rest of the group */
+	rtp* packet = &fec->slots[slot];
+	memcpy(packet, parity, gbn_packet_size(parity));
+	for (size_t i = start; i < start + parity->options; i++) {
+		if (i == abs) {
+			continue;
+		}
+		const rtp* member = &fec->slots[i % FEC_SLOTS];
+		size_t used = gbn_packet_size(member) - offsetof(rtp, data);
+		packet->len ^= member->len;
+		for (size_t b = 0; b < used; b++) {
+			packet->data[b] ^= member->data[b];
+		}
+	}
+	packet->flags = DATA;
+	packet->seq = (uint8_t)abs;
+	packet->tstamp = 0;
+	fec->slot_abs[slot] = abs;
+	fec->par_abs[start % FEC_SLOTS] = SIZE_MAX;
+
+	printf("FEC: rebuilt DATA packet (%d)\n", packet->seq);
+	return packet;
+}
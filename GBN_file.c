@@ -0,0 +1,189 @@
+/* File: GBN_file.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: File transfers. The sender maps the file and sends segments straight from the
+ *              mapping, the receiver writes every segment to its offset in the target file.
+ *              Neither end holds more than a window of the file in memory.
+ *
+ *              Transfers can be resumed. The receiver keeps a checkpoint of how much of the
+ *              file is on disk, and tells a reconnecting sender where to continue.
+ */
+
+#include "GBN.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define CHECKPOINT_MAGIC 0x47424e43     /* "GBNC" */
+
+/* On-disk checkpoint of a resumable transfer */
+typedef struct checkpoint_t {
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t transfer_id;
+	uint64_t done;              /* Bytes of the file written in order */
+} checkpoint;
+
+
+static void checkpoint_path(char* path, size_t size, uint64_t id) {
+	snprintf(path, size, "%s/gbn-%016llx.ckpt", CHECKPOINT_DIR, (unsigned long long)id);
+}
+
+/* Identify a file by where it lives and what version it is, so a changed file
+ * is never resumed from an old checkpoint */
+uint64_t file_transfer_id(const char* path) {
+	struct stat st;
+	uint64_t fields[4];
+	uint64_t hash = 0xcbf29ce484222325ULL;  /* FNV-1a */
+
+	if (stat(path, &st) < 0) {
+		return 0;
+	}
+	fields[0] = st.st_dev;
+	fields[1] = st.st_ino;
+	fields[2] = st.st_size;
+	fields[3] = st.st_mtime;
+
+	const uint8_t* p = (const uint8_t*)fields;
+	for (size_t i = 0; i < sizeof(fields); i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash != 0 ? hash : 1;
+}
+
+/* Bytes of transfer id already on disk, 0 if there is no checkpoint */
+uint64_t checkpoint_load(uint64_t id) {
+	char path[256];
+	checkpoint ckpt;
+
+	checkpoint_path(path, sizeof(path), id);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	if (read(fd, &ckpt, sizeof(ckpt)) != sizeof(ckpt) || ckpt.magic != CHECKPOINT_MAGIC || ckpt.transfer_id != id) {
+		printf("Ignoring bad checkpoint %s\n", path);
+		ckpt.done = 0;
+	}
+	close(fd);
+	return ckpt.done;
+}
+
+/* Write the checkpoint to a temporary file and rename it into place, a crash
+ * leaves either the old or the new checkpoint */
+void checkpoint_save(uint64_t id, uint64_t done) {
+	char path[256];
+	char tmp[264];
+	checkpoint ckpt = { CHECKPOINT_MAGIC, 0, id, done };
+
+	checkpoint_path(path, sizeof(path), id);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("Can't write checkpoint");
+		return;
+	}
+	if (write(fd, &ckpt, sizeof(ckpt)) != sizeof(ckpt) || fdatasync(fd) < 0) {
+		perror("Can't write checkpoint");
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	close(fd);
+
+	if (rename(tmp, path) < 0) {
+		perror("rename");
+		unlink(tmp);
+	}
+}
+
+void checkpoint_clear(uint64_t id) {
+	char path[256];
+
+	checkpoint_path(path, sizeof(path), id);
+	unlink(path);
+}
+
+
+/* Send the file at path over the established connection, returns the bytes sent or -1.
+ * Set state.transfer_id = file_transfer_id(path) before sender_connection to resume
+ * from where the receiver's checkpoint left off */
+ssize_t sender_file(int sockfd, const char* path) {
+	struct stat st;
+	ssize_t result;
+	void* map = NULL;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("Can't open file");
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			perror("mmap");
+			close(fd);
+			return -1;
+		}
+
+		/* Read ahead and drop pages behind, the file is sent front to back */
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+	}
+
+	/* The receiver already has the first resume_offset bytes */
+	off_t offset = (off_t)state.resume_offset <= st.st_size ? (off_t)state.resume_offset : 0;
+
+	printf("Sending file %s (%lld bytes from %lld)\n", path, (long long)st.st_size, (long long)offset);
+	result = sender_gbn(sockfd, (const uint8_t*)map + offset, st.st_size - offset, GBN_BYTES);
+
+	if (map != NULL) {
+		munmap(map, st.st_size);
+	}
+	close(fd);
+	return result < 0 ? -1 : (ssize_t)(st.st_size - offset);
+}
+
+/* Receive into the file at path until FIN, returns the bytes received or -1.
+ * If the sender resumes a transfer the file is kept and written from the checkpoint on,
+ * if the connection is lost the progress so far is checkpointed */
+ssize_t receiver_file(int sockfd, const char* path) {
+	ssize_t result;
+	int flags = O_WRONLY | O_CREAT;
+
+	if (state.resume_offset == 0) {
+		flags |= O_TRUNC;
+	}
+	int fd = open(path, flags, 0644);
+	if (fd < 0) {
+		perror("Can't open file");
+		return -1;
+	}
+
+	result = receiver_gbn(sockfd, &fd, SIZE_MAX, GBN_FILE);
+
+	if (state.transfer_id != 0) {
+		if (result < 0) {
+			/* Keep what made it to disk for the next attempt */
+			fdatasync(fd);
+			checkpoint_save(state.transfer_id, state.transfer_done);
+			printf("Transfer interrupted, checkpoint at byte %llu\n", (unsigned long long)state.transfer_done);
+		}
+		else {
+			checkpoint_clear(state.transfer_id);
+		}
+	}
+	if (result >= 0) {
+		printf("Received file %s (%lld bytes)\n", path, (long long)result);
+	}
+
+	close(fd);
+	return result;
+}
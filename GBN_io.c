@@ -0,0 +1,1086 @@
+/* File: GBN_io.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Socket I/O used by the protocol. Sends, receives and waits go through here
+ *              so the plain socket calls can be swapped for a batched io_uring backend.
+ *              Waiting uses epoll with a timerfd deadline instead of select, and sends
+ *              can be paced with a token bucket. Descriptors from GBN_transport.c are
+ *              handed to their transport instead. Arrival times can be taken by the kernel
+ *              (SO_TIMESTAMPING or SO_TIMESTAMPNS) so RTT samples miss the wakeup delay.
+ */
+
+#include "GBN.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/net_tstamp.h>
+#define HAVE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+__thread int io_backend = IO_SOCKET;    /* Backend in use by this thread */
+static __thread int io_clock = -1;      /* Transport whose clock gbn_now_ns reads, -1 for the real one */
+static __thread int rx_stamps;          /* The kernel timestamps packets on this thread's socket */
+static __thread int64_t rx_time;        /* Arrival of the last packet received, gbn_now_ns clock */
+
+/* Token bucket pacing of this thread's sends */
+static __thread struct {
+	uint64_t rate;          /* Bytes per second, 0 = not paced */
+	int64_t next;           /* Virtual time the next packet may leave, monotonic clock (ns) */
+	int txtime;             /* Departure times are handed to the kernel (SO_TXTIME) */
+} pace;
+
+
+/* CLOCK_MONOTONIC in nanoseconds. Sockets are waited on and paced by it even while
+ * gbn_now_ns reads the virtual clock of a simulated transport */
+static int64_t monotonic_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Attach a departure time to msg for the fq qdisc */
+static void pace_cmsg(struct msghdr* msg, char* control, size_t controllen, int64_t txtime) {
+#ifdef SCM_TXTIME
+	struct cmsghdr* cmsg;
+	uint64_t t = (uint64_t)txtime;
+
+	msg->msg_control = control;
+	msg->msg_controllen = controllen;
+	cmsg = CMSG_FIRSTHDR(msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_TXTIME;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(t));
+	memcpy(CMSG_DATA(cmsg), &t, sizeof(t));
+#endif
+}
+
+
+#ifdef HAVE_IO_URING
+
+#define URING_ENTRIES 256      /* Submission queue size */
+#define SEND_SLOTS 128         /* Packets that can be queued for sending */
+#define RECV_BUFS 256          /* Receive buffers handed to the kernel, power of two */
+#define RECV_BGID 1            /* Buffer group id of the receive buffers */
+#define RECV_TAG (~0ULL)       /* user_data of the multishot receive */
+
+/* A packet waiting to be sent, owned by the kernel until its completion */
+typedef struct send_slot_t {
+	uint8_t data[sizeof(rtp)];
+	struct sockaddr_storage to;
+	struct iovec iov;
+	struct msghdr msg;
+	char control[CMSG_SPACE(sizeof(uint64_t))];    /* SCM_TXTIME */
+	int busy;
+} send_slot;
+
+/* Receive buffer: recvmsg header, source address, then the packet */
+typedef struct recv_buf_t {
+	struct io_uring_recvmsg_out out;
+	struct sockaddr_storage from;
+	uint8_t data[sizeof(rtp)];
+} recv_buf;
+
+static __thread struct {
+	int fd;
+	int sockfd;
+
+	/* Submission ring */
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned sq_local_tail;   /* SQEs filled in but not yet submitted */
+	unsigned sq_submitted;
+
+	/* Completion ring */
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	/* Mappings, kept for teardown */
+	void* sq_ptr;
+	size_t sq_len;
+	void* cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+
+	/* Packet pool */
+	send_slot* slots;
+	recv_buf* bufs;
+	struct io_uring_buf_ring* buf_ring;
+	size_t buf_ring_len;
+	unsigned short buf_tail;
+
+	struct msghdr recv_msg;   /* Template for the multishot receive */
+	int recv_armed;
+} ring;
+
+
+static int uring_setup(unsigned entries, struct io_uring_params* p) {
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t argsz) {
+	return (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uring_register(unsigned opcode, void* arg, unsigned nr_args) {
+	return (int)syscall(__NR_io_uring_register, ring.fd, opcode, arg, nr_args);
+}
+
+/* Next free SQE, NULL if the submission queue is full */
+static struct io_uring_sqe* uring_get_sqe(void) {
+	unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+
+	if (ring.sq_local_tail - head >= URING_ENTRIES) {
+		return NULL;
+	}
+
+	unsigned index = ring.sq_local_tail & *ring.sq_mask;
+	struct io_uring_sqe* sqe = &ring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring.sq_array[index] = index;
+	ring.sq_local_tail++;
+	return sqe;
+}
+
+/* Publish filled SQEs to the kernel and optionally wait for completions */
+static int uring_submit(unsigned min_complete, struct timespec* timeout) {
+	unsigned to_submit = ring.sq_local_tail - ring.sq_submitted;
+	unsigned flags = 0;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+
+	__atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+	ring.sq_submitted = ring.sq_local_tail;
+
+	if (min_complete > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+	if (timeout != NULL) {
+		ts.tv_sec = timeout->tv_sec;
+		ts.tv_nsec = timeout->tv_nsec;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+		return uring_enter(to_submit, min_complete, flags, &arg, sizeof(arg));
+	}
+	return uring_enter(to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Arm the multishot receive, it stays active until the kernel runs out of buffers */
+static void uring_arm_recv(void) {
+	struct io_uring_sqe* sqe = uring_get_sqe();
+
+	if (sqe == NULL) {
+		uring_submit(0, NULL);
+		sqe = uring_get_sqe();
+	}
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = ring.sockfd;
+	sqe->addr = (uint64_t)(uintptr_t)&ring.recv_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = RECV_BGID;
+	sqe->user_data = RECV_TAG;
+	ring.recv_armed = 1;
+}
+
+/* Give a receive buffer back to the kernel */
+static void uring_recycle(unsigned short bid) {
+	struct io_uring_buf* buf = &ring.buf_ring->bufs[ring.buf_tail & (RECV_BUFS - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)&ring.bufs[bid];
+	buf->len = sizeof(recv_buf);
+	buf->bid = bid;
+	ring.buf_tail++;
+	__atomic_store_n(&ring.buf_ring->tail, ring.buf_tail, __ATOMIC_RELEASE);
+}
+
+/* Reap send completions. Returns the first receive completion, left on the queue, or NULL */
+static struct io_uring_cqe* uring_reap(void) {
+	unsigned head = *ring.cq_head;
+	unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+
+		if (cqe->user_data == RECV_TAG) {
+			/* Out of buffers or cancelled, re-arm and drop the CQE */
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				ring.recv_armed = 0;
+			}
+			if (cqe->res < 0 || !(cqe->flags & IORING_CQE_F_BUFFER)) {
+				if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+					errno = -cqe->res;
+					perror("io_uring recvmsg");
+				}
+				head++;
+				continue;
+			}
+			__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+			return cqe;
+		}
+
+		/* Send completion, release the slot */
+		send_slot* slot = &ring.slots[cqe->user_data];
+		slot->busy = 0;
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			perror("io_uring sendmsg");
+		}
+		head++;
+	}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+	if (!ring.recv_armed) {
+		uring_arm_recv();
+	}
+	return NULL;
+}
+
+static void uring_close(void) {
+	if (ring.buf_ring != NULL) {
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.bgid = RECV_BGID;
+		uring_register(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		munmap(ring.buf_ring, ring.buf_ring_len);
+	}
+	if (ring.sqes != NULL) {
+		munmap(ring.sqes, ring.sqes_len);
+	}
+	if (ring.cq_ptr != NULL && ring.cq_ptr != ring.sq_ptr) {
+		munmap(ring.cq_ptr, ring.cq_len);
+	}
+	if (ring.sq_ptr != NULL) {
+		munmap(ring.sq_ptr, ring.sq_len);
+	}
+	if (ring.fd > 0) {
+		close(ring.fd);
+	}
+	free(ring.slots);
+	free(ring.bufs);
+	memset(&ring, 0, sizeof(ring));
+}
+
+static int uring_init(int sockfd) {
+	struct io_uring_params p;
+
+	memset(&ring, 0, sizeof(ring));
+	memset(&p, 0, sizeof(p));
+
+	ring.fd = uring_setup(URING_ENTRIES, &p);
+	if (ring.fd < 0) {
+		ring.fd = 0;
+		return -1;
+	}
+	ring.sockfd = sockfd;
+
+	/* Timed waits need IORING_ENTER_EXT_ARG (5.11) */
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		uring_close();
+		return -1;
+	}
+
+	/* Map the rings */
+	ring.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_len > ring.sq_len) {
+			ring.sq_len = ring.cq_len;
+		}
+		ring.cq_len = ring.sq_len;
+	}
+
+	ring.sq_ptr = mmap(NULL, ring.sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	if (ring.sq_ptr == MAP_FAILED) {
+		ring.sq_ptr = NULL;
+		uring_close();
+		return -1;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring.cq_ptr = ring.sq_ptr;
+	}
+	else {
+		ring.cq_ptr = mmap(NULL, ring.cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+		if (ring.cq_ptr == MAP_FAILED) {
+			ring.cq_ptr = NULL;
+			uring_close();
+			return -1;
+		}
+	}
+	ring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(NULL, ring.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED) {
+		ring.sqes = NULL;
+		uring_close();
+		return -1;
+	}
+
+	ring.sq_head = (unsigned*)((char*)ring.sq_ptr + p.sq_off.head);
+	ring.sq_tail = (unsigned*)((char*)ring.sq_ptr + p.sq_off.tail);
+	ring.sq_mask = (unsigned*)((char*)ring.sq_ptr + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned*)((char*)ring.sq_ptr + p.sq_off.array);
+	ring.cq_head = (unsigned*)((char*)ring.cq_ptr + p.cq_off.head);
+	ring.cq_tail = (unsigned*)((char*)ring.cq_ptr + p.cq_off.tail);
+	ring.cq_mask = (unsigned*)((char*)ring.cq_ptr + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe*)((char*)ring.cq_ptr + p.cq_off.cqes);
+	ring.sq_local_tail = ring.sq_submitted = *ring.sq_tail;
+
+	/* Packet pool */
+	ring.slots = calloc(SEND_SLOTS, sizeof(*ring.slots));
+	ring.bufs = calloc(RECV_BUFS, sizeof(*ring.bufs));
+	if (ring.slots == NULL || ring.bufs == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Register the receive buffers with the kernel (provided buffer ring, 5.19) */
+	ring.buf_ring_len = RECV_BUFS * sizeof(struct io_uring_buf);
+	ring.buf_ring = mmap(NULL, ring.buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring.buf_ring == MAP_FAILED) {
+		ring.buf_ring = NULL;
+		uring_close();
+		return -1;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ring.buf_ring;
+	reg.ring_entries = RECV_BUFS;
+	reg.bgid = RECV_BGID;
+	if (uring_register(IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		munmap(ring.buf_ring, ring.buf_ring_len);
+		ring.buf_ring = NULL;
+		uring_close();
+		return -1;
+	}
+	for (unsigned short bid = 0; bid < RECV_BUFS; bid++) {
+		uring_recycle(bid);
+	}
+
+	/* Only the address length matters in the multishot template */
+	ring.recv_msg.msg_namelen = sizeof(struct sockaddr_storage);
+	uring_arm_recv();
+	uring_submit(0, NULL);
+
+	/* Multishot recvmsg needs 6.0, before that the request is refused as it is submitted
+	 * and its completion is already on the queue */
+	unsigned head = *ring.cq_head;
+	unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+
+		if (cqe->user_data == RECV_TAG && cqe->res == -EINVAL) {
+			printf("io_uring has no multishot recvmsg\n");
+			uring_close();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static ssize_t uring_sendto(const void* buf, size_t len, const struct sockaddr* to, socklen_t tolen, int64_t txtime) {
+	send_slot* slot = NULL;
+	struct io_uring_sqe* sqe;
+
+	if (len > sizeof(slot->data) || tolen > sizeof(slot->to)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	/* Find a free slot, waiting for send completions if all are in flight */
+	while (slot == NULL) {
+		for (int i = 0; i < SEND_SLOTS; i++) {
+			if (!ring.slots[i].busy) {
+				slot = &ring.slots[i];
+				break;
+			}
+		}
+		if (slot == NULL) {
+			uring_submit(1, NULL);
+			uring_reap();
+		}
+	}
+
+	sqe = uring_get_sqe();
+	if (sqe == NULL) {
+		uring_submit(0, NULL);
+		sqe = uring_get_sqe();
+	}
+
+	/* Copy into the pool, the caller reuses its packet right away. The slots are not
+	 * registered as fixed buffers, sendmsg cannot use them */
+	memcpy(slot->data, buf, len);
+	memcpy(&slot->to, to, tolen);
+	slot->iov.iov_base = slot->data;
+	slot->iov.iov_len = len;
+	memset(&slot->msg, 0, sizeof(slot->msg));
+	slot->msg.msg_name = &slot->to;
+	slot->msg.msg_namelen = tolen;
+	slot->msg.msg_iov = &slot->iov;
+	slot->msg.msg_iovlen = 1;
+	if (txtime > 0) {
+		pace_cmsg(&slot->msg, slot->control, sizeof(slot->control), txtime);
+	}
+	slot->busy = 1;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = ring.sockfd;
+	sqe->addr = (uint64_t)(uintptr_t)&slot->msg;
+	sqe->len = 1;
+	sqe->user_data = (uint64_t)(slot - ring.slots);
+
+	/* Submitted in one batch by gbn_flush, gbn_wait or gbn_recvfrom */
+	return (ssize_t)len;
+}
+
+static ssize_t uring_recvfrom(void* buf, size_t len, struct sockaddr* from, socklen_t* fromlen) {
+	struct io_uring_cqe* cqe;
+
+	/* Block until a packet has been received */
+	while ((cqe = uring_reap()) == NULL) {
+		if (uring_submit(1, NULL) < 0 && errno != EINTR) {
+			return -1;
+		}
+	}
+
+	unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	recv_buf* rb = &ring.bufs[bid];
+	size_t n = rb->out.payloadlen < len ? rb->out.payloadlen : len;
+
+	memcpy(buf, rb->data, n);
+	if (from != NULL && fromlen != NULL) {
+		socklen_t alen = rb->out.namelen < *fromlen ? rb->out.namelen : *fromlen;
+		memcpy(from, &rb->from, alen);
+		*fromlen = rb->out.namelen;
+	}
+
+	/* Consume the CQE and hand the buffer back */
+	__atomic_store_n(ring.cq_head, *ring.cq_head + 1, __ATOMIC_RELEASE);
+	uring_recycle(bid);
+	return (ssize_t)n;
+}
+
+static int uring_wait(int64_t deadline) {
+	while (uring_reap() == NULL) {
+		int64_t left = deadline - monotonic_ns();
+		struct timespec ts;
+
+		if (left <= 0) {
+			return 0;
+		}
+		ts.tv_sec = left / 1000000000;
+		ts.tv_nsec = left % 1000000000;
+
+		/* Submit pending sends and sleep until a completion or the deadline */
+		if (uring_submit(1, &ts) < 0 && errno != ETIME && errno != EINTR) {
+			return -1;
+		}
+	}
+	return 1;
+}
+
+#endif /* HAVE_IO_URING */
+
+
+#ifdef HAVE_EPOLL
+
+/* Waiting layer, one epoll set and deadline timer per thread shared by all its sockets */
+static __thread int epfd = -1;
+static __thread int tfd = -1;
+static __thread unsigned char* fd_ready;   /* Reported readable while waiting on another fd */
+static __thread unsigned char* fd_added;   /* Already in the epoll set */
+static __thread int fd_cap;
+
+#define TIMER_KEY (-1)          /* epoll data of the timer, sockets use their fd */
+
+static void epoll_setup(void) {
+	struct epoll_event ev;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (epfd == -1 || tfd == -1) {
+		perror("epoll/timerfd");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = TIMER_KEY;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) == -1) {
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* (Re)arm sockfd, one-shot so a readable socket nobody waits on does not spin epoll_wait */
+static void epoll_arm(int sockfd) {
+	struct epoll_event ev;
+
+	if (sockfd >= fd_cap) {
+		int cap = fd_cap ? fd_cap : 64;
+		while (cap <= sockfd) {
+			cap *= 2;
+		}
+		fd_ready = realloc(fd_ready, cap);
+		fd_added = realloc(fd_added, cap);
+		if (fd_ready == NULL || fd_added == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		memset(fd_ready + fd_cap, 0, cap - fd_cap);
+		memset(fd_added + fd_cap, 0, cap - fd_cap);
+		fd_cap = cap;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.fd = sockfd;
+	if (fd_added[sockfd] && epoll_ctl(epfd, EPOLL_CTL_MOD, sockfd, &ev) == 0) {
+		return;
+	}
+
+	/* New fd, or the old one was closed and the number reused */
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) == -1) {
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+	fd_added[sockfd] = 1;
+}
+
+static int epoll_wait_fd(int sockfd, int64_t deadline) {
+	struct epoll_event events[32];
+	struct itimerspec its;
+	char peek;
+
+	if (epfd == -1) {
+		epoll_setup();
+	}
+
+	/* Already seen readable while another socket was waited on */
+	if (sockfd < fd_cap && fd_ready[sockfd]) {
+		fd_ready[sockfd] = 0;
+		if (recv(sockfd, &peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT) >= 0) {
+			return 1;
+		}
+	}
+	epoll_arm(sockfd);
+
+	/* Absolute deadline, nanosecond resolution */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = deadline / 1000000000;
+	its.it_value.tv_nsec = deadline % 1000000000;
+	if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+		perror("timerfd_settime");
+		exit(EXIT_FAILURE);
+	}
+
+	while (1) {
+		int n = epoll_wait(epfd, events, 32, -1);
+
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		int readable = 0;
+		int expired = 0;
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.fd == TIMER_KEY) {
+				uint64_t ticks;
+				if (read(tfd, &ticks, sizeof(ticks)) == sizeof(ticks)) {
+					expired = 1;
+				}
+			}
+			else if (events[i].data.fd == sockfd) {
+				readable = 1;
+			}
+			else {
+				fd_ready[events[i].data.fd] = 1;
+			}
+		}
+
+		if (readable) {
+			return 1;
+		}
+		if (expired || monotonic_ns() >= deadline) {
+			return 0;
+		}
+	}
+}
+
+#endif /* HAVE_EPOLL */
+
+
+/* Select I/O backend for sockfd, returns the backend actually in use */
+int gbn_io_init(int sockfd, int backend) {
+	io_backend = IO_SOCKET;
+
+#ifdef HAVE_IO_URING
+	if (backend == IO_URING) {
+		if (uring_init(sockfd) == 0) {
+			io_backend = IO_URING;
+			printf("I/O backend: io_uring\n");
+		}
+		else {
+			printf("io_uring not available, using sockets\n");
+		}
+	}
+#else
+	if (backend == IO_URING) {
+		printf("io_uring not available, using sockets\n");
+	}
+#endif
+
+	return io_backend;
+}
+
+void gbn_io_close(int sockfd) {
+#ifdef HAVE_IO_URING
+	if (io_backend == IO_URING) {
+		gbn_flush(sockfd);
+		uring_close();
+	}
+#endif
+	io_backend = IO_SOCKET;
+}
+
+/* Start pacing sends on sockfd, kernel pacing is used if the socket takes SO_TXTIME.
+ * Returns 1 with kernel pacing, 0 with the userspace timer */
+int gbn_pace_init(int sockfd) {
+	memset(&pace, 0, sizeof(pace));
+
+#if defined(SO_TXTIME) && PACE_TXTIME
+	struct sock_txtime cfg;
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.clockid = CLOCK_MONOTONIC;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) == 0) {
+		pace.txtime = 1;
+	}
+#else
+	(void)sockfd;
+#endif
+
+	return pace.txtime;
+}
+
+/* Set the pacing rate in bytes per second, 0 stops pacing */
+void gbn_pace_rate(uint64_t rate) {
+	pace.rate = rate;
+}
+
+/* When a packet handed to gbn_sendto now would leave, for timestamps taken before the send */
+int64_t gbn_departure_ns(void) {
+	int64_t held = pace.rate > 0 ? pace.next - monotonic_ns() : 0;
+
+	return gbn_now_ns() + (held > 0 ? held : 0);
+}
+
+/* Departure time of a len byte packet, 0 if it may leave now. Tokens build up for at
+ * most PACING_BURST packets, so an idle sender can burst that much and no more */
+static int64_t pace_departure(size_t len) {
+	int64_t now;
+	int64_t burst;
+	int64_t departure;
+
+	if (pace.rate == 0) {
+		return 0;
+	}
+
+	now = monotonic_ns();
+	burst = (int64_t)(PACING_BURST * len * 1000000000ULL / pace.rate);
+	if (pace.next < now - burst) {
+		pace.next = now - burst;
+	}
+	departure = pace.next;
+	pace.next += (int64_t)(len * 1000000000ULL / pace.rate);
+
+	return departure > now ? departure : 0;
+}
+
+/* Transport behind sockfd, a transport with its own clock becomes this thread's clock */
+static const gbn_transport* io_transport(int sockfd) {
+	const gbn_transport* t = gbn_transport_get(sockfd);
+
+	if (t != NULL && t->now_ns != NULL) {
+		io_clock = sockfd;
+	}
+	return t;
+}
+
+static ssize_t io_sendto(int sockfd, const void* buf, size_t len, int flags, const struct sockaddr* to, socklen_t tolen) {
+	const gbn_transport* t = io_transport(sockfd);
+	if (t != NULL) { /* Not paced, the transport decides when packets arrive */
+		return t->sendto(t->ctx, buf, len, to, tolen);
+	}
+
+	int64_t txtime = pace_departure(len);
+
+	/* Userspace pacing, sleep until the packet may leave */
+	if (txtime > 0 && !pace.txtime) {
+		struct timespec ts;
+
+		gbn_flush(sockfd);
+		ts.tv_sec = txtime / 1000000000;
+		ts.tv_nsec = txtime % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+		}
+		txtime = 0;
+	}
+
+#ifdef HAVE_IO_URING
+	if (io_backend == IO_URING) {
+		return uring_sendto(buf, len, to, tolen, txtime);
+	}
+#endif
+
+	if (txtime > 0) { /* Kernel pacing, the fq qdisc holds the packet until txtime */
+		struct iovec iov;
+		struct msghdr msg;
+		char control[CMSG_SPACE(sizeof(uint64_t))];
+
+		iov.iov_base = (void*)buf;
+		iov.iov_len = len;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = (void*)to;
+		msg.msg_namelen = tolen;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		pace_cmsg(&msg, control, sizeof(control), txtime);
+		return sendmsg(sockfd, &msg, flags);
+	}
+
+	return sendto(sockfd, buf, len, flags, to, tolen);
+}
+
+/* Kernel receive time (CLOCK_REALTIME) on the gbn_now_ns clock, by how long ago it was */
+static int64_t rx_stamp_time(const struct timespec* ts) {
+	struct timespec real;
+	int64_t now = gbn_now_ns();
+	int64_t age;
+
+	clock_gettime(CLOCK_REALTIME, &real);
+	age = (int64_t)(real.tv_sec - ts->tv_sec) * 1000000000 + (real.tv_nsec - ts->tv_nsec);
+	return age > 0 ? now - age : now;
+}
+
+/* recvfrom that also takes the kernel's arrival time from the control messages */
+static ssize_t stamped_recvfrom(int sockfd, void* buf, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen) {
+	struct iovec iov;
+	struct msghdr msg;
+	char control[CMSG_SPACE(3 * sizeof(struct timespec))];
+	ssize_t n;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = from;
+	msg.msg_namelen = fromlen != NULL ? *fromlen : 0;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	n = recvmsg(sockfd, &msg, flags);
+	if (n < 0) {
+		return n;
+	}
+	if (fromlen != NULL) {
+		*fromlen = msg.msg_namelen;
+	}
+
+	rx_time = 0;
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		struct timespec ts[3];
+
+		if (cmsg->cmsg_level != SOL_SOCKET) {
+			continue;
+		}
+#ifdef SCM_TIMESTAMPING
+		if (cmsg->cmsg_type == SCM_TIMESTAMPING) { /* Software stamp first, then legacy and hardware */
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+			rx_time = rx_stamp_time(&ts[0]);
+		}
+#endif
+#ifdef SCM_TIMESTAMPNS
+		if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(ts[0]));
+			rx_time = rx_stamp_time(&ts[0]);
+		}
+#endif
+	}
+	if (rx_time == 0) {
+		rx_time = gbn_now_ns();
+	}
+	return n;
+}
+
+static ssize_t io_recvfrom(int sockfd, void* buf, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen) {
+	const gbn_transport* t = io_transport(sockfd);
+	ssize_t n;
+
+	if (t != NULL) {
+		n = t->recvfrom(t->ctx, buf, len, from, fromlen);
+		rx_time = gbn_now_ns();
+		return n;
+	}
+
+#ifdef HAVE_IO_URING
+	if (io_backend == IO_URING) {
+		n = uring_recvfrom(buf, len, from, fromlen);
+		rx_time = gbn_now_ns();
+		return n;
+	}
+#endif
+	if (rx_stamps) {
+		return stamped_recvfrom(sockfd, buf, len, flags, from, fromlen);
+	}
+	n = recvfrom(sockfd, buf, len, flags, from, fromlen);
+	rx_time = gbn_now_ns();
+	return n;
+}
+
+/* Every packet goes through these two, they are where it is captured */
+ssize_t gbn_sendto(int sockfd, const void* buf, size_t len, int flags, const struct sockaddr* to, socklen_t tolen) {
+	ssize_t n = io_sendto(sockfd, buf, len, flags, to, tolen);
+
+	if (n >= 0) {
+		gbn_pcap_packet(PCAP_SENT, sockfd, buf, len, to, gbn_now_ns());
+	}
+	return n;
+}
+
+ssize_t gbn_recvfrom(int sockfd, void* buf, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen) {
+	ssize_t n = io_recvfrom(sockfd, buf, len, flags, from, fromlen);
+
+	if (n > 0) {
+		gbn_pcap_packet(PCAP_RECEIVED, sockfd, buf, n, from, rx_time);
+	}
+	return n;
+}
+
+/* Have the kernel timestamp packets arriving on sockfd, returns 1 if it does */
+int gbn_timestamps_init(int sockfd) {
+	rx_stamps = 0;
+
+#ifdef SO_TIMESTAMPING
+	int stamping = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &stamping, sizeof(stamping)) == 0) {
+		rx_stamps = 1;
+	}
+#endif
+#ifdef SO_TIMESTAMPNS
+	int on = 1;
+	if (!rx_stamps && setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0) {
+		rx_stamps = 1;
+	}
+#endif
+
+	return rx_stamps;
+}
+
+/* Arrival time of the last packet gbn_recvfrom returned, taken by the kernel if it can */
+int64_t gbn_rx_time(void) {
+	return rx_time;
+}
+
+/* The socket option for the don't-fragment mode of sends to family, 0 if there is none */
+static int df_option(int family, int* level, int* name) {
+#if defined(IP_MTU_DISCOVER) && defined(IPV6_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE) && defined(IPV6_PMTUDISC_PROBE)
+	*level = family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+	*name = family == AF_INET6 ? IPV6_MTU_DISCOVER : IP_MTU_DISCOVER;
+	return 1;
+#else
+	(void)family;
+	(void)level;
+	(void)name;
+	return 0;
+#endif
+}
+
+/* Set the don't-fragment bit on every send to peer, path MTU probes and DATA alike. A
+ * segment too big for the path is then lost, not fragmented, and pmtu_blackhole finds out.
+ * The kernel's idea of the path MTU does not hold back probes (PROBE, not DO).
+ * Returns the mode the socket had for gbn_df_restore, -1 if it was not changed */
+int gbn_df_set(int sockfd, const struct sockaddr* peer) {
+	int level;
+	int name;
+	int mode;
+	socklen_t mode_len = sizeof(mode);
+
+	if (io_transport(sockfd) != NULL || !df_option(peer->sa_family, &level, &name) ||
+		getsockopt(sockfd, level, name, &mode, &mode_len) < 0) {
+		return -1;
+	}
+
+	/* Queued sends go first, under the socket's old setting */
+	gbn_flush(sockfd);
+#if defined(IP_PMTUDISC_PROBE) && defined(IPV6_PMTUDISC_PROBE)
+	int probe = peer->sa_family == AF_INET6 ? IPV6_PMTUDISC_PROBE : IP_PMTUDISC_PROBE;
+	if (setsockopt(sockfd, level, name, &probe, sizeof(probe)) < 0) {
+		perror("setsockopt");
+		return -1;
+	}
+#endif
+	return mode;
+}
+
+/* Give the socket back the mode gbn_df_set found */
+void gbn_df_restore(int sockfd, const struct sockaddr* peer, int mode) {
+	int level;
+	int name;
+
+	if (mode < 0 || !df_option(peer->sa_family, &level, &name)) {
+		return;
+	}
+	gbn_flush(sockfd);
+	if (setsockopt(sockfd, level, name, &mode, sizeof(mode)) < 0) {
+		perror("setsockopt");
+	}
+}
+
+/* Send a path MTU probe. The socket is in don't-fragment mode for the whole transfer
+ * (gbn_df_set), this only sends at once so a probe too big for the interface fails here
+ * with EMSGSIZE */
+ssize_t gbn_sendto_df(int sockfd, const void* buf, size_t len, const struct sockaddr* to, socklen_t tolen) {
+	const gbn_transport* t = io_transport(sockfd);
+	ssize_t n;
+
+	if (t != NULL) {
+		n = t->sendto(t->ctx, buf, len, to, tolen);
+	}
+	else {
+		/* Queued sends go first, in order */
+		gbn_flush(sockfd);
+		n = sendto(sockfd, buf, len, 0, to, tolen);
+	}
+
+	if (n >= 0) {
+		gbn_pcap_packet(PCAP_SENT, sockfd, buf, len, to, gbn_now_ns());
+	}
+	return n;
+}
+
+/* Largest segment the route to peer takes without fragmenting, from the MTU of its
+ * interface. MAXMSG if that can not be found out */
+int gbn_path_mss(const struct sockaddr* peer, socklen_t peer_len) {
+	int mss = MAXMSG;
+
+#if defined(IP_MTU) && defined(IPV6_MTU)
+	int fd = socket(peer->sa_family, SOCK_DGRAM, 0);
+	int mtu;
+	socklen_t mtu_len = sizeof(mtu);
+
+	/* A connected socket has a route, and the route an MTU */
+	if (fd >= 0 && connect(fd, peer, peer_len) == 0) {
+		if (peer->sa_family == AF_INET6) {
+			if (getsockopt(fd, IPPROTO_IPV6, IPV6_MTU, &mtu, &mtu_len) == 0) {
+				mss = mtu - 40 - 8 - (int)offsetof(rtp, data);
+			}
+		}
+		else if (getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &mtu_len) == 0) {
+			mss = mtu - 20 - 8 - (int)offsetof(rtp, data);
+		}
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+#endif
+
+	if (mss > MAXMSG) {
+		mss = MAXMSG;
+	}
+	return mss;
+}
+
+/* Push queued sends to the kernel, a no-op for plain sockets */
+int gbn_flush(int sockfd) {
+	if (gbn_transport_get(sockfd) != NULL) {
+		return 0;
+	}
+
+#ifdef HAVE_IO_URING
+	if (io_backend == IO_URING) {
+		return uring_submit(0, NULL);
+	}
+#endif
+	return 0;
+}
+
+/* Monotonic clock in nanoseconds, or the virtual clock of a simulated transport in use */
+int64_t gbn_now_ns(void) {
+	if (io_clock >= 0) {
+		const gbn_transport* t = gbn_transport_get(io_clock);
+		if (t != NULL && t->now_ns != NULL) {
+			return t->now_ns(t->ctx);
+		}
+		io_clock = -1;
+	}
+	return monotonic_ns();
+}
+
+/* Wait until sockfd is readable. Returns 1 if readable, 0 on timeout and -1 on error,
+ * the time left is written back to timeout_ns. A transport waits on its own clock, a
+ * socket's deadline is on the monotonic clock the timerfd runs on */
+int gbn_wait_ns(int sockfd, int64_t* timeout_ns) {
+	const gbn_transport* t = io_transport(sockfd);
+	if (t != NULL) {
+		return t->wait_ns(t->ctx, timeout_ns);
+	}
+
+	int64_t deadline = monotonic_ns() + *timeout_ns;
+	int result;
+
+#ifdef HAVE_IO_URING
+	if (io_backend == IO_URING) {
+		result = uring_wait(deadline);
+	}
+	else
+#endif
+	{
+#ifdef HAVE_EPOLL
+		result = epoll_wait_fd(sockfd, deadline);
+#else
+		fd_set readFdSet;
+		struct timeval tv;
+
+		tv.tv_sec = *timeout_ns / 1000000000;
+		tv.tv_usec = (*timeout_ns % 1000000000) / 1000;
+		FD_ZERO(&readFdSet);
+		FD_SET(sockfd, &readFdSet);
+		result = select(sockfd + 1, &readFdSet, NULL, NULL, &tv);
+#endif
+	}
+
+	*timeout_ns = deadline - monotonic_ns();
+	if (*timeout_ns < 0 || result == 0) {
+		*timeout_ns = 0;
+	}
+	return result;
+}
+
+/* gbn_wait_ns with a timeval, the time left is written back like select() does on Linux */
+int gbn_wait(int sockfd, struct timeval* timeout) {
+	int64_t ns = (int64_t)timeout->tv_sec * 1000000000 + (int64_t)timeout->tv_usec * 1000;
+	int result = gbn_wait_ns(sockfd, &ns);
+
+	timeout->tv_sec = ns / 1000000000;
+	timeout->tv_usec = (ns % 1000000000) / 1000;
+	return result;
+}
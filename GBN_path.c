@@ -0,0 +1,197 @@
+/* File: GBN_path.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Connections that outlive their peer's address. The receiver gives every
+ *              connection an id in the handshake and both ends put it in each packet, so a
+ *              packet still belongs to its connection when a NAT on the way maps the sender
+ *              to a new port. Packets with the id from a new address are taken in, but
+ *              nothing is sent there until a CHALLENGE to it comes back as a RESPONSE with
+ *              the same token; then the peer has moved. An idle connection sends KEEPALIVEs,
+ *              which hold the NAT binding and tell whether the peer is still there.
+ */
+
+#include "GBN.h"
+
+
+#define KEEPALIVE_MIN_TIMEOUT (10 * 1000000LL)     /* A KEEPALIVE is lost after 3 RTTs, but not before this (ns) */
+#define KEEPALIVE_TIMEOUT (1000 * 1000000LL)       /* Before there is an RTT sample (ns) */
+
+
+/* A new connection id, owner (a server worker) in the top byte and random bits below.
+ * Never 0, that is a packet from before the handshake */
+uint32_t path_conn_id(int owner) {
+	uint32_t id;
+
+	do {
+		id = (uint32_t)owner << 24 | ((uint32_t)gbn_random() & 0xffffff);
+	} while (id == 0);
+	return id;
+}
+
+/* 1 if a and b are the same address and port */
+int path_same(const struct sockaddr* a, const struct sockaddr* b) {
+	if (a->sa_family != b->sa_family) {
+		return 0;
+	}
+	if (a->sa_family == AF_INET6) {
+		const struct sockaddr_in6* x = (const struct sockaddr_in6*)a;
+		const struct sockaddr_in6* y = (const struct sockaddr_in6*)b;
+		return x->sin6_port == y->sin6_port && memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+	}
+	const struct sockaddr_in* x = (const struct sockaddr_in*)a;
+	const struct sockaddr_in* y = (const struct sockaddr_in*)b;
+	return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+}
+
+/* Handshake-sized packet of our connection, with the checksum of state.options */
+static void path_packet(rtp* packet, int flags, uint8_t seq, uint64_t token) {
+	memset(packet, 0, offsetof(rtp, data) + sizeof(syn_params));
+	packet->flags = flags;
+	packet->seq = seq;
+	packet->conn_id = state.conn_id;
+	memcpy(packet->data, &token, sizeof(token));
+	packet->checksum = checksum(packet);
+}
+
+/* Receiver: a packet came from "from". Returns 1 if it is from the peer, or carries our
+ * connection id and a valid checksum, and is to be taken in. Replies still go to the peer,
+ * a packet from a new address sends a CHALLENGE there instead. Returns 2 when that address
+ * answered with the RESPONSE, peer is then moved to it, and 0 for packets to drop. SYNs
+ * have no id and are left to the caller. state.options and state.conn_id are the connection's */
+int path_check(int sockfd, gbn_path* path, rtp* packet, const struct sockaddr* from, socklen_t from_len,
+	struct sockaddr_storage* peer, socklen_t* peer_len) {
+	int64_t now = gbn_now_ns();
+	int challenge = 0;
+
+	if (packet->flags == SYN) {
+		return 1;
+	}
+	if (path_same(from, (struct sockaddr*)peer)) {
+		return packet->flags == RESPONSE ? 0 : 1;
+	}
+	if (state.conn_id == 0 || packet->conn_id != state.conn_id || packet->checksum != checksum(packet)) {
+		return 0;
+	}
+
+	if (path->len == 0 || !path_same(from, (struct sockaddr*)&path->address)) {
+		if (packet->flags == RESPONSE) {
+			return 0;
+		}
+
+		/* A new address, only the latest one is tried */
+		memcpy(&path->address, from, from_len);
+		path->len = from_len;
+		path->token = gbn_random();
+		challenge = 1;
+	}
+	else if (packet->flags == RESPONSE) {
+		uint64_t token;
+		memcpy(&token, packet->data, sizeof(token));
+		if (token != path->token) {
+			return 0;
+		}
+
+		/* It reaches the peer, the old address is forgotten */
+		memcpy(peer, from, from_len);
+		*peer_len = from_len;
+		path->len = 0;
+		printf("Peer address validated, connection %08x moved\n", state.conn_id);
+		return 2;
+	}
+	else {
+		/* Asked again with the same token, a late RESPONSE still counts */
+		challenge = now - path->sent_at >= PATH_RETRY * 1000LL;
+	}
+
+	if (challenge) {
+		rtp CHALLENGE_packet;
+
+		path->sent_at = now;
+		path_packet(&CHALLENGE_packet, CHALLENGE, packet->seq, path->token);
+		if (gbn_sendto(sockfd, &CHALLENGE_packet, gbn_packet_size(&CHALLENGE_packet), 0, from, from_len) < 0) {
+			perror("Could not send CHALLENGE");
+		}
+		else {
+			printf("Connection %08x seen from a new address, CHALLENGE sent\n", state.conn_id);
+		}
+	}
+	return 1;
+}
+
+/* Sender: answer a CHALLENGE of our connection in place, from wherever we are now.
+ * Returns 1 if packet was one */
+int path_respond(int sockfd, rtp* packet) {
+	if (packet->flags != CHALLENGE || packet->conn_id != state.conn_id || packet->checksum != checksum(packet)) {
+		return 0;
+	}
+
+	packet->flags = RESPONSE;
+	packet->checksum = checksum(packet);
+	if (gbn_sendto(sockfd, packet, gbn_packet_size(packet), 0, (struct sockaddr*)&state.address, state.sck_len) < 0) {
+		perror("Could not send RESPONSE");
+	}
+	else {
+		printf("Answered a path CHALLENGE\n");
+	}
+	return 1;
+}
+
+/* Receiver: answer a KEEPALIVE in place, to the validated peer */
+void path_keepalive_answer(int sockfd, rtp* packet, const struct sockaddr* peer, socklen_t peer_len) {
+	packet->flags = KEEPALIVEACK;
+	packet->conn_id = state.conn_id;
+	packet->checksum = checksum(packet);
+
+	if (gbn_sendto(sockfd, packet, gbn_packet_size(packet), 0, peer, peer_len) < 0) {
+		perror("Could not answer KEEPALIVE");
+	}
+}
+
+static int64_t keepalive_timeout(void) {
+	if (state.srtt_ns == 0) {
+		return KEEPALIVE_TIMEOUT;
+	}
+	return 3 * state.srtt_ns > KEEPALIVE_MIN_TIMEOUT ? 3 * state.srtt_ns : KEEPALIVE_MIN_TIMEOUT;
+}
+
+/* Sender, between transfers: send a KEEPALIVE and wait for its answer, up to KEEPALIVE_TRIES
+ * times. Path CHALLENGEs are answered meanwhile, a KEEPALIVE from behind a NAT that picked a
+ * new port is what shows the receiver the new address. Call it at least every KEEPALIVE_IDLE
+ * seconds while the connection is idle. Returns 0 if the peer answered, -1 if not */
+int gbn_keepalive(int sockfd) {
+	arena_mark mark = arena_get_mark(arena_thread());
+	rtp* packet = arena_alloc(arena_thread(), sizeof(*packet));
+	struct sockaddr_storage from;
+	socklen_t from_len;
+
+	for (int tries = 0; tries < KEEPALIVE_TRIES; tries++) {
+		uint8_t seq = (uint8_t)gbn_random();
+
+		path_packet(packet, KEEPALIVE, seq, 0);
+		if (gbn_sendto(sockfd, packet, gbn_packet_size(packet), 0, (struct sockaddr*)&state.address, state.sck_len) < 0) {
+			perror("Could not send KEEPALIVE");
+			break;
+		}
+		printf("KEEPALIVE sent\n");
+
+		int64_t timeout = keepalive_timeout();
+		while (gbn_wait_ns(sockfd, &timeout) > 0) {
+			from_len = sizeof(from);
+			if (gbn_recvfrom(sockfd, packet, sizeof(*packet), 0, (struct sockaddr*)&from, &from_len) == -1) {
+				perror("Can't read from socket");
+				arena_release(arena_thread(), mark);
+				return -1;
+			}
+
+			if (packet->flags == KEEPALIVEACK && packet->seq == seq && packet->checksum == checksum(packet)) {
+				printf("KEEPALIVE answered\n");
+				arena_release(arena_thread(), mark);
+				return 0;
+			}
+			path_respond(sockfd, packet);
+		}
+	}
+
+	printf("No answer to KEEPALIVE, peer is gone\n");
+	arena_release(arena_thread(), mark);
+	return -1;
+}
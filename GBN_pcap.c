@@ -0,0 +1,133 @@
+/* File: GBN_pcap.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Packet capture. Once gbn_pcap_open is called every packet the process sends or
+ *              receives through GBN_io.c is written to a pcap file, together with the ones
+ *              maybe_sendto loses or corrupts on purpose. Records use LINKTYPE_USER0: a
+ *              pcap_gbn header (what happened, socket and peer) and then the packet as it
+ *              went on the wire, an rtp as laid out in GBN.h. tools/gbn_analyze.c reads them.
+ */
+
+#include "GBN.h"
+#include <stdatomic.h>
+
+
+#define PCAP_MAGIC_NS 0xa1b23c4d    /* pcap with nanosecond timestamps */
+#define LINKTYPE_USER0 147
+
+
+/* pcap file and record headers */
+typedef struct pcap_file_hdr_t {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} pcap_file_hdr;
+
+typedef struct pcap_rec_hdr_t {
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_rec_hdr;
+
+
+static _Atomic(FILE*) pcap_file;  /* Set under pcap_lock, gbn_pcap_packet peeks without it */
+static size_t pcap_snaplen;
+static int64_t pcap_epoch;      /* Wall clock minus gbn_now_ns when the capture started */
+static pthread_mutex_t pcap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Start capturing to path, truncating it. Only the first snaplen bytes of each packet are
+ * kept, 0 for whole packets (offsetof(rtp, data) is enough for the analyzer). Returns 0 or -1 */
+int gbn_pcap_open(const char* path, size_t snaplen) {
+	pcap_file_hdr hdr;
+	struct timespec ts;
+	FILE* f = fopen(path, "wb");
+
+	if (f == NULL) {
+		perror("fopen");
+		return -1;
+	}
+
+	hdr.magic = PCAP_MAGIC_NS;
+	hdr.version_major = 2;
+	hdr.version_minor = 4;
+	hdr.thiszone = 0;
+	hdr.sigfigs = 0;
+	hdr.snaplen = sizeof(pcap_gbn) + (snaplen > 0 && snaplen < sizeof(rtp) ? snaplen : sizeof(rtp));
+	hdr.network = LINKTYPE_USER0;
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+		perror("fwrite");
+		fclose(f);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	pthread_mutex_lock(&pcap_lock);
+	if (pcap_file != NULL) {
+		fclose(pcap_file);
+	}
+	pcap_epoch = ts.tv_sec * 1000000000LL + ts.tv_nsec - gbn_now_ns();
+	pcap_snaplen = snaplen;
+	pcap_file = f;
+	pthread_mutex_unlock(&pcap_lock);
+	return 0;
+}
+
+void gbn_pcap_close(void) {
+	pthread_mutex_lock(&pcap_lock);
+	if (pcap_file != NULL) {
+		fclose(pcap_file);
+		pcap_file = NULL;
+	}
+	pthread_mutex_unlock(&pcap_lock);
+}
+
+/* Record a packet, event is one of PCAP_SENT, PCAP_RECEIVED, PCAP_DROPPED and
+ * PCAP_CORRUPTED, at a gbn_now_ns time. peer may be NULL */
+void gbn_pcap_packet(int event, int sockfd, const void* buf, size_t len, const struct sockaddr* peer, int64_t at) {
+	pcap_rec_hdr rec;
+	pcap_gbn gbn;
+
+	if (atomic_load_explicit(&pcap_file, memory_order_relaxed) == NULL) { /* Not capturing, checked again under the lock */
+		return;
+	}
+
+	memset(&gbn, 0, sizeof(gbn));
+	gbn.event = event;
+	gbn.sockfd = sockfd;
+	if (peer != NULL && peer->sa_family == AF_INET) {
+		const struct sockaddr_in* in4 = (const struct sockaddr_in*)peer;
+		gbn.family = AF_INET;
+		gbn.port = in4->sin_port;
+		memcpy(gbn.addr, &in4->sin_addr, sizeof(in4->sin_addr));
+	}
+	else if (peer != NULL && peer->sa_family == AF_INET6) {
+		const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)peer;
+		gbn.family = AF_INET6;
+		gbn.port = in6->sin6_port;
+		memcpy(gbn.addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+	}
+
+	pthread_mutex_lock(&pcap_lock);
+	if (pcap_file != NULL) {
+		size_t caplen = pcap_snaplen > 0 && pcap_snaplen < len ? pcap_snaplen : len;
+		int64_t t = pcap_epoch + at;
+
+		rec.ts_sec = t / 1000000000;
+		rec.ts_nsec = t % 1000000000;
+		rec.incl_len = sizeof(gbn) + caplen;
+		rec.orig_len = sizeof(gbn) + len;
+		if (fwrite(&rec, sizeof(rec), 1, pcap_file) != 1 || fwrite(&gbn, sizeof(gbn), 1, pcap_file) != 1 ||
+			fwrite(buf, 1, caplen, pcap_file) != caplen) {
+			perror("Can't write capture, stopping it");
+			fclose(pcap_file);
+			pcap_file = NULL;
+		}
+	}
+	pthread_mutex_unlock(&pcap_lock);
+}
@@ -0,0 +1,747 @@
+/* File: GBN_pipeline.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Pipelined sending of a byte buffer, sender_gbn with GBN_PIPELINE. sender_gbn
+ *              builds a packet, sends it and waits for ACKs in one loop, so a fast connection
+ *              goes no faster than one core gets through that loop. Here the work is split in
+ *              three stages on threads of their own: a segmenter cuts, compresses and
+ *              checksums packets into a ring of slots ahead of the window, the calling thread
+ *              sends them as the window opens and resends them on timeouts, and an ACK thread
+ *              reads the ACKs and moves the window. The stages hand work to each other through
+ *              single producer, single consumer rings and never take a lock. A stage with
+ *              nothing to do blocks on a bell of its own, an eventfd the stage handing it work
+ *              rings, and only if it is blocked.
+ *
+ *              A packet is built once and a retransmission sends it as it is, its timestamp is
+ *              when it was built. RTT samples come from the send times instead (Karn), the
+ *              echo only tells how long the receiver held the ACK.
+ *              Parity groups are closed by the segmenter, it builds packets in the order they
+ *              are first sent. All packets leave from the calling thread, which also answers
+ *              path CHALLENGEs for the ACK thread, and probes the path MTU. New segments are
+ *              cut at the size it finds, so how many packets there are is only known once
+ *              the segmenter has cut the last one. If the path stops taking them, the built
+ *              ones are too big to ever arrive: the stages are stopped and started again
+ *              from the packet the receiver expects, with the slots from there on cut again.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* pthread_setaffinity_np */
+#endif
+#include "GBN.h"
+#include <sched.h>
+#include <stdatomic.h>
+
+#if defined(__linux__)
+#define HAVE_EVENTFD 1
+#include <sys/eventfd.h>
+#endif
+
+
+#define PIPE_RING 256                       /* Items per ring, power of two, more than PIPELINE_SLOTS */
+#define PIPE_TIMEOUT (5 * 1000000000LL)     /* Retransmission timeout (ns) */
+#define PIPE_SPIN 64                        /* Empty looks before a stage blocks */
+
+/* Stages, their CPU and bell */
+#define PIPE_SEGMENTER 0
+#define PIPE_SENDER 1
+#define PIPE_ACKER 2
+
+/* Control ring items */
+#define PIPE_GO_BACK 0      /* Timeout, resend from packet n. at: timeouts in a row */
+#define PIPE_RESPOND 1      /* Answer the CHALLENGE in pipeline->challenge */
+#define PIPE_PROBEACK 2     /* A PROBE was answered, n: its seq, at: its len */
+
+/* pipe_sender */
+#define PIPE_RECUT 1        /* The segment size fell back, cut the unacknowledged ones again */
+
+
+/* A packet number and a time, or what the control item says */
+typedef struct pipe_item_t {
+    uint64_t n;
+    int64_t at;
+    int kind;
+} pipe_item;
+
+typedef struct pipe_ring_t {
+    _Atomic uint32_t head __attribute__((aligned(64)));     /* Next item to read, consumer only */
+    _Atomic uint32_t tail __attribute__((aligned(64)));     /* Next item to write, producer only */
+    pipe_item items[PIPE_RING] __attribute__((aligned(64)));
+} pipe_ring;
+
+/* Wakes a blocked stage. It says it is parked before it looks for work a last time, so
+ * whoever hands it work after that look sees it parked and rings */
+typedef struct pipe_bell_t {
+    _Atomic int parked __attribute__((aligned(64)));
+    int fd[2];                  /* eventfd in both, or a pipe */
+} pipe_bell;
+
+typedef struct gbn_pipeline_t {
+    int sockfd;
+    const uint8_t* buf;
+    size_t len;
+    state_t conn;               /* The calling thread's connection, each stage starts from it */
+    rtp* slots;                 /* PIPELINE_SLOTS built packets, packet n in slot n % PIPELINE_SLOTS */
+    rtp* parity;                /* With FEC, the PARITY packet a packet closes in the same slot */
+    size_t* offsets;            /* Where the segment in each slot starts in buf */
+    rtp* ACK_packet;            /* ACK thread's receive buffer */
+    rtp* challenge;             /* CHALLENGE for the calling thread to answer */
+    rtp* PROBEACK_packet;       /* Sender's copy of a PROBEACK, for pmtu_ack */
+
+    pipe_ring built;            /* Segmenter to sender: packet n is in its slot, at: so is a PARITY */
+    pipe_ring sent;             /* Sender to ACK thread: packet n went out at "at", -1 if resent */
+    pipe_ring control;          /* ACK thread to sender: go back N, answer a CHALLENGE */
+    pipe_bell bells[3];         /* By stage */
+
+    _Atomic uint64_t total __attribute__((aligned(64)));    /* Packets in the transfer, UINT64_MAX until the last is cut */
+    _Atomic uint64_t base;      /* Oldest unacknowledged packet, ACK thread */
+    _Atomic int mss;            /* Size of new segments, sender */
+    _Atomic uint64_t sending;   /* Oldest packet the sender may still read, its slot is not reused */
+    _Atomic int64_t srtt_ns;    /* ACK thread's smoothed RTT, the sender paces by it */
+    _Atomic uint64_t lost;      /* Losses the ACK thread saw, FEC adapts to them */
+    _Atomic int challenge_busy; /* pipeline->challenge not answered yet */
+    _Atomic int going_back;     /* A go back is not resent yet, the ACK thread waits for it */
+    _Atomic int handshake_unconfirmed;
+    _Atomic int stop;           /* All acknowledged or the connection given up */
+    _Atomic int failed;
+
+    /* Where the stages start, packet 0 or the one the receiver expects after a black hole */
+    uint64_t first;
+    size_t first_offset;
+
+    /* Read after the stages are joined */
+    size_t end_offset;          /* Where the segmenter would have cut the next segment */
+    size_t sent_hi;             /* Packets the sender sent at least once */
+    uint64_t bytes_raw;         /* Segmenter's compression statistics */
+    uint64_t bytes_wire;
+} gbn_pipeline;
+
+
+/* Producer side. Returns 0 if the ring is full */
+static int ring_push(pipe_ring* ring, const pipe_item* item) {
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == PIPE_RING) {
+		return 0;
+	}
+	ring->items[tail & (PIPE_RING - 1)] = *item;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return 1;
+}
+
+/* Consumer side. Returns 0 if the ring is empty */
+static int ring_pop(pipe_ring* ring, pipe_item* item) {
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	if (atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+		return 0;
+	}
+	*item = ring->items[head & (PIPE_RING - 1)];
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return 1;
+}
+
+static void bell_open(pipe_bell* bell) {
+	atomic_init(&bell->parked, 0);
+#ifdef HAVE_EVENTFD
+	bell->fd[0] = bell->fd[1] = eventfd(0, EFD_CLOEXEC);
+	if (bell->fd[0] < 0) {
+		perror("eventfd");
+		exit(EXIT_FAILURE);
+	}
+#else
+	if (pipe(bell->fd) < 0) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+#endif
+}
+
+static void bell_close(pipe_bell* bell) {
+	close(bell->fd[0]);
+	if (bell->fd[1] != bell->fd[0]) {
+		close(bell->fd[1]);
+	}
+}
+
+/* Work was handed over. A system call only if the stage is parked, once per park */
+static void bell_ring(pipe_bell* bell) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&bell->parked, memory_order_relaxed) && atomic_exchange(&bell->parked, 0)) {
+#ifdef HAVE_EVENTFD
+		uint64_t one = 1;
+		if (write(bell->fd[1], &one, sizeof(one)) != sizeof(one)) {
+			perror("eventfd");
+		}
+#else
+		uint8_t one = 1;
+		if (write(bell->fd[1], &one, 1) != 1) {
+			perror("pipe");
+		}
+#endif
+	}
+}
+
+/* Nothing to do. Spin first, the stage before is most likely about to hand over work. Then
+ * park, the caller looks once more, and the next call blocks until the bell rings. A ring
+ * left over from a look that found work only costs one more look */
+static void pipe_idle(pipe_bell* bell, int* idle) {
+	if (++*idle < PIPE_SPIN) {
+#if defined(__x86_64__)
+		__builtin_ia32_pause();
+#endif
+		return;
+	}
+	if (*idle == PIPE_SPIN) {
+		atomic_store_explicit(&bell->parked, 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		return;
+	}
+
+#ifdef HAVE_EVENTFD
+	uint64_t rings;
+#else
+	uint8_t rings;
+#endif
+	if (read(bell->fd[0], &rings, sizeof(rings)) == -1 && errno != EINTR) {
+		perror("read");
+		exit(EXIT_FAILURE);
+	}
+	*idle = 0;
+}
+
+/* Run stage on CPU PIPELINE_CPU + stage, if pinning is asked for */
+static void pipe_pin(int stage) {
+#if defined(__linux__)
+	if (PIPELINE_CPU >= 0) {
+		cpu_set_t cpus;
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+		CPU_ZERO(&cpus);
+		CPU_SET((PIPELINE_CPU + stage) % (ncpu > 0 ? ncpu : 1), &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+			printf("Pipeline stage %d: could not pin to a CPU\n", stage);
+		}
+	}
+#endif
+}
+
+static void pipe_stop(gbn_pipeline* pipeline, int failed) {
+	if (failed) {
+		atomic_store(&pipeline->failed, 1);
+	}
+	atomic_store(&pipeline->stop, 1);
+	for (int stage = 0; stage < 3; stage++) {
+		bell_ring(&pipeline->bells[stage]);
+	}
+}
+
+
+/* Stage 1: cut, compress and checksum packets while there are free slots */
+static void* pipe_segmenter(void* arg) {
+	gbn_pipeline* pipeline = arg;
+	int idle = 0;
+
+	state = pipeline->conn;
+	state.bytes_raw = 0;
+	state.bytes_wire = 0;
+	pipe_pin(PIPE_SEGMENTER);
+
+	/* The sender half of FEC, its receive slots are in this thread's arena */
+	fec_t fec;
+	memset(&fec, 0, sizeof(fec));
+	if (state.fec_k > 0) {
+		fec_init(&fec, state.fec_k);
+	}
+
+	/* Striped flows have fixed segments, the others are cut at the size in use */
+	size_t total = state.stripe_count > 0 ? gbn_segments(pipeline->len) : SIZE_MAX;
+	size_t offset = pipeline->first_offset;
+	size_t n = pipeline->first;
+
+	while (!atomic_load(&pipeline->stop)) {
+		if (state.stripe_count > 0 ? n == total : offset == pipeline->len) {
+			break;
+		}
+
+		/* A slot is reused once its packet is acknowledged and the sender is past it. Base
+		 * is read first, the sender publishes where it reads from before it reads base */
+		uint64_t base = atomic_load(&pipeline->base);
+		uint64_t sending = atomic_load(&pipeline->sending);
+		if (n >= (base < sending ? base : sending) + PIPELINE_SLOTS) {
+			pipe_idle(&pipeline->bells[PIPE_SEGMENTER], &idle);
+			continue;
+		}
+
+		if (state.stripe_count > 0) {
+			offset = gbn_segment_offset(n);
+		}
+		else {
+			state.mss = atomic_load(&pipeline->mss);
+		}
+		size_t left = pipeline->len - offset;
+		size_t size = left < (size_t)state.mss ? left : (size_t)state.mss;
+		int last = state.stripe_count > 0 ? n + 1 == total : size == left;
+
+		rtp* DATA_packet = &pipeline->slots[n % PIPELINE_SLOTS];
+		pipeline->offsets[n % PIPELINE_SLOTS] = offset;
+		DATA_packet->flags = DATA;
+		DATA_packet->stream = 0;
+		DATA_packet->seq = (uint8_t)n;
+		data_packet_fill(DATA_packet, pipeline->buf + offset, size);
+
+		pipe_item item = { n, 0, 0 };
+		if (state.fec_k > 0) {
+			uint64_t lost = atomic_exchange(&pipeline->lost, 0);
+			if (lost > 0) {
+				fec_loss(&fec, lost);
+			}
+			if (fec_add(&fec, DATA_packet, n, last)) {
+				memcpy(&pipeline->parity[n % PIPELINE_SLOTS], &fec.parity, gbn_packet_size(&fec.parity));
+				item.at = 1;
+			}
+		}
+
+		/* Never full, the ring has room for more than all the slots */
+		ring_push(&pipeline->built, &item);
+		bell_ring(&pipeline->bells[PIPE_SENDER]);
+		idle = 0;
+		offset += size;
+		n++;
+	}
+	pipeline->end_offset = offset;
+	atomic_store(&pipeline->total, n);
+	bell_ring(&pipeline->bells[PIPE_ACKER]);
+
+	pipeline->bytes_raw += state.bytes_raw;
+	pipeline->bytes_wire += state.bytes_wire;
+	fec_free(&fec);
+	arena_destroy(arena_thread());
+	return NULL;
+}
+
+/* Stage 3: take ACKs, move the window and run the retransmission timer */
+static void* pipe_acker(void* arg) {
+	gbn_pipeline* pipeline = arg;
+	int sockfd = pipeline->sockfd;
+	rtp* ACK_packet = pipeline->ACK_packet;
+	int attempts = 0;   /* Timeouts in a row, at MAX_ATTEMPTS the connection is given up */
+	int failed = 0;
+
+	size_t base = pipeline->first;      /* Oldest unacknowledged packet */
+	size_t sent_hi = pipeline->first;   /* Packets sent so far */
+	size_t loss_base = SIZE_MAX; /* base when a loss was last counted, once per gap */
+	int64_t timer_at = 0;
+	int64_t sent_at[256];       /* Send time by packet number % 256, -1 once retransmitted */
+	int idle = 0;
+	pipe_item item;
+
+	state = pipeline->conn;
+	state.srtt_ns = atomic_load(&pipeline->srtt_ns);
+	pipe_pin(PIPE_ACKER);
+
+	while (base < atomic_load(&pipeline->total) && !atomic_load(&pipeline->stop)) {
+		/* Sends since the last look, the timer runs from the last send of the oldest packet */
+		int taken = 0;
+		while (ring_pop(&pipeline->sent, &item)) {
+			sent_at[item.n % 256] = item.at;
+			if (item.n >= sent_hi) {
+				sent_hi = item.n + 1;
+			}
+			if (item.n == base) {
+				timer_at = gbn_now_ns() + PIPE_TIMEOUT;
+			}
+			taken = 1;
+		}
+		if (taken) { /* The sender may wait for room */
+			bell_ring(&pipeline->bells[PIPE_SENDER]);
+		}
+
+		/* Nothing in flight, or the sender is resending after a timeout. No ACK to wait for
+		 * until it has sent */
+		if (base == sent_hi || atomic_load(&pipeline->going_back)) {
+			pipe_idle(&pipeline->bells[PIPE_ACKER], &idle);
+			continue;
+		}
+		idle = 0;
+
+		int64_t now = gbn_now_ns();
+		if (now >= timer_at) { /* Timeout, the sender goes back N */
+			printf("TIMEOUT: DATA packet (%d) lost\n", (uint8_t)base);
+			if (++attempts > MAX_ATTEMPTS) {
+				printf("ERROR: Max attempts are reached.\n");
+				failed = 1;
+				break;
+			}
+
+			if (base != loss_base) {
+				atomic_fetch_add(&pipeline->lost, 1);
+				loss_base = base;
+			}
+
+			/* All of them are resent, and an ACK may come for one before the sender
+			 * has said so. Still taken as the first transmission, it is no sample */
+			for (size_t i = base; i < sent_hi; i++) {
+				sent_at[i % 256] = -1;
+			}
+
+			/* A full ring already holds a go back */
+			item.n = base;
+			item.at = attempts;
+			item.kind = PIPE_GO_BACK;
+			atomic_store(&pipeline->going_back, 1);
+			ring_push(&pipeline->control, &item);
+			bell_ring(&pipeline->bells[PIPE_SENDER]);
+			timer_at = now + PIPE_TIMEOUT;
+			continue;
+		}
+
+		/* Until the timer runs out, new sends are looked at with the next ACK. The sender
+		 * sends at most a window in between */
+		int64_t wait = timer_at - now;
+		int result = gbn_wait_ns(sockfd, &wait);
+		if (result == -1) {
+			perror("select");
+			failed = 1;
+			break;
+		}
+		if (result == 0) {
+			continue;
+		}
+
+		struct sockaddr_storage from;
+		socklen_t from_len = sizeof(from);
+		if (gbn_recvfrom(sockfd, ACK_packet, sizeof(*ACK_packet), 0, (struct sockaddr*)&from, &from_len) == -1) {
+			perror("Can't read from socket");
+			failed = 1;
+			break;
+		}
+
+		if (ACK_packet->flags == CHALLENGE) {
+			/* The receiver saw us from a new address, the sender answers. One at a time,
+			 * the receiver asks again */
+			if (!atomic_load(&pipeline->challenge_busy)) {
+				memcpy(pipeline->challenge, ACK_packet, offsetof(rtp, data) + sizeof(syn_params));
+				atomic_store(&pipeline->challenge_busy, 1);
+				item.n = 0;
+				item.at = 0;
+				item.kind = PIPE_RESPOND;
+				if (!ring_push(&pipeline->control, &item)) {
+					atomic_store(&pipeline->challenge_busy, 0);
+				}
+				bell_ring(&pipeline->bells[PIPE_SENDER]);
+			}
+			continue;
+		}
+		if (ACK_packet->flags == PROBEACK && ACK_packet->checksum == checksum(ACK_packet)) {
+			/* The sender probes, a lost answer is a lost probe to it */
+			item.n = ACK_packet->seq;
+			item.at = ACK_packet->len;
+			item.kind = PIPE_PROBEACK;
+			ring_push(&pipeline->control, &item);
+			bell_ring(&pipeline->bells[PIPE_SENDER]);
+			continue;
+		}
+		if (ACK_packet->flags != ACK || ACK_packet->checksum != checksum(ACK_packet)) {
+			printf("Invalid ACK packet\n");
+			continue;
+		}
+
+		/* It may be for packets sent after the last look */
+		while (ring_pop(&pipeline->sent, &item)) {
+			sent_at[item.n % 256] = item.at;
+			if (item.n >= sent_hi) {
+				sent_hi = item.n + 1;
+			}
+		}
+
+		/* Cumulative ACK, seq is the next packet the receiver expects */
+		size_t acked = (uint8_t)(ACK_packet->seq - (uint8_t)base);
+		if (acked == 0 || acked > sent_hi - base) {
+			printf("Duplicate ACK (seq: %d)\n", ACK_packet->seq);
+
+			/* The receiver saw a gap, count it towards the loss rate */
+			if (base != loss_base) {
+				atomic_fetch_add(&pipeline->lost, 1);
+				loss_base = base;
+			}
+			continue;
+		}
+		printf("Valid ACK packet! (seq: %d)\n", ACK_packet->seq);
+
+		/* RTT from the newest packet acknowledged unless it was resent (Karn), less the
+		 * time the receiver held the ACK. Its slot is not reused before base moves past it */
+		int64_t sent = sent_at[(uint8_t)(ACK_packet->seq - 1)];
+		if (sent > 0) {
+			const rtp* DATA_packet = &pipeline->slots[(base + acked - 1) % PIPELINE_SLOTS];
+			int64_t rtt = gbn_now_ns() - sent;
+
+			if (ACK_packet->tstamp != 0 && DATA_packet->tstamp != 0) {
+				int64_t held = (int32_t)(ACK_packet->tstamp - DATA_packet->tstamp) * 1000LL;
+				if (held > 0 && held < rtt) {
+					rtt -= held;
+				}
+			}
+			rtt_sample(rtt);
+			atomic_store(&pipeline->srtt_ns, state.srtt_ns);
+		}
+		base += acked;
+		atomic_store(&pipeline->base, base);
+		atomic_store(&pipeline->handshake_unconfirmed, 0);
+		bell_ring(&pipeline->bells[PIPE_SENDER]);
+		bell_ring(&pipeline->bells[PIPE_SEGMENTER]);
+		attempts = 0;
+		timer_at = gbn_now_ns() + PIPE_TIMEOUT;
+	}
+
+	pipe_stop(pipeline, failed);
+	return NULL;
+}
+
+/* Stage 2, on the calling thread: send built packets that fit in the window, resend them
+ * on a go back. Returns 0, -1 if a send failed, or PIPE_RECUT after a black hole */
+static int pipe_sender(gbn_pipeline* pipeline, pmtu_t* pmtu) {
+	int sockfd = pipeline->sockfd;
+	size_t window = state.window_size < PIPELINE_SLOTS ? state.window_size : PIPELINE_SLOTS;
+	size_t built = pipeline->first;     /* Packets the segmenter has handed over */
+	size_t next = pipeline->first;      /* Next packet to send */
+	size_t sent_hi = pipeline->first;   /* Packets sent at least once */
+	uint8_t parity[PIPELINE_SLOTS];     /* The packet in the slot closes a parity group */
+	int going_back = 0;         /* Resending, the ACK thread is told once it is done */
+	int idle = 0;
+	pipe_item item;
+
+	while (!atomic_load(&pipeline->stop)) {
+		while (ring_pop(&pipeline->built, &item)) {
+			parity[item.n % PIPELINE_SLOTS] = item.at != 0;
+			built = item.n + 1;
+		}
+
+		while (ring_pop(&pipeline->control, &item)) {
+			if (item.kind == PIPE_RESPOND) {
+				path_respond(sockfd, pipeline->challenge);
+				atomic_store(&pipeline->challenge_busy, 0);
+			}
+			else if (item.kind == PIPE_PROBEACK) {
+				pipeline->PROBEACK_packet->seq = (uint8_t)item.n;
+				pipeline->PROBEACK_packet->len = (uint16_t)item.at;
+				if (pmtu_ack(pmtu, pipeline->PROBEACK_packet)) {
+					atomic_store(&pipeline->mss, state.mss);
+				}
+			}
+			else {
+				state.handshake_unconfirmed = atomic_load(&pipeline->handshake_unconfirmed);
+				resend_handshake_ack(sockfd);
+
+				/* Segments bigger than the path takes would never get through, resent as
+				 * they are built. The stages start again to cut them at the smaller size */
+				if (pmtu_blackhole(pmtu, (int)item.at)) {
+					atomic_store(&pipeline->mss, state.mss);
+					pipeline->sent_hi = sent_hi;
+					pipe_stop(pipeline, 0);
+					return PIPE_RECUT;
+				}
+				if (item.n < next) {
+					next = item.n;
+				}
+				going_back = 1;
+			}
+		}
+		pmtu_probe(sockfd, pmtu);
+
+		/* Where we read from is published before base is read, so the segmenter never
+		 * fills a slot in between. Anything acknowledged meanwhile is skipped */
+		atomic_store(&pipeline->sending, next);
+		bell_ring(&pipeline->bells[PIPE_SEGMENTER]);
+		uint64_t base = atomic_load(&pipeline->base);
+		if (next < base) {
+			next = base;
+		}
+
+		int64_t srtt = atomic_load(&pipeline->srtt_ns);
+		if (srtt != state.srtt_ns) {
+			state.srtt_ns = srtt;
+			pace_update();
+		}
+
+		if (next >= built || next >= base + window) {
+			gbn_flush(sockfd);
+			if (going_back) {
+				atomic_store(&pipeline->going_back, 0);
+				bell_ring(&pipeline->bells[PIPE_ACKER]);
+				going_back = 0;
+			}
+			pipe_idle(&pipeline->bells[PIPE_SENDER], &idle);
+			continue;
+		}
+		idle = 0;
+
+		while (next < built && next < base + window) {
+			rtp* DATA_packet = &pipeline->slots[next % PIPELINE_SLOTS];
+			int first = next >= sent_hi;
+
+			/* Told before it is sent, the ACK for it may be read before this thread is back.
+			 * The ACK thread empties the ring on every look */
+			item.n = next;
+			item.at = first ? gbn_now_ns() : -1;
+			item.kind = 0;
+			while (!ring_push(&pipeline->sent, &item)) {
+				if (atomic_load(&pipeline->stop)) {
+					return 0;
+				}
+				bell_ring(&pipeline->bells[PIPE_ACKER]);
+				pipe_idle(&pipeline->bells[PIPE_SENDER], &idle);
+			}
+			bell_ring(&pipeline->bells[PIPE_ACKER]);
+
+			if (maybe_sendto(sockfd, DATA_packet, gbn_packet_size(DATA_packet), 0, (struct sockaddr*)&state.address, state.sck_len) == -1) {
+				printf("ERROR: Unable to send DATA packet.\n");
+				return -1;
+			}
+			if (!first) {
+				printf("SUCCESS: Retransmitted DATA packet (%d)...\n", DATA_packet->seq);
+			}
+			else {
+				printf("SUCCESS: Sent DATA packet (%d)...\n", DATA_packet->seq);
+				sent_hi = next + 1;
+
+				/* Parity only follows the first transmission */
+				if (parity[next % PIPELINE_SLOTS]) {
+					rtp* PARITY_packet = &pipeline->parity[next % PIPELINE_SLOTS];
+
+					if (maybe_sendto(sockfd, PARITY_packet, gbn_packet_size(PARITY_packet), 0, (struct sockaddr*)&state.address, state.sck_len) == -1) {
+						printf("ERROR: Unable to send PARITY packet.\n");
+						return -1;
+					}
+					printf("SUCCESS: Sent PARITY packet (%d, k: %d)...\n", PARITY_packet->seq, PARITY_packet->options);
+				}
+			}
+			next++;
+		}
+	}
+	return 0;
+}
+
+/* After a black hole, with the stages stopped: start them again from the packet the
+ * receiver expects, it may have more than the ACKs that came back said. The slots from
+ * there on are thrown away and cut again at the smaller size. Returns -1 if the receiver
+ * does not answer */
+static int pipe_recut(gbn_pipeline* pipeline) {
+	ssize_t expected = gbn_resync(pipeline->sockfd, pipeline->ACK_packet, pipeline->base, pipeline->sent_hi);
+	if (expected < 0) {
+		return -1;
+	}
+
+	/* Still in its slot, the segmenter never got a window past base */
+	pipeline->first_offset = (uint64_t)expected < pipeline->total ? pipeline->offsets[expected % PIPELINE_SLOTS] : pipeline->end_offset;
+	pipeline->first = expected;
+	pipeline->base = expected;
+	pipeline->sending = expected;
+	pipeline->total = UINT64_MAX;
+	pipeline->going_back = 0;
+	pipeline->challenge_busy = 0;
+	pipeline->stop = 0;
+
+	pipe_ring* rings[] = { &pipeline->built, &pipeline->sent, &pipeline->control };
+	for (int i = 0; i < 3; i++) {
+		rings[i]->head = 0;
+		rings[i]->tail = 0;
+	}
+	return 0;
+}
+
+/* sender_gbn for len bytes of buf over three threads, see the top of the file.
+ * Returns the number of packets, or -1 if the connection was given up */
+ssize_t sender_pipelined(int sockfd, const void* buf, size_t len) {
+	gbn_arena* arena = arena_thread();
+	arena_mark mark = arena_get_mark(arena);
+	pthread_t segmenter;
+	pthread_t acker;
+
+	/* The rings and slots live in the calling thread's arena, released on return */
+	gbn_pipeline* pipeline = arena_alloc(arena, sizeof(*pipeline));
+	memset(pipeline, 0, sizeof(*pipeline));
+	pipeline->sockfd = sockfd;
+	pipeline->buf = buf;
+	pipeline->len = len;
+	pipeline->total = UINT64_MAX;
+	pipeline->mss = state.mss;
+	pipeline->conn = state;
+	pipeline->slots = arena_alloc(arena, PIPELINE_SLOTS * sizeof(*pipeline->slots));
+	pipeline->offsets = arena_alloc(arena, PIPELINE_SLOTS * sizeof(*pipeline->offsets));
+	pipeline->ACK_packet = arena_alloc(arena, sizeof(*pipeline->ACK_packet));
+	pipeline->challenge = arena_alloc(arena, sizeof(*pipeline->challenge));
+	pipeline->PROBEACK_packet = arena_alloc(arena, sizeof(*pipeline->PROBEACK_packet));
+	if (state.fec_k > 0) {
+		pipeline->parity = arena_alloc(arena, PIPELINE_SLOTS * sizeof(*pipeline->parity));
+	}
+	pipeline->srtt_ns = state.srtt_ns;
+	pipeline->handshake_unconfirmed = state.handshake_unconfirmed;
+	for (int stage = 0; stage < 3; stage++) {
+		bell_open(&pipeline->bells[stage]);
+	}
+
+#if defined(__linux__)
+	/* Pinning the sender stage is undone on return */
+	cpu_set_t caller_cpus;
+	int pinned = PIPELINE_CPU >= 0 && pthread_getaffinity_np(pthread_self(), sizeof(caller_cpus), &caller_cpus) == 0;
+#endif
+
+	gbn_pace_init(sockfd);
+	pace_update();
+
+	/* Bigger segments, if the path takes them. Striped flows share fixed segments */
+	pmtu_t pmtu;
+	pmtu_init(&pmtu, sockfd, state.stripe_count == 0);
+	printf("Pipelined sending of %zu bytes\n", len);
+
+	state.state = ESTABLISHED;
+	pipe_pin(PIPE_SENDER);
+	for (;;) {
+		if (pthread_create(&segmenter, NULL, pipe_segmenter, pipeline) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+		if (pthread_create(&acker, NULL, pipe_acker, pipeline) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+
+		int sent = pipe_sender(pipeline, &pmtu);
+		if (sent == -1) {
+			pipe_stop(pipeline, 1); /* An ACK thread waiting for the socket sees it when the wait ends */
+		}
+		pthread_join(acker, NULL);
+		pthread_join(segmenter, NULL);
+
+		if (sent != PIPE_RECUT || pipeline->failed) {
+			break;
+		}
+		if (pipe_recut(pipeline) == -1) {
+			pipeline->failed = 1;
+			break;
+		}
+	}
+	pmtu_free(&pmtu);
+
+#if defined(__linux__)
+	if (pinned) {
+		pthread_setaffinity_np(pthread_self(), sizeof(caller_cpus), &caller_cpus);
+	}
+#endif
+
+	/* What the other stages learned about the connection */
+	state.srtt_ns = pipeline->srtt_ns;
+	state.handshake_unconfirmed = pipeline->handshake_unconfirmed;
+	state.bytes_raw = pipeline->bytes_raw;
+	state.bytes_wire = pipeline->bytes_wire;
+
+	for (int stage = 0; stage < 3; stage++) {
+		bell_close(&pipeline->bells[stage]);
+	}
+
+	ssize_t result = pipeline->failed ? -1 : (ssize_t)pipeline->total;
+	if (result == -1) {
+		s_state = CLOSED;
+	}
+	arena_release(arena, mark);
+	return result;
+}
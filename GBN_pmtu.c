@@ -0,0 +1,162 @@
+/* File: GBN_pmtu.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Path MTU discovery for the sender, done with the data transfer's own packets
+ *              (packetization layer PMTUD). The segment size starts at what both ends know
+ *              gets through and a PROBE padded to a bigger segment is sent with DF set. The
+ *              receiver answers each one it gets with a PROBEACK, and the segment size is
+ *              raised to the largest answered probe. The first probe tries the largest
+ *              segment agreed in the handshake, after a size is given up the rest of the
+ *              range is halved. Timeouts in a row lower the segment size again, the path
+ *              may have changed under the connection.
+ */
+
+#include "GBN.h"
+
+
+#define PROBE_MIN_TIMEOUT (10 * 1000000LL)     /* A probe is lost after 3 RTTs, but not before this (ns) */
+#define PROBE_TIMEOUT (1000 * 1000000LL)       /* Before there is an RTT sample (ns) */
+
+
+/* Search between the segment size in use and the largest agreed one. Without probing
+ * the segment size never changes, not even on loss. With it everything sockfd sends has
+ * the don't-fragment bit set until pmtu_free, what gets through is what the path takes */
+void pmtu_init(pmtu_t* pmtu, int sockfd, int probing) {
+	memset(pmtu, 0, sizeof(*pmtu));
+	pmtu->lo = state.mss;
+	pmtu->hi = state.mss_max;
+	pmtu->sockfd = sockfd;
+	pmtu->df_mode = -1;
+
+	/* In the thread's arena, with the rest of the transfer's buffers */
+	if (probing) {
+		pmtu->probe = arena_alloc(arena_thread(), sizeof(*pmtu->probe));
+		memset(pmtu->probe, 0, sizeof(*pmtu->probe));
+		pmtu->df_mode = gbn_df_set(sockfd, (struct sockaddr*)&state.address);
+	}
+}
+
+void pmtu_free(pmtu_t* pmtu) {
+	if (pmtu->probe != NULL) {
+		gbn_df_restore(pmtu->sockfd, (struct sockaddr*)&state.address, pmtu->df_mode);
+	}
+	memset(pmtu, 0, sizeof(*pmtu));
+}
+
+static int64_t probe_timeout(void) {
+	if (state.srtt_ns == 0) {
+		return PROBE_TIMEOUT;
+	}
+	return 3 * state.srtt_ns > PROBE_MIN_TIMEOUT ? 3 * state.srtt_ns : PROBE_MIN_TIMEOUT;
+}
+
+/* Send the next probe if none is in flight and the search is not done.
+ * Returns 1 if a probe was sent */
+int pmtu_probe(int sockfd, pmtu_t* pmtu) {
+	int64_t now = gbn_now_ns();
+	int size;
+
+	if (pmtu->probe == NULL) {
+		return 0;
+	}
+
+	if (pmtu->size > 0) {
+		if (now - pmtu->sent_at < probe_timeout()) {
+			return 0;
+		}
+
+		/* Lost, maybe only by chance, so a size is tried PMTU_PROBES times */
+		if (++pmtu->tries >= PMTU_PROBES) {
+			printf("PMTU: no answer to %d byte segments\n", pmtu->size);
+			pmtu->hi = pmtu->size - 1;
+			pmtu->failed = 1;
+			pmtu->tries = 0;
+		}
+	}
+
+	if (pmtu->hi - pmtu->lo < PMTU_STEP) {
+		pmtu->size = 0;
+		return 0;
+	}
+
+	if (pmtu->tries > 0) {
+		size = pmtu->size;
+	}
+	else {
+		size = pmtu->failed ? (pmtu->lo + pmtu->hi + 1) / 2 : pmtu->hi;
+	}
+
+	rtp* PROBE_packet = pmtu->probe;
+	PROBE_packet->flags = PROBE;
+	PROBE_packet->seq = ++pmtu->seq;
+	PROBE_packet->options = 0;
+	PROBE_packet->stream = 0;
+	PROBE_packet->len = size;
+	PROBE_packet->tstamp = 0;
+	PROBE_packet->conn_id = state.conn_id;
+	PROBE_packet->checksum = checksum(PROBE_packet);
+
+	pmtu->size = size;
+	pmtu->sent_at = now;
+
+	if (gbn_sendto_df(sockfd, PROBE_packet, gbn_packet_size(PROBE_packet), (struct sockaddr*)&state.address, state.sck_len) < 0) {
+		if (errno != EMSGSIZE) {
+			perror("Could not send PMTU probe");
+			return 0;
+		}
+
+		/* Bigger than the kernel knows the path to take, no need to wait for it */
+		pmtu->hi = size - 1;
+		pmtu->failed = 1;
+		pmtu->tries = 0;
+		pmtu->size = 0;
+		return 0;
+	}
+	printf("PMTU: probing %d byte segments\n", size);
+	return 1;
+}
+
+/* A PROBEACK came back. Returns 1 if state.mss was raised */
+int pmtu_ack(pmtu_t* pmtu, const rtp* PROBEACK_packet) {
+	if (pmtu->size == 0 || PROBEACK_packet->seq != pmtu->seq || PROBEACK_packet->len != pmtu->size) {
+		return 0;
+	}
+
+	pmtu->lo = pmtu->size;
+	pmtu->size = 0;
+	pmtu->tries = 0;
+	state.mss = pmtu->lo;
+	printf("PMTU: segment size raised to %d\n", state.mss);
+	return 1;
+}
+
+/* Retransmission timeouts in a row. Enough of them while segments bigger than BASE_MSS
+ * are in use and the path may have shrunk, so fall back and search again from there.
+ * Returns 1 if state.mss was lowered */
+int pmtu_blackhole(pmtu_t* pmtu, int timeouts) {
+	int base = state.mss_max < BASE_MSS ? state.mss_max : BASE_MSS;
+
+	if (timeouts < PMTU_BLACKHOLE || state.mss <= base || pmtu->probe == NULL) {
+		return 0;
+	}
+
+	printf("PMTU: %d timeouts with %d byte segments, back to %d\n", timeouts, state.mss, base);
+	pmtu->hi = state.mss;
+	pmtu->lo = base;
+	pmtu->failed = 0;
+	pmtu->tries = 0;
+	pmtu->size = 0;
+	state.mss = base;
+	return 1;
+}
+
+/* Receiver: answer a PROBE in place with the size it arrived with. The answer is small,
+ * it is the path towards the receiver that is measured */
+void pmtu_answer(int sockfd, rtp* PROBE_packet, const struct sockaddr* peer, socklen_t peer_len) {
+	PROBE_packet->flags = PROBEACK;
+	PROBE_packet->tstamp = 0;
+	PROBE_packet->checksum = checksum(PROBE_packet);
+
+	if (maybe_sendto(sockfd, PROBE_packet, gbn_packet_size(PROBE_packet), 0, peer, peer_len) == -1) {
+		perror("maybe_sendto");
+	}
+}
@@ -0,0 +1,403 @@
+/* File: GBN_queue.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Asynchronous sending. gbn_write_async puts a buffer in the connection's send
+ *              queue and returns at once, a sender thread cuts queued writes into segments
+ *              whenever the window has room. The window stays full for as long as the
+ *              application keeps writing, instead of draining at the end of every
+ *              sender_gbn call. A write is done when its last byte is acknowledged, which is
+ *              reported to a callback and counted on an eventfd the application can poll.
+ *              The buffer of a write must stay untouched until then.
+ */
+
+#include "GBN.h"
+#include <fcntl.h>
+
+#if defined(__linux__)
+#define HAVE_EVENTFD 1
+#include <sys/eventfd.h>
+#endif
+
+
+#define QUEUE_TIMEOUT (5 * 1000000000LL)    /* Retransmission timeout (ns) */
+
+
+/* One gbn_write_async call */
+typedef struct queue_write_t {
+    const uint8_t* buf;
+    size_t len;
+    uint64_t offset;            /* Where it starts in the byte stream */
+} queue_write;
+
+struct gbn_queue_t {
+    int sockfd;
+    state_t conn;               /* Connection state, handed to the sender thread and back */
+    gbn_queue_done done;
+    void* arg;
+    int notify[2];              /* eventfd in both, or a pipe */
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* A write was queued or the queue is closing */
+    queue_write* writes;        /* Ring of QUEUE_WRITES */
+    size_t head;                /* Oldest write not done */
+    size_t tail;                /* Next write to be queued */
+    uint64_t queued;            /* Bytes queued so far */
+    int closing;
+    int failed;                 /* The connection was given up */
+
+    /* Segments in flight by packet number % 256, which write and where in it */
+    size_t seg_write[256];
+    size_t seg_offset[256];
+    uint16_t seg_size[256];
+    int64_t sent_at[256];       /* -1 once retransmitted */
+};
+
+
+/* Count done writes on the descriptor the application polls */
+static void queue_notify(gbn_queue* queue, uint64_t n) {
+#ifdef HAVE_EVENTFD
+	if (write(queue->notify[1], &n, sizeof(n)) != sizeof(n)) {
+		perror("eventfd");
+	}
+#else
+	uint8_t byte = 1;
+	for (; n > 0; n--) {
+		if (write(queue->notify[1], &byte, 1) != 1) { /* Full, it is readable anyway */
+			break;
+		}
+	}
+#endif
+}
+
+/* Writes before write number upto are acknowledged, hand them back */
+static void queue_complete(gbn_queue* queue, size_t upto) {
+	size_t n = 0;
+
+	for (size_t i = queue->head; i < upto; i++) {
+		const queue_write* w = &queue->writes[i % QUEUE_WRITES];
+
+		if (queue->done != NULL) {
+			queue->done(queue->arg, w->buf, w->offset, w->len);
+		}
+		n++;
+	}
+	if (n == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	queue->head = upto;
+	pthread_mutex_unlock(&queue->lock);
+	queue_notify(queue, n);
+}
+
+static int queue_send(gbn_queue* queue, rtp* DATA_packet, size_t n) {
+	const queue_write* w = &queue->writes[queue->seg_write[n % 256] % QUEUE_WRITES];
+
+	DATA_packet->flags = DATA;
+	DATA_packet->stream = 0;
+	DATA_packet->seq = (uint8_t)n;
+	data_packet_fill(DATA_packet, w->buf + queue->seg_offset[n % 256], queue->seg_size[n % 256]);
+
+	if (maybe_sendto(queue->sockfd, DATA_packet, gbn_packet_size(DATA_packet), 0, (struct sockaddr*)&state.address, state.sck_len) == -1) {
+		printf("ERROR: Unable to send DATA packet.\n");
+		return -1;
+	}
+	printf("SUCCESS: Sent DATA packet (%d)...\n", DATA_packet->seq);
+	return 0;
+}
+
+/* The sender thread, sender_gbn over a byte stream that grows while it runs */
+static void* queue_sender(void* arg) {
+	gbn_queue* queue = arg;
+	int sockfd = queue->sockfd;
+	int attempts = 0;
+	int failed = 0;
+
+	state = queue->conn;
+
+	/* The sender thread's own arena, on the node it runs on */
+	rtp* DATA_packet = arena_alloc(arena_thread(), sizeof(*DATA_packet));
+	rtp* ACK_packet = arena_alloc(arena_thread(), sizeof(*ACK_packet));
+
+	size_t base = 0;            /* Oldest unacknowledged packet */
+	size_t next_seq_num = 0;    /* Next packet to be sent */
+	size_t cut_write = 0;       /* The next segment comes from this write */
+	size_t cut_offset = 0;      /* at this offset */
+	int64_t timer_at = 0;
+
+	gbn_pace_init(sockfd);
+	if (state.options & OPT_TSTAMP) {
+		gbn_timestamps_init(sockfd);
+	}
+
+	for (;;) {
+		/* Nothing in flight, sleep until there is something to send or the connection has
+		 * been idle for KEEPALIVE_IDLE seconds */
+		struct timespec idle_until;
+		int idle = 0;
+
+		clock_gettime(CLOCK_REALTIME, &idle_until);
+		idle_until.tv_sec += KEEPALIVE_IDLE;
+
+		pthread_mutex_lock(&queue->lock);
+		while (base == next_seq_num && cut_write == queue->tail && !queue->closing && !idle) {
+			idle = pthread_cond_timedwait(&queue->cond, &queue->lock, &idle_until) == ETIMEDOUT;
+		}
+		size_t tail = queue->tail;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (base == next_seq_num && cut_write == tail) {
+			if (!idle) { /* Closing and all acknowledged */
+				break;
+			}
+
+			/* Hold the NAT binding, a peer that does not answer is given up */
+			if (gbn_keepalive(sockfd) == -1) {
+				failed = 1;
+				break;
+			}
+			continue;
+		}
+
+		/* Cut segments from the queued writes while the window has room */
+		while (next_seq_num < base + state.window_size && cut_write < tail) {
+			const queue_write* w = &queue->writes[cut_write % QUEUE_WRITES];
+			size_t left = w->len - cut_offset;
+			int slot = next_seq_num % 256;
+
+			queue->seg_write[slot] = cut_write;
+			queue->seg_offset[slot] = cut_offset;
+			queue->seg_size[slot] = left < (size_t)state.mss ? left : (size_t)state.mss;
+
+			cut_offset += queue->seg_size[slot];
+			if (cut_offset == w->len) {
+				cut_write++;
+				cut_offset = 0;
+			}
+
+			if (queue_send(queue, DATA_packet, next_seq_num) == -1) {
+				failed = 1;
+				break;
+			}
+			queue->sent_at[slot] = gbn_now_ns();
+			if (base == next_seq_num) {
+				timer_at = queue->sent_at[slot] + QUEUE_TIMEOUT;
+			}
+			next_seq_num++;
+		}
+		if (failed) {
+			break;
+		}
+
+		/* Wait for ACKs, but look for new writes now and then while there is room for them */
+		int64_t now = gbn_now_ns();
+		int64_t wait = timer_at > now ? timer_at - now : 0;
+		if (next_seq_num < base + state.window_size && wait > QUEUE_POLL * 1000LL) {
+			wait = QUEUE_POLL * 1000LL;
+		}
+
+		int result = gbn_wait_ns(sockfd, &wait);
+		if (result == -1) {
+			perror("select");
+			failed = 1;
+			break;
+		}
+
+		if (result == 0) {
+			if (gbn_now_ns() < timer_at) {
+				continue;
+			}
+
+			/* Timeout, go back N */
+			printf("TIMEOUT: DATA packet (%d) lost\n", (uint8_t)base);
+			if (++attempts > MAX_ATTEMPTS) {
+				printf("ERROR: Max attempts are reached.\n");
+				failed = 1;
+				break;
+			}
+			resend_handshake_ack(sockfd);
+
+			for (size_t i = base; i < next_seq_num; i++) {
+				if (queue_send(queue, DATA_packet, i) == -1) {
+					failed = 1;
+					break;
+				}
+				queue->sent_at[i % 256] = -1;
+			}
+			if (failed) {
+				break;
+			}
+			timer_at = gbn_now_ns() + QUEUE_TIMEOUT;
+			continue;
+		}
+
+		struct sockaddr_storage from;
+		socklen_t from_len = sizeof(from);
+		if (gbn_recvfrom(sockfd, ACK_packet, sizeof(*ACK_packet), 0, (struct sockaddr*)&from, &from_len) == -1) {
+			perror("Can't read from socket");
+			failed = 1;
+			break;
+		}
+
+		if (path_respond(sockfd, ACK_packet)) { /* The receiver saw us from a new address */
+			continue;
+		}
+		if (ACK_packet->flags != ACK || ACK_packet->checksum != checksum(ACK_packet)) {
+			printf("Invalid ACK packet\n");
+			continue;
+		}
+		echo_rtt_sample(ACK_packet);
+
+		/* Cumulative ACK, seq is the next packet the receiver expects */
+		size_t acked = (uint8_t)(ACK_packet->seq - (uint8_t)base);
+		if (acked == 0 || acked > next_seq_num - base) {
+			printf("Duplicate ACK (seq: %d)\n", ACK_packet->seq);
+			continue;
+		}
+		printf("Valid ACK packet! (seq: %d)\n", ACK_packet->seq);
+
+		int64_t sent = queue->sent_at[(uint8_t)(ACK_packet->seq - 1)];
+		if (!(state.options & OPT_TSTAMP) && sent > 0) {
+			rtt_sample(gbn_now_ns() - sent);
+		}
+		base += acked;
+		attempts = 0;
+		state.handshake_unconfirmed = 0;
+		timer_at = gbn_now_ns() + QUEUE_TIMEOUT;
+
+		/* Writes up to the one the last acknowledged segment is from are done, that one too if it was its end */
+		int last = (base - 1) % 256;
+		const queue_write* w = &queue->writes[queue->seg_write[last] % QUEUE_WRITES];
+		int ended = queue->seg_offset[last] + queue->seg_size[last] == w->len;
+		queue_complete(queue, queue->seg_write[last] + ended);
+	}
+
+	/* Later writes fail at once, the ones not done are never reported */
+	pthread_mutex_lock(&queue->lock);
+	queue->failed = failed;
+	pthread_mutex_unlock(&queue->lock);
+
+	queue->conn = state;
+	arena_destroy(arena_thread());
+	return NULL;
+}
+
+
+/* Take over an established connection (after sender_connection) for asynchronous sending,
+ * until gbn_queue_close. done may be NULL. Returns NULL if the sender thread can't start */
+gbn_queue* gbn_queue_open(int sockfd, gbn_queue_done done, void* arg) {
+	gbn_queue* queue = calloc(1, sizeof(*queue));
+	if (queue == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	queue->writes = malloc(QUEUE_WRITES * sizeof(*queue->writes));
+	if (queue->writes == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	queue->sockfd = sockfd;
+	queue->conn = state;
+	queue->done = done;
+	queue->arg = arg;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+
+#ifdef HAVE_EVENTFD
+	queue->notify[0] = queue->notify[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (queue->notify[0] < 0) {
+		perror("eventfd");
+		goto fail;
+	}
+#else
+	if (pipe(queue->notify) < 0) {
+		perror("pipe");
+		goto fail;
+	}
+	fcntl(queue->notify[0], F_SETFL, O_NONBLOCK);
+	fcntl(queue->notify[1], F_SETFL, O_NONBLOCK);
+#endif
+
+	if (pthread_create(&queue->thread, NULL, queue_sender, queue) != 0) {
+		perror("pthread_create");
+		close(queue->notify[0]);
+		if (queue->notify[1] != queue->notify[0]) {
+			close(queue->notify[1]);
+		}
+		goto fail;
+	}
+	return queue;
+
+fail:
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->cond);
+	free(queue->writes);
+	free(queue);
+	return NULL;
+}
+
+/* Queue len bytes of buf and return at once. Returns where they start in the byte stream,
+ * or -1 with errno EAGAIN if the queue is full, EPIPE if the connection was given up */
+int64_t gbn_write_async(gbn_queue* queue, const void* buf, size_t len) {
+	int64_t offset;
+
+	if (len == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->failed || queue->closing) {
+		pthread_mutex_unlock(&queue->lock);
+		errno = EPIPE;
+		return -1;
+	}
+	if (queue->tail - queue->head >= QUEUE_WRITES) {
+		pthread_mutex_unlock(&queue->lock);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	queue_write* w = &queue->writes[queue->tail % QUEUE_WRITES];
+	w->buf = buf;
+	w->len = len;
+	w->offset = queue->queued;
+	offset = (int64_t)queue->queued;
+
+	queue->queued += len;
+	queue->tail++;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+	return offset;
+}
+
+/* Readable when writes are done. On Linux an eventfd, reading it gives how many since the
+ * last read, otherwise a pipe with a byte per write */
+int gbn_queue_fd(const gbn_queue* queue) {
+	return queue->notify[0];
+}
+
+/* Wait until every queued write is acknowledged, then hand the connection back to the
+ * calling thread for sender_teardown. Returns 0, or -1 if the connection was given up */
+int gbn_queue_close(gbn_queue* queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->closing = 1;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	pthread_join(queue->thread, NULL);
+	state = queue->conn;
+
+	int result = queue->failed ? -1 : 0;
+	close(queue->notify[0]);
+	if (queue->notify[1] != queue->notify[0]) {
+		close(queue->notify[1]);
+	}
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->cond);
+	free(queue->writes);
+	free(queue);
+	return result;
+}
@@ -0,0 +1,717 @@
+/* File: GBN_server.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Server mode, many receiving connections on one port. One worker thread per
+ *              core, each with its own SO_REUSEPORT socket, connection table, packet pool and
+ *              timer wheel, so workers share nothing while packets flow. The kernel hashes a
+ *              peer's address to the same socket every time, so a connection always lands on
+ *              the worker that owns it. The owning worker is also in the connection id, and
+ *              where the kernel takes a BPF program for the port, packets with an id are steered
+ *              by it instead. A peer whose NAT picked a new port then still reaches its worker,
+ *              which finds the connection by id and validates the new address (GBN_path.c).
+ *
+ *              Handshakes are stateless (GBN_cookie.c), a table entry is only made for an ACK
+ *              with a valid cookie. FEC is not offered, every other option is.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* recvmmsg, pthread_setaffinity_np */
+#endif
+#include "GBN.h"
+
+#if defined(__linux__)
+#define HAVE_RECVMMSG 1
+#include <sched.h>
+#include <linux/filter.h>
+#endif
+
+
+#define SERVER_OPTIONS (LOCAL_OPTIONS & ~OPT_FEC)  /* Options a server connection accepts */
+#define SERVER_BUCKETS (2 * SERVER_MAX_CONNS)       /* Connection table size, power of two */
+#define WHEEL_SLOTS 256                             /* Timer wheel slots, power of two */
+#define WHEEL_TICK (5 * 1000000LL)                  /* Time per slot (ns) */
+#define FINACK_TIMEOUT (5 * 1000000000LL)           /* Resend of an unanswered FINACK (ns) */
+
+
+/* One worker, allocated on its own so workers never share a cache line */
+typedef struct server_worker_t {
+	gbn_server* server;
+	int index;
+	int sockfd;
+	pthread_t thread;
+
+	/* Connection table, chained by peer address and by id, entries come from a fixed pool */
+	gbn_conn* conns;
+	gbn_conn* free_list;
+	gbn_conn* buckets[SERVER_BUCKETS];
+	gbn_conn* id_buckets[SERVER_BUCKETS];
+	size_t open;
+
+	/* Timer wheel, a connection is in the slot of its next deadline */
+	gbn_conn* wheel[WHEEL_SLOTS];
+	int64_t wheel_tick;     /* Next tick to process */
+
+	/* Packet pool, filled by one recvmmsg */
+	rtp* pool;
+	struct sockaddr_storage* addrs;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr* msgs;
+	struct iovec* iovs;
+#endif
+	rtp reply;
+
+	/* Where the tables and pools above live, mapped by the worker on its own NUMA node */
+	gbn_arena arena;
+} __attribute__((aligned(64))) server_worker;
+
+struct gbn_server_t {
+	gbn_server_config config;
+	int nworkers;
+	volatile int stop;
+	server_worker** workers;
+};
+
+
+static uint32_t peer_hash(const struct sockaddr* peer) {
+	const uint8_t* p;
+	size_t n;
+	uint32_t hash = 2166136261U;    /* FNV-1a */
+
+	if (peer->sa_family == AF_INET6) {
+		const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)peer;
+		hash = (hash ^ in6->sin6_port) * 16777619U;
+		p = (const uint8_t*)&in6->sin6_addr;
+		n = sizeof(in6->sin6_addr);
+	}
+	else {
+		const struct sockaddr_in* in4 = (const struct sockaddr_in*)peer;
+		hash = (hash ^ in4->sin_port) * 16777619U;
+		p = (const uint8_t*)&in4->sin_addr;
+		n = sizeof(in4->sin_addr);
+	}
+	for (size_t i = 0; i < n; i++) {
+		hash = (hash ^ p[i]) * 16777619U;
+	}
+	return hash;
+}
+
+/* Timer wheel */
+
+static void timer_unlink(server_worker* w, gbn_conn* conn) {
+	if (conn->timer_prev != NULL) {
+		conn->timer_prev->timer_next = conn->timer_next;
+	}
+	else if (w->wheel[conn->timer_slot] == conn) {
+		w->wheel[conn->timer_slot] = conn->timer_next;
+	}
+	if (conn->timer_next != NULL) {
+		conn->timer_next->timer_prev = conn->timer_prev;
+	}
+	conn->timer_next = NULL;
+	conn->timer_prev = NULL;
+}
+
+/* Move the connection's timer to at, deadlines in the past fire on the next tick */
+static void timer_set(server_worker* w, gbn_conn* conn, int64_t at) {
+	int64_t tick = at / WHEEL_TICK;
+
+	timer_unlink(w, conn);
+	if (tick < w->wheel_tick) {
+		tick = w->wheel_tick;
+	}
+	conn->timer_at = at;
+	conn->timer_slot = tick & (WHEEL_SLOTS - 1);
+	conn->timer_next = w->wheel[conn->timer_slot];
+	if (conn->timer_next != NULL) {
+		conn->timer_next->timer_prev = conn;
+	}
+	w->wheel[conn->timer_slot] = conn;
+}
+
+/* Next deadline of a connection: a FINACK to resend, a held ACK, or being idle too long */
+static void timer_update(server_worker* w, gbn_conn* conn) {
+	if (conn->state == RCVD_FIN) {
+		timer_set(w, conn, conn->fin_at);
+	}
+	else if (conn->pending > 0) {
+		timer_set(w, conn, conn->ack_at);
+	}
+	else {
+		timer_set(w, conn, conn->last_seen + SERVER_IDLE * 1000000000LL);
+	}
+}
+
+
+/* Connection table */
+
+static gbn_conn* conn_find(server_worker* w, const struct sockaddr* peer) {
+	gbn_conn* conn = w->buckets[peer_hash(peer) & (SERVER_BUCKETS - 1)];
+
+	while (conn != NULL && !path_same((struct sockaddr*)&conn->peer, peer)) {
+		conn = conn->hash_next;
+	}
+	return conn;
+}
+
+static gbn_conn* conn_find_id(server_worker* w, uint32_t id) {
+	gbn_conn* conn = w->id_buckets[id & (SERVER_BUCKETS - 1)];
+
+	while (conn != NULL && conn->id != id) {
+		conn = conn->id_next;
+	}
+	return conn;
+}
+
+/* An id for a new connection of this worker, none of its open ones has it */
+static uint32_t conn_new_id(server_worker* w) {
+	uint32_t id;
+
+	do {
+		id = path_conn_id(w->index);
+	} while (conn_find_id(w, id) != NULL);
+	return id;
+}
+
+/* Chain the connection by its address */
+static void conn_hash(server_worker* w, gbn_conn* conn) {
+	uint32_t bucket = peer_hash((struct sockaddr*)&conn->peer) & (SERVER_BUCKETS - 1);
+
+	conn->hash_next = w->buckets[bucket];
+	w->buckets[bucket] = conn;
+}
+
+/* Take the connection out of the chain of its address */
+static void conn_unhash(server_worker* w, gbn_conn* conn) {
+	gbn_conn** link = &w->buckets[peer_hash((struct sockaddr*)&conn->peer) & (SERVER_BUCKETS - 1)];
+
+	while (*link != conn) {
+		link = &(*link)->hash_next;
+	}
+	*link = conn->hash_next;
+}
+
+/* A handshake ACK was accepted (state holds what was agreed), make the table entry */
+static gbn_conn* conn_open(server_worker* w, const rtp* ACK_packet, const struct sockaddr* peer, socklen_t peer_len) {
+	gbn_conn* conn = w->free_list;
+
+	if (conn == NULL) {
+		printf("Worker %d: connection table full\n", w->index);
+		return NULL;
+	}
+	w->free_list = conn->hash_next;
+
+	const syn_params* agreed = (const syn_params*)ACK_packet->data;
+	memset(conn, 0, sizeof(*conn));
+	conn->id = agreed->conn_id;
+	memcpy(&conn->peer, peer, peer_len);
+	conn->peer_len = peer_len;
+	conn->options = state.options;
+	conn->window_size = ACK_packet->windowsize;
+	conn->state = ESTABLISHED;
+	conn->last_seen = gbn_now_ns();
+
+	conn_hash(w, conn);
+
+	/* Two handshakes in flight may have drawn the same id, the later one can't move */
+	if (conn_find_id(w, conn->id) == NULL) {
+		uint32_t bucket = conn->id & (SERVER_BUCKETS - 1);
+		conn->id_next = w->id_buckets[bucket];
+		w->id_buckets[bucket] = conn;
+	}
+	w->open++;
+	timer_update(w, conn);
+
+	printf("Worker %d: connection %08x open (options: 0x%02x)\n", w->index, conn->id, conn->options);
+	return conn;
+}
+
+static void conn_close(server_worker* w, gbn_conn* conn, const char* reason) {
+	printf("Worker %d: connection %08x closed, %s (%zu bytes)\n", w->index, conn->id, reason, conn->received);
+	if (w->server->config.on_close != NULL) {
+		w->server->config.on_close(conn);
+	}
+
+	conn_unhash(w, conn);
+	timer_unlink(w, conn);
+
+	/* Not in the id table if another connection had the id first */
+	gbn_conn** link = &w->id_buckets[conn->id & (SERVER_BUCKETS - 1)];
+	while (*link != NULL && *link != conn) {
+		link = &(*link)->id_next;
+	}
+	if (*link == conn) {
+		*link = conn->id_next;
+	}
+
+	conn->state = CLOSED;
+	conn->hash_next = w->free_list;
+	w->free_list = conn;
+	w->open--;
+}
+
+
+/* Replies, checksummed with the connection's options */
+static void conn_reply(server_worker* w, gbn_conn* conn, int flags, uint8_t seq) {
+	rtp* packet = &w->reply;
+
+	packet->flags = flags;
+	packet->seq = seq;
+	packet->options = 0;
+	packet->stream = 0;
+	packet->len = 0;
+	packet->tstamp = flags == ACK ? ack_tstamp(conn->options, conn->ts_recent, conn->ts_arrival) : 0;
+	packet->conn_id = conn->id;
+	state.options = conn->options;
+	packet->checksum = checksum(packet);
+
+	if (maybe_sendto(w->sockfd, packet, gbn_packet_size(packet), 0, (struct sockaddr*)&conn->peer, conn->peer_len) == -1) {
+		perror("maybe_sendto");
+	}
+}
+
+static void conn_ack(server_worker* w, gbn_conn* conn) {
+	conn_reply(w, conn, ACK, conn->expSeq);
+	conn->pending = 0;
+	conn->ack_at = 0;
+}
+
+
+/* One packet from a peer without a connection, only the handshake is answered */
+static void server_handshake(server_worker* w, rtp* packet, const struct sockaddr* peer, socklen_t peer_len) {
+	state.options = 0;
+
+	if (packet->flags == SYN && packet->checksum == checksum(packet)) {
+		/* Server connections are not resumable */
+		syn_params* offer = (syn_params*)packet->data;
+		offer->transfer_id = 0;
+
+		make_synack(packet, peer, SERVER_OPTIONS, conn_new_id(w));
+		if (gbn_sendto(w->sockfd, packet, gbn_packet_size(packet), 0, peer, peer_len) < 0) {
+			perror("Can't send SYNACK packet");
+		}
+	}
+	else if (packet->flags == ACK && accept_ack(packet, peer)) {
+		conn_open(w, packet, peer, peer_len);
+	}
+}
+
+/* One packet of an open connection, the same steps as receiver_gbn and receiver_teardown */
+static void server_packet(server_worker* w, gbn_conn* conn, rtp* packet) {
+	const uint8_t* payload;
+	uint8_t unpacked[MAXMSG];
+	int64_t now = gbn_now_ns();
+
+	state.options = conn->options;
+	state.conn_id = conn->id;
+	if (packet->checksum != checksum(packet)) {
+		/* A SYN is checked with the handshake checksum, the peer may have restarted */
+		state.options = 0;
+		if (packet->flags == SYN && packet->checksum == checksum(packet)) {
+			conn_close(w, conn, "peer reconnecting");
+			server_handshake(w, packet, (struct sockaddr*)&conn->peer, conn->peer_len);
+		}
+		return;
+	}
+	conn->last_seen = now;
+
+	switch (packet->flags) {
+	case DATA:
+		if (conn->state != ESTABLISHED) {
+			break;
+		}
+		if (packet->tstamp != 0) { /* Arrival is when the batch was received */
+			conn->ts_recent = packet->tstamp;
+			conn->ts_arrival = now;
+		}
+		if (packet->seq == conn->expSeq) {
+			ssize_t size = data_payload(packet, &payload, unpacked);
+			if (size < 0) {
+				break;
+			}
+			if (w->server->config.on_data != NULL) {
+				w->server->config.on_data(conn, payload, size);
+			}
+			conn->received += size;
+			conn->expSeq++;
+
+			/* ACK at once if this fills a gap, otherwise every ack_every packets */
+			if (conn->outOfOrder || ++conn->pending >= ack_every(conn->window_size)) {
+				conn_ack(w, conn);
+				conn->outOfOrder = 0;
+			}
+			else if (conn->ack_at == 0) {
+				conn->ack_at = now + ACK_DELAY * 1000LL;
+			}
+		}
+		else {
+			conn_ack(w, conn);
+			conn->outOfOrder = 1;
+		}
+		timer_update(w, conn);
+		break;
+
+	case SKIP: {
+		uint8_t ahead = packet->seq - conn->expSeq;
+		if (ahead < 128) {
+			conn->expSeq = packet->seq;
+		}
+		conn_ack(w, conn);
+		timer_update(w, conn);
+		break;
+	}
+
+	case PROBE:
+		/* The sender's path MTU probe got here, answer with its size */
+		pmtu_answer(w->sockfd, packet, (struct sockaddr*)&conn->peer, conn->peer_len);
+		break;
+
+	case KEEPALIVE:
+		/* Seen, so not idle any more */
+		path_keepalive_answer(w->sockfd, packet, (struct sockaddr*)&conn->peer, conn->peer_len);
+		timer_update(w, conn);
+		break;
+
+	case FIN:
+		/* Flush a held ACK, then FINACK until the last ACK comes */
+		if (conn->pending > 0) {
+			conn_ack(w, conn);
+		}
+		if (conn->state != RCVD_FIN) {
+			conn->state = RCVD_FIN;
+			conn->fin_seq = packet->seq + 1;
+			conn->attempts = 0;
+		}
+		conn_reply(w, conn, FINACK, conn->fin_seq);
+		conn->fin_at = now + FINACK_TIMEOUT;
+		timer_update(w, conn);
+		break;
+
+	case ACK:
+		if (conn->state == RCVD_FIN) {
+			conn_close(w, conn, "finished");
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+/* A packet with the id of a connection from another address. Taken in while the new address
+ * is validated, and once it is the connection moves there */
+static void server_moved(server_worker* w, gbn_conn* conn, rtp* packet, const struct sockaddr* peer, socklen_t peer_len) {
+	int result;
+
+	state.options = conn->options;
+	state.conn_id = conn->id;
+
+	/* Chained again afterwards, by the new address if it moved */
+	conn_unhash(w, conn);
+	result = path_check(w->sockfd, &conn->path, packet, peer, peer_len, &conn->peer, &conn->peer_len);
+	conn_hash(w, conn);
+
+	if (result == 1) {
+		server_packet(w, conn, packet);
+	}
+	else if (result == 2) {
+		printf("Worker %d: connection %08x moved\n", w->index, conn->id);
+
+		/* ACKs sent to the old address were lost */
+		conn->last_seen = gbn_now_ns();
+		if (conn->state == ESTABLISHED) {
+			conn_ack(w, conn);
+		}
+		timer_update(w, conn);
+	}
+}
+
+/* Run the timers of every slot up to now */
+static void server_timers(server_worker* w, int64_t now) {
+	int64_t tick = now / WHEEL_TICK;
+	int64_t last = w->wheel_tick + WHEEL_SLOTS;
+
+	for (; w->wheel_tick <= tick && w->wheel_tick < last; w->wheel_tick++) {
+		gbn_conn* conn = w->wheel[w->wheel_tick & (WHEEL_SLOTS - 1)];
+
+		while (conn != NULL) {
+			gbn_conn* next = conn->timer_next;
+
+			if (conn->timer_at <= now) {
+				if (conn->state == RCVD_FIN) {
+					if (++conn->attempts > MAX_ATTEMPTS) {
+						conn_close(w, conn, "no ACK for FINACK");
+						conn = next;
+						continue;
+					}
+					conn_reply(w, conn, FINACK, conn->fin_seq);
+					conn->fin_at = now + FINACK_TIMEOUT;
+				}
+				else if (conn->pending > 0) {
+					conn_ack(w, conn);
+				}
+				else if (now - conn->last_seen >= SERVER_IDLE * 1000000000LL) {
+					conn_close(w, conn, "idle");
+					conn = next;
+					continue;
+				}
+				timer_update(w, conn);
+			}
+			conn = next;
+		}
+	}
+	if (w->wheel_tick <= tick) { /* Slept longer than a turn, every slot was run */
+		w->wheel_tick = tick + 1;
+	}
+}
+
+
+/* Receive up to SERVER_BATCH packets into the pool, returns how many */
+static int server_receive(server_worker* w, socklen_t* lens, ssize_t* sizes) {
+#ifdef HAVE_RECVMMSG
+	for (int i = 0; i < SERVER_BATCH; i++) {
+		w->msgs[i].msg_hdr.msg_namelen = sizeof(w->addrs[i]);
+	}
+	int n = recvmmsg(w->sockfd, w->msgs, SERVER_BATCH, MSG_DONTWAIT, NULL);
+	for (int i = 0; i < n; i++) {
+		lens[i] = w->msgs[i].msg_hdr.msg_namelen;
+		sizes[i] = w->msgs[i].msg_len;
+	}
+	return n < 0 ? 0 : n;
+#else
+	int n = 0;
+	while (n < SERVER_BATCH) {
+		lens[n] = sizeof(w->addrs[n]);
+		sizes[n] = recvfrom(w->sockfd, &w->pool[n], sizeof(w->pool[n]), MSG_DONTWAIT, (struct sockaddr*)&w->addrs[n], &lens[n]);
+		if (sizes[n] < 0) {
+			break;
+		}
+		n++;
+	}
+	return n;
+#endif
+}
+
+/* Connection table and packet pool, allocated by the worker itself once it is pinned so
+ * they are placed on its node */
+static void worker_buffers(server_worker* w) {
+	w->conns = arena_alloc(&w->arena, SERVER_MAX_CONNS * sizeof(*w->conns));
+	w->pool = arena_alloc(&w->arena, SERVER_BATCH * sizeof(*w->pool));
+	w->addrs = arena_alloc(&w->arena, SERVER_BATCH * sizeof(*w->addrs));
+	memset(w->conns, 0, SERVER_MAX_CONNS * sizeof(*w->conns));
+
+	/* Every entry starts out free */
+	for (int i = SERVER_MAX_CONNS - 1; i >= 0; i--) {
+		w->conns[i].state = CLOSED;
+		w->conns[i].hash_next = w->free_list;
+		w->free_list = &w->conns[i];
+	}
+
+#ifdef HAVE_RECVMMSG
+	w->msgs = arena_alloc(&w->arena, SERVER_BATCH * sizeof(*w->msgs));
+	w->iovs = arena_alloc(&w->arena, SERVER_BATCH * sizeof(*w->iovs));
+	memset(w->msgs, 0, SERVER_BATCH * sizeof(*w->msgs));
+	for (int i = 0; i < SERVER_BATCH; i++) {
+		w->iovs[i].iov_base = &w->pool[i];
+		w->iovs[i].iov_len = sizeof(w->pool[i]);
+		w->msgs[i].msg_hdr.msg_name = &w->addrs[i];
+		w->msgs[i].msg_hdr.msg_iov = &w->iovs[i];
+		w->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+}
+
+static void* server_worker_main(void* arg) {
+	server_worker* w = arg;
+	gbn_server* server = w->server;
+	socklen_t lens[SERVER_BATCH];
+	ssize_t sizes[SERVER_BATCH];
+
+#ifdef HAVE_RECVMMSG
+	if (server->config.pin_cpus) {
+		cpu_set_t cpus;
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+		CPU_ZERO(&cpus);
+		CPU_SET(w->index % (ncpu > 0 ? ncpu : 1), &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+			printf("Worker %d: could not pin to a CPU\n", w->index);
+		}
+	}
+#endif
+
+	worker_buffers(w);
+	w->wheel_tick = gbn_now_ns() / WHEEL_TICK;
+
+	while (!server->stop) {
+		int64_t timeout = (w->wheel_tick + 1) * WHEEL_TICK - gbn_now_ns();
+		if (timeout < 0) {
+			timeout = 0;
+		}
+
+		int result = gbn_wait_ns(w->sockfd, &timeout);
+		if (result == -1) {
+			perror("select");
+			break;
+		}
+
+		if (result > 0) {
+			int n = server_receive(w, lens, sizes);
+			int64_t received_at = gbn_now_ns();
+
+			for (int i = 0; i < n; i++) {
+				rtp* packet = &w->pool[i];
+				struct sockaddr* peer = (struct sockaddr*)&w->addrs[i];
+
+				if (sizes[i] > 0) {
+					gbn_pcap_packet(PCAP_RECEIVED, w->sockfd, packet, sizes[i], peer, received_at);
+				}
+
+				/* Cut short on the way, whatever it claims to be */
+				if (sizes[i] < (ssize_t)offsetof(rtp, data) || (size_t)sizes[i] < gbn_packet_size(packet)) {
+					continue;
+				}
+
+				gbn_conn* conn = conn_find(w, peer);
+				if (conn != NULL) {
+					server_packet(w, conn, packet);
+				}
+				else if (packet->conn_id != 0 && (conn = conn_find_id(w, packet->conn_id)) != NULL) {
+					server_moved(w, conn, packet, peer, lens[i]);
+				}
+				else {
+					server_handshake(w, packet, peer, lens[i]);
+				}
+			}
+		}
+
+		server_timers(w, gbn_now_ns());
+	}
+
+	/* Connections still open are dropped */
+	for (int i = 0; i < SERVER_MAX_CONNS; i++) {
+		if (w->conns[i].state != CLOSED) {
+			conn_close(w, &w->conns[i], "server stopped");
+		}
+	}
+	gbn_io_close(w->sockfd);
+	return NULL;
+}
+
+
+static server_worker* worker_create(gbn_server* server, int index) {
+	server_worker* w;
+	struct sockaddr_in addr;
+	int one = 1;
+
+	if (posix_memalign((void**)&w, 64, sizeof(*w)) != 0) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(w, 0, sizeof(*w));
+	w->server = server;
+	w->index = index;
+	arena_init(&w->arena);
+
+	/* Every worker binds the same port, the kernel spreads peers over the sockets */
+	w->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (w->sockfd < 0) {
+		perror("Could not create socket");
+		exit(EXIT_FAILURE);
+	}
+	if (setsockopt(w->sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+		perror("SO_REUSEPORT");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(server->config.port);
+	if (bind(w->sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("Could not bind socket");
+		exit(EXIT_FAILURE);
+	}
+	return w;
+}
+
+static void worker_free(server_worker* w) {
+	close(w->sockfd);
+	arena_destroy(&w->arena);
+	free(w);
+}
+
+
+/* Steer packets with a connection id to the socket of the worker in the id's top byte, the
+ * others (handshakes) by the kernel's hash. Sockets are numbered in the order they were bound,
+ * which is the worker index */
+static void server_steer(gbn_server* server) {
+#if defined(SO_ATTACH_REUSEPORT_CBPF)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	const uint32_t owner = offsetof(rtp, conn_id) + 3;
+#else
+	const uint32_t owner = offsetof(rtp, conn_id);
+#endif
+	/* The program sees the UDP payload. An index past the last socket falls back to the hash */
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(rtp, conn_id)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 3, 0),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, owner),
+		BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, (uint32_t)server->nworkers, 1, 0),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+	};
+	struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+
+	if (server->nworkers > 1 && server->nworkers <= 256 &&
+		setsockopt(server->workers[0]->sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		perror("SO_ATTACH_REUSEPORT_CBPF, peers that move may reach the wrong worker");
+	}
+#else
+	(void)server;
+#endif
+}
+
+/* Start the workers, all sockets are bound before the first one runs */
+gbn_server* gbn_server_start(const gbn_server_config* config) {
+	gbn_server* server = calloc(1, sizeof(*server));
+	if (server == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	server->config = *config;
+	server->nworkers = config->workers;
+	if (server->nworkers <= 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		server->nworkers = ncpu > 0 ? ncpu : 1;
+	}
+
+	server->workers = calloc(server->nworkers, sizeof(*server->workers));
+	if (server->workers == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < server->nworkers; i++) {
+		server->workers[i] = worker_create(server, i);
+	}
+	server_steer(server);
+	for (int i = 0; i < server->nworkers; i++) {
+		if (pthread_create(&server->workers[i]->thread, NULL, server_worker_main, server->workers[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("Server on port %d with %d workers\n", config->port, server->nworkers);
+	return server;
+}
+
+/* Stop and free the server, open connections are dropped */
+void gbn_server_stop(gbn_server* server) {
+	server->stop = 1;
+
+	for (int i = 0; i < server->nworkers; i++) {
+		pthread_join(server->workers[i]->thread, NULL);
+		worker_free(server->workers[i]);
+	}
+	free(server->workers);
+	free(server);
+}
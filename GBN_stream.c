@@ -0,0 +1,375 @@
+/* File: GBN_stream.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Several independent streams inside one connection. Every stream has its own
+ *              sequence numbers, ACKs and retransmission timer, so a loss only makes its own
+ *              stream go back N. The streams share the handshake, the socket and the window.
+ */
+
+#include "GBN.h"
+
+
+/* Retransmission timeout of a stream (ns) */
+#define STREAM_TIMEOUT (5 * 1000000000LL)
+
+
+static size_t stream_segments(const gbn_stream* s) {
+	return (s->len + state.mss - 1) / state.mss;
+}
+
+/* Fill DATA_packet with segment n of stream id, compressed and stamped as in sender_gbn */
+static void make_stream_packet(rtp* DATA_packet, gbn_stream* s, int id, size_t n) {
+	size_t offset = n * state.mss;
+	size_t left = s->len - offset;
+
+	DATA_packet->flags = DATA;
+	DATA_packet->stream = id;
+	DATA_packet->seq = (uint8_t)n;
+	data_packet_fill(DATA_packet, (const uint8_t*)s->send_buf + offset, left < (size_t)state.mss ? left : (size_t)state.mss);
+}
+
+static int send_stream_packet(int sockfd, rtp* DATA_packet) {
+	if (maybe_sendto(sockfd, DATA_packet, gbn_packet_size(DATA_packet), 0, (struct sockaddr*)&state.address, state.sck_len) == -1) {
+		printf("ERROR: Unable to send DATA packet.\n");
+		return -1;
+	}
+	printf("SUCCESS: Sent DATA packet (stream: %d seq: %d)...\n", DATA_packet->stream, DATA_packet->seq);
+	return 0;
+}
+
+
+/* Send nstreams buffers over the established connection, interleaved round-robin.
+ * Returns the number of bytes sent, or -1 if a stream ran out of attempts */
+ssize_t sender_streams(int sockfd, gbn_stream* streams, int nstreams) {
+	size_t in_flight = 0;   /* Unacknowledged packets, all streams */
+	size_t total = 0;
+	int turn = 0;           /* Next stream to get a send slot */
+	int result;
+
+	struct sockaddr_storage from;
+	socklen_t from_len;
+
+	if (nstreams > MAX_STREAMS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* From the connection's arena, released on return */
+	gbn_arena* arena = arena_thread();
+	arena_mark mark = arena_get_mark(arena);
+	rtp* DATA_packet = arena_alloc(arena, sizeof(*DATA_packet));
+	rtp* ACK_packet = arena_alloc(arena, sizeof(*ACK_packet));
+	memset(DATA_packet, 0, sizeof(*DATA_packet));
+	memset(ACK_packet, 0, sizeof(*ACK_packet));
+
+	for (int i = 0; i < nstreams; i++) {
+		streams[i].base = 0;
+		streams[i].next = 0;
+		streams[i].attempts = 0;
+		streams[i].done = 0;
+		total += streams[i].len;
+	}
+
+	/* ACK arrival times from the kernel, for the timestamp echo */
+	if (state.options & OPT_TSTAMP) {
+		gbn_timestamps_init(sockfd);
+	}
+
+	while (1) {
+		int64_t now = gbn_now_ns();
+		int64_t deadline = 0;
+		int unfinished = 0;
+
+		/* Hand out free window slots one stream at a time */
+		for (int tries = 0; tries < nstreams && in_flight < (size_t)state.window_size; ) {
+			gbn_stream* s = &streams[turn];
+
+			if (s->next < stream_segments(s) && s->next - s->base < 255) {
+				if (s->next == s->base) { /* First outstanding packet starts the timer */
+					s->deadline = now + STREAM_TIMEOUT;
+				}
+				make_stream_packet(DATA_packet, s, turn, s->next);
+				if (send_stream_packet(sockfd, DATA_packet) == -1) {
+					arena_release(arena, mark);
+					return -1;
+				}
+				s->next++;
+				in_flight++;
+				tries = 0;
+			}
+			else {
+				tries++;
+			}
+			turn = (turn + 1) % nstreams;
+		}
+
+		/* Retransmit streams whose timer ran out, the others keep going */
+		for (int i = 0; i < nstreams; i++) {
+			gbn_stream* s = &streams[i];
+
+			if (s->base < stream_segments(s)) {
+				unfinished = 1;
+			}
+			if (s->base == s->next) {
+				continue;
+			}
+
+			if (s->deadline <= now) {
+				printf("TIMEOUT: stream %d packet (%d) lost\n", i, (uint8_t)s->base);
+
+				if (++s->attempts > MAX_ATTEMPTS) {
+					printf("ERROR: Max attempts are reached.\n");
+					arena_release(arena, mark);
+					return -1;
+				}
+				resend_handshake_ack(sockfd);
+				for (size_t n = s->base; n < s->next; n++) {
+					make_stream_packet(DATA_packet, s, i, n);
+					if (send_stream_packet(sockfd, DATA_packet) == -1) {
+						arena_release(arena, mark);
+						return -1;
+					}
+				}
+				s->deadline = now + STREAM_TIMEOUT;
+			}
+			if (deadline == 0 || s->deadline < deadline) {
+				deadline = s->deadline;
+			}
+		}
+
+		if (!unfinished) {
+			break;
+		}
+
+		/* Wait for an ACK until the earliest stream timer */
+		int64_t timeout = deadline - now;
+		result = gbn_wait_ns(sockfd, &timeout);
+
+		if (result == -1) {
+			perror("select");
+			arena_release(arena, mark);
+			return -1;
+		}
+		else if (result == 0) {
+			continue;
+		}
+
+		from_len = sizeof(from);
+		if (gbn_recvfrom(sockfd, ACK_packet, sizeof(*ACK_packet), 0, (struct sockaddr*)&from, &from_len) == -1) {
+			perror("Can't read from socket");
+			exit(EXIT_FAILURE);
+		}
+
+		if (path_respond(sockfd, ACK_packet)) { /* The receiver saw us from a new address */
+			continue;
+		}
+		if (ACK_packet->flags != ACK || ACK_packet->checksum != checksum(ACK_packet) || ACK_packet->stream >= nstreams) {
+			printf("Invalid ACK packet\n");
+			continue;
+		}
+
+		/* Cumulative ACK for one stream */
+		gbn_stream* s = &streams[ACK_packet->stream];
+		size_t acked = (uint8_t)(ACK_packet->seq - (uint8_t)s->base);
+
+		echo_rtt_sample(ACK_packet);
+
+		if (acked > 0 && acked <= s->next - s->base) {
+			printf("Valid ACK packet! (stream: %d seq: %d)\n", ACK_packet->stream, ACK_packet->seq);
+			s->base += acked;
+			in_flight -= acked;
+			s->attempts = 0;
+			state.handshake_unconfirmed = 0;
+			s->done = s->base * state.mss < s->len ? s->base * state.mss : s->len;
+			s->deadline = gbn_now_ns() + STREAM_TIMEOUT;
+		}
+	}
+
+	arena_release(arena, mark);
+	return (ssize_t)total;
+}
+
+
+/* Send a cumulative ACK for one stream */
+static void send_stream_ack(int sockfd, rtp* ACK_packet, int id, uint8_t expSeq, const struct sockaddr* client, socklen_t client_len) {
+	ACK_packet->stream = id;
+	ACK_packet->seq = expSeq;
+	ACK_packet->tstamp = ack_tstamp(state.options, state.ts_recent, state.ts_arrival);
+	ACK_packet->conn_id = state.conn_id;
+	ACK_packet->checksum = checksum(ACK_packet);
+
+	if (maybe_sendto(sockfd, ACK_packet, gbn_packet_size(ACK_packet), 0, client, client_len) == -1) {
+		perror("maybe_sendto");
+		exit(EXIT_FAILURE);
+	}
+	printf("Successfully sent ACK! (stream: %d seq: %d)\n", id, expSeq);
+}
+
+/* Receive nstreams streams until FIN. Each stream is delivered in order into its recv_buf,
+ * and to its deliver callback if set. Returns the number of bytes received */
+ssize_t receiver_streams(int sockfd, gbn_stream* streams, int nstreams) {
+	uint8_t expSeq[MAX_STREAMS];
+	int pending[MAX_STREAMS];       /* Held ACKs, see receiver_gbn */
+	int outOfOrder[MAX_STREAMS];
+	int held = 0;                   /* Streams with a held ACK, ackTimer runs */
+	int ackEvery = ack_every(state.window_size);
+	size_t received = 0;
+	int64_t ackTimer = 0;
+	int result;
+
+	/* Where the last packet came from, ACKs go to the validated peer as in receiver_gbn */
+	struct sockaddr_storage client_addr;
+	socklen_t client_len = sizeof(client_addr);
+
+	if (nstreams > MAX_STREAMS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* From the connection's arena, released on return */
+	gbn_arena* arena = arena_thread();
+	arena_mark mark = arena_get_mark(arena);
+	rtp* DATA_packet = arena_alloc(arena, sizeof(*DATA_packet));
+	rtp* ACK_packet = arena_alloc(arena, sizeof(*ACK_packet));
+	memset(ACK_packet, 0, sizeof(*ACK_packet));
+	ACK_packet->flags = ACK;
+
+	for (int i = 0; i < nstreams; i++) {
+		expSeq[i] = 0;
+		pending[i] = 0;
+		outOfOrder[i] = 0;
+		streams[i].done = 0;
+	}
+
+	/* DATA arrival times from the kernel, the ACK delay is taken out of the echo */
+	state.ts_recent = 0;
+	if (state.options & OPT_TSTAMP) {
+		gbn_timestamps_init(sockfd);
+	}
+
+	while (r_state == ESTABLISHED) {
+
+		/* Flush held ACKs when the delay timer runs out */
+		if (held) {
+			result = gbn_wait_ns(sockfd, &ackTimer);
+
+			if (result == -1) {
+				perror("Select failed");
+				exit(EXIT_FAILURE);
+			}
+			else if (result == 0) {
+				for (int i = 0; i < nstreams; i++) {
+					if (pending[i] > 0) {
+						send_stream_ack(sockfd, ACK_packet, i, expSeq[i], (struct sockaddr*)&state.address, state.sck_len);
+						pending[i] = 0;
+					}
+				}
+				held = 0;
+				continue;
+			}
+		}
+
+		client_len = sizeof(client_addr);
+		ssize_t nbytes = gbn_recvfrom(sockfd, DATA_packet, sizeof(*DATA_packet), 0, (struct sockaddr*)&client_addr, &client_len);
+		if (nbytes == -1) {
+			r_state = CLOSED;
+			perror("Can't read from socket\n");
+			exit(EXIT_FAILURE);
+		}
+
+		/* Cut short on the way, whatever it claims to be */
+		if ((size_t)nbytes < gbn_packet_size(DATA_packet)) {
+			printf("Short packet (%zd bytes)\n", nbytes);
+			continue;
+		}
+
+		if (DATA_packet->checksum != checksum(DATA_packet)) {
+			printf("Invalid packet!\n");
+			continue;
+		}
+
+		result = path_check(sockfd, &state.path, DATA_packet, (struct sockaddr*)&client_addr, client_len, &state.address, &state.sck_len);
+		if (result == 0) {
+			continue;
+		}
+		else if (result == 2) { /* Moved, ACK every stream to the new address */
+			for (int i = 0; i < nstreams; i++) {
+				send_stream_ack(sockfd, ACK_packet, i, expSeq[i], (struct sockaddr*)&state.address, state.sck_len);
+				pending[i] = 0;
+			}
+			held = 0;
+			continue;
+		}
+
+		if (DATA_packet->flags == KEEPALIVE) {
+			path_keepalive_answer(sockfd, DATA_packet, (struct sockaddr*)&state.address, state.sck_len);
+			continue;
+		}
+
+		if (DATA_packet->flags == FIN) {
+			printf("Received a valid FIN packet!\n");
+			for (int i = 0; i < nstreams; i++) {
+				if (pending[i] > 0) {
+					send_stream_ack(sockfd, ACK_packet, i, expSeq[i], (struct sockaddr*)&state.address, state.sck_len);
+				}
+			}
+			break;
+		}
+
+		if (DATA_packet->flags != DATA || DATA_packet->stream >= nstreams) {
+			continue;
+		}
+
+		int id = DATA_packet->stream;
+		gbn_stream* s = &streams[id];
+
+		/* Echoed by the next ACK */
+		if (DATA_packet->tstamp != 0) {
+			state.ts_recent = DATA_packet->tstamp;
+			state.ts_arrival = gbn_rx_time();
+		}
+
+		if (DATA_packet->seq == expSeq[id]) {
+			size_t offset = s->done;
+			const uint8_t* payload;
+			uint8_t unpacked[MAXMSG];
+			ssize_t size = data_payload(DATA_packet, &payload, unpacked);
+
+			if (size < 0) { /* Not acknowledged, the sender resends it */
+				printf("ERROR: Can't decompress DATA packet (stream: %d seq: %d)\n", id, DATA_packet->seq);
+				continue;
+			}
+			size_t plen = size;
+
+			/* In order for this stream, deliver right away */
+			if (offset < s->len) {
+				memcpy((uint8_t*)s->recv_buf + offset, payload, plen < s->len - offset ? plen : s->len - offset);
+			}
+			if (s->deliver != NULL) {
+				s->deliver(id, payload, plen);
+			}
+			s->done += plen;
+			received += plen;
+			expSeq[id]++;
+			pending[id]++;
+
+			if (outOfOrder[id] || pending[id] >= ackEvery) {
+				send_stream_ack(sockfd, ACK_packet, id, expSeq[id], (struct sockaddr*)&state.address, state.sck_len);
+				outOfOrder[id] = 0;
+				pending[id] = 0;
+			}
+			else if (!held) {
+				held = 1;
+				ackTimer = ACK_DELAY * 1000LL;
+			}
+		}
+		else { /* Gap in this stream only, duplicate ACK at once */
+			printf("DATA packet has wrong sequence number! (stream: %d)\n", id);
+			send_stream_ack(sockfd, ACK_packet, id, expSeq[id], (struct sockaddr*)&state.address, state.sck_len);
+			outOfOrder[id] = 1;
+			pending[id] = 0;
+		}
+	}
+
+	arena_release(arena, mark);
+	return (ssize_t)received;
+}
@@ -0,0 +1,169 @@
+/* File: GBN_stripe.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Striped bulk transfer. One logical transfer is spread over several UDP flows,
+ *              each an ordinary GBN connection driven by its own thread. Segment n of the
+ *              buffer goes to flow n % nflows and is put back at the same offset on receive.
+ */
+
+#include "GBN.h"
+
+
+/* One flow of a striped transfer */
+typedef struct stripe_flow_t {
+	int sockfd;
+	int index;                  /* Flow number, 0..count-1 */
+	int count;                  /* Number of flows */
+	struct sockaddr_in peer;
+	socklen_t peer_len;
+	const void* send_buf;
+	void* recv_buf;
+	size_t len;
+	ssize_t result;             /* Packets sent or bytes received, -1 on failure */
+} stripe_flow;
+
+
+/* Open nflows UDP sockets. The receiver binds port, port + 1, ... one port per flow,
+ * the sender passes port 0 to get ephemeral ports */
+int stripe_open(int port, int nflows, int* sockfds) {
+	struct sockaddr_in addr;
+
+	for (int i = 0; i < nflows; i++) {
+		sockfds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sockfds[i] < 0) {
+			perror("Could not create socket");
+			exit(EXIT_FAILURE);
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(port == 0 ? 0 : port + i);
+
+		if (bind(sockfds[i], (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+			perror("Could not bind socket");
+			exit(EXIT_FAILURE);
+		}
+	}
+	return nflows;
+}
+
+static void* stripe_send_worker(void* arg) {
+	stripe_flow* flow = arg;
+
+	/* Connection state is per thread, tell sender_gbn which segments are ours */
+	state.stripe_index = flow->index;
+	state.stripe_count = flow->count;
+
+	sender_connection(flow->sockfd, (struct sockaddr*)&flow->peer, flow->peer_len);
+	flow->result = sender_gbn(flow->sockfd, flow->send_buf, flow->len, GBN_BYTES);
+
+	if (flow->result >= 0) {
+		sender_teardown(flow->sockfd, (struct sockaddr*)&flow->peer, flow->peer_len);
+	}
+	return NULL;
+}
+
+static void* stripe_recv_worker(void* arg) {
+	stripe_flow* flow = arg;
+
+	state.stripe_index = flow->index;
+	state.stripe_count = flow->count;
+
+	flow->peer_len = sizeof(flow->peer);
+	receiver_connection(flow->sockfd, (struct sockaddr*)&flow->peer, &flow->peer_len);
+	flow->result = receiver_gbn(flow->sockfd, flow->recv_buf, flow->len, GBN_BYTES);
+	receiver_teardown(flow->sockfd, (struct sockaddr*)&flow->peer, flow->peer_len);
+	return NULL;
+}
+
+/* Start one thread per flow and wait for all of them */
+static int stripe_run(stripe_flow* flows, int nflows, void* (*worker)(void*)) {
+	pthread_t* threads = malloc(nflows * sizeof(*threads));
+	if (threads == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < nflows; i++) {
+		if (pthread_create(&threads[i], NULL, worker, &flows[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (int i = 0; i < nflows; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+	return 0;
+}
+
+/* Send len bytes of buf over nflows flows. Flow i connects to the port of server + i.
+ * Returns len, or -1 if any flow failed */
+ssize_t stripe_send(const int* sockfds, int nflows, const struct sockaddr_in* server, const void* buf, size_t len) {
+	ssize_t result = (ssize_t)len;
+
+	stripe_flow* flows = calloc(nflows, sizeof(*flows));
+	if (flows == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < nflows; i++) {
+		flows[i].sockfd = sockfds[i];
+		flows[i].index = i;
+		flows[i].count = nflows;
+		flows[i].peer = *server;
+		flows[i].peer.sin_port = htons(ntohs(server->sin_port) + i);
+		flows[i].peer_len = sizeof(flows[i].peer);
+		flows[i].send_buf = buf;
+		flows[i].len = len;
+	}
+
+	stripe_run(flows, nflows, stripe_send_worker);
+
+	for (int i = 0; i < nflows; i++) {
+		if (flows[i].result < 0) {
+			printf("Striped flow %d failed\n", i);
+			result = -1;
+		}
+	}
+
+	free(flows);
+	return result;
+}
+
+/* Receive a striped transfer into buf (at most len bytes), returns the bytes received,
+ * or -1 if any flow failed */
+ssize_t stripe_recv(const int* sockfds, int nflows, void* buf, size_t len) {
+	ssize_t result = 0;
+
+	stripe_flow* flows = calloc(nflows, sizeof(*flows));
+	if (flows == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < nflows; i++) {
+		flows[i].sockfd = sockfds[i];
+		flows[i].index = i;
+		flows[i].count = nflows;
+		flows[i].recv_buf = buf;
+		flows[i].len = len;
+	}
+
+	stripe_run(flows, nflows, stripe_recv_worker);
+
+	for (int i = 0; i < nflows; i++) {
+		if (flows[i].result < 0) {
+			printf("Striped flow %d failed\n", i);
+			result = -1;
+		}
+		else if (result >= 0) {
+			result += flows[i].result;
+		}
+	}
+
+	free(flows);
+	return result;
+}
@@ -0,0 +1,512 @@
+/* File: GBN_transport.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Transports other than a UDP socket. A transport gets a file descriptor of its
+ *              own (a placeholder, nothing is read from it) and every gbn_ I/O call on that
+ *              descriptor goes to the transport instead of the kernel.
+ *
+ *              Simulated channel: two endpoints in one process, packets are lost with a given
+ *              probability and arrive after a fixed delay. Time is virtual, it only moves when
+ *              both ends are waiting, and then jumps to the next arrival or timeout. Timeouts
+ *              cost nothing, so long simulations run as fast as the protocol code allows.
+ *
+ *              Shared memory ring: two peers on the same host exchange packets through a pair
+ *              of single producer, single consumer rings in a POSIX shared memory object.
+ */
+
+#include "GBN.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#define HAVE_FUTEX 1
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+
+#define MAX_TRANSPORT_FDS 1024
+#define SIM_START (1000000000LL)    /* Virtual clock at the start, 0 means "not sent" to sender_gbn */
+#define SHM_SLOTS 256               /* Packets per ring, power of two */
+#define SHM_SIZE_WAIT 5000          /* ms to wait for the creating peer to size the object */
+
+
+static gbn_transport* transports[MAX_TRANSPORT_FDS];
+static pthread_mutex_t transports_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Register a transport, returns the descriptor to use with the gbn_ calls or -1 */
+int gbn_transport_open(const gbn_transport* transport) {
+	gbn_transport* t = malloc(sizeof(*t));
+	if (t == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	*t = *transport;
+
+	/* Any open descriptor keeps the number from being handed out twice */
+	int fd = open("/dev/null", O_RDONLY);
+	if (fd < 0 || fd >= MAX_TRANSPORT_FDS) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		free(t);
+		errno = EMFILE;
+		return -1;
+	}
+
+	pthread_mutex_lock(&transports_lock);
+	transports[fd] = t;
+	pthread_mutex_unlock(&transports_lock);
+	return fd;
+}
+
+void gbn_transport_close(int fd) {
+	gbn_transport* t = NULL;
+
+	pthread_mutex_lock(&transports_lock);
+	if (fd >= 0 && fd < MAX_TRANSPORT_FDS) {
+		t = transports[fd];
+		transports[fd] = NULL;
+	}
+	pthread_mutex_unlock(&transports_lock);
+
+	if (t != NULL) {
+		if (t->close != NULL) {
+			t->close(t->ctx);
+		}
+		free(t);
+		close(fd);
+	}
+}
+
+/* Transport behind fd, NULL for a plain socket */
+const gbn_transport* gbn_transport_get(int fd) {
+	if (fd < 0 || fd >= MAX_TRANSPORT_FDS) {
+		return NULL;
+	}
+	return transports[fd];
+}
+
+
+/* Peer address handed out by the transports, they only have one peer */
+static void fake_peer(struct sockaddr* from, socklen_t* fromlen, int side) {
+	struct sockaddr_in addr;
+
+	if (from == NULL || fromlen == NULL) {
+		return;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(side + 1);
+
+	memcpy(from, &addr, *fromlen < sizeof(addr) ? *fromlen : sizeof(addr));
+	*fromlen = sizeof(addr);
+}
+
+
+/* Simulated channel */
+
+typedef struct sim_packet_t {
+	struct sim_packet_t* next;
+	int64_t arrival;
+	size_t len;
+	uint8_t data[];
+} sim_packet;
+
+typedef struct sim_channel_t {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int64_t now;                /* Virtual clock */
+	double loss;
+	int64_t delay;
+	unsigned int seed;
+	sim_packet* head[2];        /* Packets on their way to end i, by arrival */
+	sim_packet* tail[2];
+	int64_t waiting[2];         /* Deadline end i waits for, -1 while it runs */
+	int closed[2];
+	int ends;                   /* Ends not closed yet */
+} sim_channel;
+
+typedef struct sim_end_t {
+	sim_channel* channel;
+	int side;
+} sim_end;
+
+/* Both ends wait, move the clock to whatever happens first */
+static void sim_advance(sim_channel* ch) {
+	int64_t next = INT64_MAX;
+
+	if (ch->waiting[0] < 0 || ch->waiting[1] < 0) {
+		return;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (ch->waiting[i] < next) {
+			next = ch->waiting[i];
+		}
+		if (ch->head[i] != NULL && ch->head[i]->arrival < next) {
+			next = ch->head[i]->arrival;
+		}
+	}
+	if (next != INT64_MAX && next > ch->now) {
+		ch->now = next;
+		pthread_cond_broadcast(&ch->cond);
+	}
+}
+
+/* Wait with the lock held until a packet for side has arrived or deadline passes. 0 on
+ * timeout, or at once for an endless wait when the peer has closed */
+static int sim_wait_locked(sim_channel* ch, int side, int64_t deadline) {
+	int result;
+
+	while (1) {
+		if (ch->head[side] != NULL && ch->head[side]->arrival <= ch->now) {
+			result = 1;
+			break;
+		}
+		if (ch->now >= deadline) {
+			result = 0;
+			break;
+		}
+		if (deadline == INT64_MAX && ch->head[side] == NULL && ch->closed[1 - side]) {
+			/* Nothing more comes once the peer has closed, waiting forever would hang */
+			result = 0;
+			break;
+		}
+
+		int64_t before = ch->now;
+		ch->waiting[side] = deadline;
+		sim_advance(ch);
+		if (ch->now == before) {
+			pthread_cond_wait(&ch->cond, &ch->lock);
+		}
+	}
+	ch->waiting[side] = -1;
+	return result;
+}
+
+static ssize_t sim_sendto(void* ctx, const void* buf, size_t len, const struct sockaddr* to, socklen_t tolen) {
+	sim_end* end = ctx;
+	sim_channel* ch = end->channel;
+	int peer = 1 - end->side;
+
+	(void)to;
+	(void)tolen;
+	pthread_mutex_lock(&ch->lock);
+	if (!ch->closed[peer] && rand_r(&ch->seed) >= ch->loss * RAND_MAX) {
+		sim_packet* packet = malloc(sizeof(*packet) + len);
+		if (packet == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		packet->next = NULL;
+		packet->arrival = ch->now + ch->delay;
+		packet->len = len;
+		memcpy(packet->data, buf, len);
+
+		/* Fixed delay, so arrivals are in send order */
+		if (ch->tail[peer] != NULL) {
+			ch->tail[peer]->next = packet;
+		}
+		else {
+			ch->head[peer] = packet;
+		}
+		ch->tail[peer] = packet;
+		pthread_cond_broadcast(&ch->cond);
+	}
+	pthread_mutex_unlock(&ch->lock);
+	return len;
+}
+
+static ssize_t sim_recvfrom(void* ctx, void* buf, size_t len, struct sockaddr* from, socklen_t* fromlen) {
+	sim_end* end = ctx;
+	sim_channel* ch = end->channel;
+
+	pthread_mutex_lock(&ch->lock);
+
+	if (!sim_wait_locked(ch, end->side, INT64_MAX)) {
+		pthread_mutex_unlock(&ch->lock);
+		errno = ECONNRESET;
+		return -1;
+	}
+
+	sim_packet* packet = ch->head[end->side];
+	ch->head[end->side] = packet->next;
+	if (ch->head[end->side] == NULL) {
+		ch->tail[end->side] = NULL;
+	}
+	pthread_mutex_unlock(&ch->lock);
+
+	size_t n = packet->len < len ? packet->len : len;
+	memcpy(buf, packet->data, n);
+	free(packet);
+	fake_peer(from, fromlen, 1 - end->side);
+	return n;
+}
+
+static int sim_wait_ns(void* ctx, int64_t* timeout_ns) {
+	sim_end* end = ctx;
+	sim_channel* ch = end->channel;
+	int result;
+
+	pthread_mutex_lock(&ch->lock);
+	int64_t deadline = ch->now + *timeout_ns;
+	result = sim_wait_locked(ch, end->side, deadline);
+	*timeout_ns = result ? deadline - ch->now : 0;
+	pthread_mutex_unlock(&ch->lock);
+	return result;
+}
+
+static int64_t sim_now_ns(void* ctx) {
+	sim_end* end = ctx;
+	int64_t now;
+
+	pthread_mutex_lock(&end->channel->lock);
+	now = end->channel->now;
+	pthread_mutex_unlock(&end->channel->lock);
+	return now;
+}
+
+/* A closed end waits forever, so the clock keeps moving for the other one */
+static void sim_close(void* ctx) {
+	sim_end* end = ctx;
+	sim_channel* ch = end->channel;
+	int last;
+
+	pthread_mutex_lock(&ch->lock);
+	ch->waiting[end->side] = INT64_MAX;
+	ch->closed[end->side] = 1;
+	for (sim_packet* p = ch->head[end->side]; p != NULL; ) {
+		sim_packet* next = p->next;
+		free(p);
+		p = next;
+	}
+	ch->head[end->side] = NULL;
+	ch->tail[end->side] = NULL;
+	sim_advance(ch);
+	pthread_cond_broadcast(&ch->cond);
+	last = --ch->ends == 0;
+	pthread_mutex_unlock(&ch->lock);
+
+	if (last) {
+		pthread_mutex_destroy(&ch->lock);
+		pthread_cond_destroy(&ch->cond);
+		free(ch);
+	}
+	free(end);
+}
+
+/* Two connected ends of a simulated channel, for a sender and a receiver thread.
+ * Close both with gbn_transport_close when done */
+int gbn_sim_pair(int fds[2], double loss, int64_t delay_ns) {
+	sim_channel* ch = calloc(1, sizeof(*ch));
+	if (ch == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutex_init(&ch->lock, NULL);
+	pthread_cond_init(&ch->cond, NULL);
+	ch->now = SIM_START;
+	ch->loss = loss;
+	ch->delay = delay_ns;
+	ch->seed = (unsigned int)time(NULL);
+	ch->waiting[0] = -1;
+	ch->waiting[1] = -1;
+	ch->ends = 2;
+
+	for (int i = 0; i < 2; i++) {
+		sim_end* end = malloc(sizeof(*end));
+		if (end == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		end->channel = ch;
+		end->side = i;
+
+		gbn_transport t = { "sim", sim_sendto, sim_recvfrom, sim_wait_ns, sim_now_ns, sim_close, end };
+		fds[i] = gbn_transport_open(&t);
+		if (fds[i] < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/* Shared memory ring */
+
+typedef struct shm_ring_t {
+	_Atomic uint32_t head __attribute__((aligned(64)));     /* Next slot to read, consumer only */
+	_Atomic uint32_t tail __attribute__((aligned(64)));     /* Next slot to write, producer only */
+	_Atomic uint32_t wake;      /* Futex word, bumped on every packet */
+	_Atomic uint32_t waiters;
+	struct {
+		uint32_t len;
+		uint8_t data[sizeof(rtp)];
+	} slots[SHM_SLOTS];
+} shm_ring;
+
+typedef struct shm_end_t {
+	shm_ring* rings;            /* Two rings, end i reads ring i */
+	int side;
+	int owner;                  /* Created the object, removes it on close */
+	char name[NAME_MAX];
+} shm_end;
+
+#ifdef HAVE_FUTEX
+static void shm_futex_wait(_Atomic uint32_t* word, uint32_t value, int64_t timeout_ns) {
+	struct timespec ts;
+
+	ts.tv_sec = timeout_ns / 1000000000;
+	ts.tv_nsec = timeout_ns % 1000000000;
+	syscall(SYS_futex, word, FUTEX_WAIT, value, timeout_ns < INT64_MAX ? &ts : NULL, NULL, 0);
+}
+
+static ssize_t shm_sendto(void* ctx, const void* buf, size_t len, const struct sockaddr* to, socklen_t tolen) {
+	shm_end* end = ctx;
+	shm_ring* ring = &end->rings[1 - end->side];
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	(void)to;
+	(void)tolen;
+
+	/* A full ring drops the packet, like a full socket buffer */
+	if (len > sizeof(ring->slots[0].data) || tail - atomic_load_explicit(&ring->head, memory_order_acquire) == SHM_SLOTS) {
+		return len;
+	}
+	ring->slots[tail & (SHM_SLOTS - 1)].len = len;
+	memcpy(ring->slots[tail & (SHM_SLOTS - 1)].data, buf, len);
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+	atomic_fetch_add_explicit(&ring->wake, 1, memory_order_seq_cst);
+	if (atomic_load_explicit(&ring->waiters, memory_order_seq_cst) > 0) {
+		syscall(SYS_futex, &ring->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+	return len;
+}
+
+static int shm_wait_ns(void* ctx, int64_t* timeout_ns) {
+	shm_end* end = ctx;
+	shm_ring* ring = &end->rings[end->side];
+	int64_t deadline = *timeout_ns == INT64_MAX ? INT64_MAX : gbn_now_ns() + *timeout_ns;
+
+	while (1) {
+		uint32_t wake = atomic_load_explicit(&ring->wake, memory_order_seq_cst);
+
+		if (atomic_load_explicit(&ring->tail, memory_order_acquire) != atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+			*timeout_ns = deadline == INT64_MAX ? INT64_MAX : deadline - gbn_now_ns();
+			if (*timeout_ns < 0) {
+				*timeout_ns = 0;
+			}
+			return 1;
+		}
+
+		int64_t left = deadline == INT64_MAX ? INT64_MAX : deadline - gbn_now_ns();
+		if (left <= 0) {
+			*timeout_ns = 0;
+			return 0;
+		}
+
+		atomic_fetch_add_explicit(&ring->waiters, 1, memory_order_seq_cst);
+		if (atomic_load_explicit(&ring->tail, memory_order_acquire) == atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+			shm_futex_wait(&ring->wake, wake, left);
+		}
+		atomic_fetch_sub_explicit(&ring->waiters, 1, memory_order_seq_cst);
+	}
+}
+
+static ssize_t shm_recvfrom(void* ctx, void* buf, size_t len, struct sockaddr* from, socklen_t* fromlen) {
+	shm_end* end = ctx;
+	shm_ring* ring = &end->rings[end->side];
+	int64_t forever = INT64_MAX;
+
+	shm_wait_ns(ctx, &forever);
+
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t n = ring->slots[head & (SHM_SLOTS - 1)].len;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(buf, ring->slots[head & (SHM_SLOTS - 1)].data, n);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	fake_peer(from, fromlen, 1 - end->side);
+	return n;
+}
+
+static void shm_close(void* ctx) {
+	shm_end* end = ctx;
+
+	munmap(end->rings, 2 * sizeof(shm_ring));
+	if (end->owner) {
+		shm_unlink(end->name);
+	}
+	free(end);
+}
+#endif
+
+/* Connect to a same-host peer through the shared memory object name (e.g. "/gbn-test").
+ * One peer opens it with create set, the other without */
+int gbn_shm_open(const char* name, int create) {
+#ifdef HAVE_FUTEX
+	int fd = shm_open(name, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0600);
+	if (fd < 0) {
+		perror("shm_open");
+		return -1;
+	}
+	if (create && ftruncate(fd, 2 * sizeof(shm_ring)) < 0) {
+		perror("ftruncate");
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+
+	/* The object exists before the creating peer sizes it, mapping it then and touching the
+	 * rings would be a SIGBUS. Wait until it has its size */
+	struct stat st;
+	for (int waited = 0; ; waited++) {
+		if (fstat(fd, &st) < 0) {
+			perror("fstat");
+			close(fd);
+			return -1;
+		}
+		if ((size_t)st.st_size >= 2 * sizeof(shm_ring)) {
+			break;
+		}
+		if (waited == SHM_SIZE_WAIT) {
+			printf("%s was never sized by its creator\n", name);
+			close(fd);
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		struct timespec nap = { 0, 1000000 };
+		nanosleep(&nap, NULL);
+	}
+
+	void* rings = mmap(NULL, 2 * sizeof(shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (rings == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	shm_end* end = calloc(1, sizeof(*end));
+	if (end == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	end->rings = rings;
+	end->side = create ? 0 : 1;
+	end->owner = create;
+	snprintf(end->name, sizeof(end->name), "%s", name);
+
+	gbn_transport t = { "shm", shm_sendto, shm_recvfrom, shm_wait_ns, NULL, shm_close, end };
+	return gbn_transport_open(&t);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
@@ -0,0 +1,130 @@
+/* File: test_ack_delay.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Regression test for delayed ACKs. Sends a buffer over loopback UDP with
+ *              sender_gbn and checks that receiver_gbn acknowledged it without waiting out
+ *              the ACK delay timer: a sender with a full window waits for the ACK, so every
+ *              ACK the timer releases costs the transfer ACK_DELAY. One is allowed for the
+ *              end of the transfer and one for every retransmission timeout, maybe_sendto
+ *              loses packets on purpose. The protocol's messages go to a temporary file and
+ *              are counted there.
+ *
+ *              test_ack_delay [bytes]
+ *              Exits with 0 if the test passed.
+ *
+ *              Build: gcc -I.. -o test_ack_delay test_ack_delay.c ../GBN*.c -lpthread
+ */
+
+#include "../GBN.h"
+
+
+static int receiver_fd;
+static uint8_t* received;
+static size_t len;
+static ssize_t received_len;
+
+
+static void* receiver(void* arg) {
+	struct sockaddr_storage client;
+	socklen_t client_len = sizeof(client);
+
+	(void)arg;
+	memset(&client, 0, sizeof(client));
+	receiver_connection(receiver_fd, (struct sockaddr*)&client, &client_len);
+	received_len = receiver_gbn(receiver_fd, received, len, GBN_BYTES);
+	receiver_teardown(receiver_fd, (struct sockaddr*)&client, client_len);
+	return NULL;
+}
+
+static int udp_socket(struct sockaddr_in* address) {
+	socklen_t address_len = sizeof(*address);
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	memset(address, 0, sizeof(*address));
+	address->sin_family = AF_INET;
+	address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd < 0 || bind(fd, (struct sockaddr*)address, sizeof(*address)) < 0 ||
+		getsockname(fd, (struct sockaddr*)address, &address_len) < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+/* Lines of the captured output that contain text */
+static size_t count_lines(FILE* log, const char* text) {
+	char line[512];
+	size_t n = 0;
+
+	rewind(log);
+	while (fgets(line, sizeof(line), log) != NULL) {
+		if (strstr(line, text) != NULL) {
+			n++;
+		}
+	}
+	return n;
+}
+
+
+int main(int argc, char** argv) {
+	struct sockaddr_in sender_address;
+	struct sockaddr_in receiver_address;
+	pthread_t thread;
+
+	len = argc > 1 ? strtoul(argv[1], NULL, 10) : 400 * 1000;
+	uint8_t* sent = malloc(len);
+	received = calloc(len, 1);
+	if (sent == NULL || received == NULL) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < len; i++) {
+		sent[i] = (uint8_t)(i * 7 + i / 1000);
+	}
+
+	int sender_fd = udp_socket(&sender_address);
+	receiver_fd = udp_socket(&receiver_address);
+
+	/* Both ends print what they do, keep it to count the delayed ACKs */
+	FILE* log = tmpfile();
+	if (log == NULL) {
+		perror("tmpfile");
+		return EXIT_FAILURE;
+	}
+	fflush(stdout);
+	int saved_stdout = dup(STDOUT_FILENO);
+	dup2(fileno(log), STDOUT_FILENO);
+
+	if (pthread_create(&thread, NULL, receiver, NULL) != 0) {
+		perror("pthread_create");
+		return EXIT_FAILURE;
+	}
+	sender_connection(sender_fd, (struct sockaddr*)&receiver_address, sizeof(receiver_address));
+	int64_t start = gbn_now_ns();
+	ssize_t packets = sender_gbn(sender_fd, sent, len, GBN_BYTES);
+	int64_t elapsed = gbn_now_ns() - start;
+	sender_teardown(sender_fd, (struct sockaddr*)&receiver_address, sizeof(receiver_address));
+	pthread_join(thread, NULL);
+
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+
+	size_t acks = count_lines(log, "Successfully sent ACK!");
+	size_t expired = count_lines(log, "ACK delay expired");
+	size_t timeouts = count_lines(log, "TIMEOUT: DATA packet");
+	fclose(log);
+
+	printf("%zd packets, %zu ACKs, %zu released by the delay timer, %zu timeouts, %.3f s\n",
+		packets, acks, expired, timeouts, elapsed / 1e9);
+
+	if (packets < 0 || received_len != (ssize_t)len || memcmp(sent, received, len) != 0) {
+		printf("FAIL: the data did not arrive intact\n");
+		return EXIT_FAILURE;
+	}
+	if (expired > 1 + timeouts) {
+		printf("FAIL: ACKs were held for the delay timer while the sender waited for them\n");
+		return EXIT_FAILURE;
+	}
+	printf("PASS\n");
+	return EXIT_SUCCESS;
+}
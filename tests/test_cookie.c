@@ -0,0 +1,253 @@
+/* File: test_cookie.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Test of the handshake cookies. A handshake ACK must only be accepted with the
+ *              cookie of a SYNACK we made, for the address it was made for and within
+ *              COOKIE_LIFETIME seconds: a forged cookie, a changed parameter, another address,
+ *              a moved cookie time and a cookie past its lifetime are refused. A server given
+ *              many SYNs and refused ACKs must not open a connection before the valid ACK comes.
+ *              The server's messages go to a temporary file and are counted there. Waits out
+ *              the cookie lifetime, so it takes a little over COOKIE_LIFETIME seconds.
+ *
+ *              test_cookie
+ *              Exits with 0 if the test passed, a hang is ended by an alarm.
+ *
+ *              Build: gcc -I.. -o test_cookie test_cookie.c ../GBN*.c -lpthread
+ */
+
+#include "../GBN.h"
+
+
+static int failures;
+
+
+static void expect(int accepted, int want, const char* what) {
+	if (accepted != want) {
+		printf("FAIL: %s was %s\n", what, accepted ? "accepted" : "refused");
+		failures++;
+	}
+}
+
+static void loopback(struct sockaddr_in* address, int port) {
+	memset(address, 0, sizeof(*address));
+	address->sin_family = AF_INET;
+	address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address->sin_port = htons(port);
+}
+
+static int udp_socket(void) {
+	struct timeval timeout = { 1, 0 };
+	struct sockaddr_in address;
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	loopback(&address, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+/* A SYN as sender_connection sends it */
+static void make_syn(rtp* packet, uint8_t seq) {
+	memset(packet, 0, sizeof(*packet));
+	packet->flags = SYN;
+	packet->seq = seq;
+	packet->windowsize = windowSize;
+	packet->options = LOCAL_OPTIONS;
+	syn_params* params = (syn_params*)packet->data;
+	params->fec_k = FEC_K;
+	params->mss = BASE_MSS;
+	state.options = 0;
+	packet->checksum = checksum(packet);
+}
+
+/* The handshake ACK echoing synack, as sender_connection sends it */
+static void make_ack(rtp* packet, const rtp* synack) {
+	memset(packet, 0, sizeof(*packet));
+	packet->flags = ACK;
+	packet->seq = synack->seq + 1;
+	packet->options = synack->options & LOCAL_OPTIONS;
+	packet->windowsize = synack->windowsize;
+	packet->conn_id = ((const syn_params*)synack->data)->conn_id;
+	memcpy(packet->data, synack->data, sizeof(syn_params));
+	state.options = packet->options;
+	packet->checksum = checksum(packet);
+}
+
+/* A copy of ack with a change made by edit, checksummed again so only the cookie can refuse it */
+static int accept_changed(const rtp* ack, void (*edit)(rtp*), const struct sockaddr_in* peer) {
+	rtp packet;
+
+	memcpy(&packet, ack, sizeof(packet));
+	edit(&packet);
+	state.options = packet.options;
+	packet.checksum = checksum(&packet);
+	return accept_ack(&packet, (const struct sockaddr*)peer);
+}
+
+static void flip_cookie(rtp* packet) { ((syn_params*)packet->data)->cookie ^= 1; }
+static void bigger_window(rtp* packet) { packet->windowsize = 100; }
+static void other_conn_id(rtp* packet) { ((syn_params*)packet->data)->conn_id ^= 0x100; }
+static void more_fec(rtp* packet) { ((syn_params*)packet->data)->fec_k = FEC_MAX_K; }
+static void older_time(rtp* packet) { ((syn_params*)packet->data)->cookie_time -= COOKIE_LIFETIME + 1; }
+static void newer_time(rtp* packet) { ((syn_params*)packet->data)->cookie_time += 1000; }
+static void unchanged(rtp* packet) { (void)packet; }
+
+/* Lines of the captured output that contain text */
+static size_t count_lines(FILE* log, const char* text) {
+	char line[512];
+	size_t n = 0;
+
+	fflush(stdout);
+	rewind(log);
+	while (fgets(line, sizeof(line), log) != NULL) {
+		if (strstr(line, text) != NULL) {
+			n++;
+		}
+	}
+	fseek(log, 0, SEEK_END);
+	return n;
+}
+
+/* Send a SYN from fd to the server and receive its SYNACK */
+static int handshake_synack(int fd, const struct sockaddr_in* server, uint8_t seq, rtp* synack) {
+	rtp syn;
+
+	make_syn(&syn, seq);
+	sendto(fd, &syn, gbn_packet_size(&syn), 0, (const struct sockaddr*)server, sizeof(*server));
+	ssize_t n = recv(fd, synack, sizeof(*synack), 0);
+	state.options = 0;
+	return n > 0 && synack->flags == SYNACK && synack->checksum == checksum(synack);
+}
+
+/* Open connections of the server once what was sent to it has been handled */
+static size_t opened(FILE* log) {
+	usleep(100 * 1000);
+	return count_lines(log, "open (options");
+}
+
+
+int main(void) {
+	struct sockaddr_in peer;
+	struct sockaddr_in other_port;
+	struct sockaddr_in other_host;
+	rtp synack;
+	rtp ack;
+
+	alarm(120);
+
+	/* Cookies made and checked directly */
+	loopback(&peer, 4000);
+	loopback(&other_port, 4001);
+	loopback(&other_host, 4000);
+	other_host.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1);
+
+	make_syn(&synack, 42);
+	make_synack(&synack, (struct sockaddr*)&peer, LOCAL_OPTIONS, path_conn_id(0));
+	make_ack(&ack, &synack);
+
+	expect(accept_changed(&ack, unchanged, &peer), 1, "the ACK of our SYNACK");
+	expect(accept_changed(&ack, flip_cookie, &peer), 0, "a forged cookie");
+	expect(accept_changed(&ack, bigger_window, &peer), 0, "a bigger window than agreed");
+	expect(accept_changed(&ack, other_conn_id, &peer), 0, "another connection id");
+	expect(accept_changed(&ack, more_fec, &peer), 0, "another FEC group size");
+	expect(accept_changed(&ack, older_time, &peer), 0, "a cookie time moved back");
+	expect(accept_changed(&ack, newer_time, &peer), 0, "a cookie time in the future");
+	expect(accept_changed(&ack, unchanged, &other_port), 0, "the ACK from another port");
+	expect(accept_changed(&ack, unchanged, &other_host), 0, "the ACK from another address");
+
+	/* A server keeps nothing for SYNs or refused ACKs. Its messages are kept to count the
+	 * connections it opens */
+	fflush(stdout);
+	int saved_stdout = dup(STDOUT_FILENO);
+	FILE* log = tmpfile();
+	if (log == NULL) {
+		perror("tmpfile");
+		return EXIT_FAILURE;
+	}
+	dup2(fileno(log), STDOUT_FILENO);
+
+	int probe = udp_socket();
+	struct sockaddr_in server_address;
+	socklen_t address_len = sizeof(server_address);
+	getsockname(probe, (struct sockaddr*)&server_address, &address_len);
+	close(probe);
+
+	gbn_server_config config;
+	memset(&config, 0, sizeof(config));
+	config.port = ntohs(server_address.sin_port);
+	config.workers = 1;
+	gbn_server* server = gbn_server_start(&config);
+	loopback(&server_address, config.port);
+
+	int client = udp_socket();
+	int stranger = udp_socket();
+	int late = udp_socket();
+	rtp last;
+	rtp stale;
+	int answered = 0;
+	for (int i = 0; i < 50; i++) {
+		answered += handshake_synack(client, &server_address, (uint8_t)(10 + i), &last);
+	}
+	answered += handshake_synack(late, &server_address, 99, &stale);
+	size_t after_syns = opened(log);
+
+	rtp forged;
+	make_ack(&forged, &last);
+	((syn_params*)forged.data)->cookie ^= 1;
+	state.options = forged.options;
+	forged.checksum = checksum(&forged);
+	sendto(client, &forged, gbn_packet_size(&forged), 0, (struct sockaddr*)&server_address, sizeof(server_address));
+	size_t after_forged = opened(log);
+
+	make_ack(&ack, &last);
+	sendto(stranger, &ack, gbn_packet_size(&ack), 0, (struct sockaddr*)&server_address, sizeof(server_address));
+	size_t after_stranger = opened(log);
+
+	sendto(client, &ack, gbn_packet_size(&ack), 0, (struct sockaddr*)&server_address, sizeof(server_address));
+	size_t after_ack = opened(log);
+
+	/* A cookie that was good is refused once it is past its lifetime, by the server too */
+	sleep(COOKIE_LIFETIME + 1);
+	make_ack(&ack, &stale);
+	sendto(late, &ack, gbn_packet_size(&ack), 0, (struct sockaddr*)&server_address, sizeof(server_address));
+	size_t after_stale = opened(log);
+
+	make_ack(&ack, &synack);
+	int stale_direct = accept_changed(&ack, unchanged, &peer);
+
+	gbn_server_stop(server);
+	close(client);
+	close(stranger);
+	close(late);
+
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+	fclose(log);
+
+	printf("%d of 51 SYNs answered, connections open after the SYNs: %zu, a forged ACK: %zu, "
+		"the ACK from another port: %zu, the valid ACK: %zu, a stale ACK: %zu\n",
+		answered, after_syns, after_forged, after_stranger, after_ack, after_stale);
+
+	expect(stale_direct, 0, "a cookie past its lifetime");
+	if (answered != 51) {
+		printf("FAIL: the server did not answer every SYN\n");
+		failures++;
+	}
+	if (after_syns != 0 || after_forged != 0 || after_stranger != 0) {
+		printf("FAIL: the server opened a connection before the valid ACK\n");
+		failures++;
+	}
+	if (after_ack != 1 || after_stale != 1) {
+		printf("FAIL: the server did not open exactly one connection\n");
+		failures++;
+	}
+
+	if (failures > 0) {
+		return EXIT_FAILURE;
+	}
+	printf("PASS\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,192 @@
+/* File: test_fec.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Test of forward error correction over a simulated channel. The sender's end
+ *              first drops every fifth new DATA packet, more than one parity per group can
+ *              repair, so the sender must lower k. From then on it drops exactly one new DATA
+ *              packet of every parity group, the first member or the second by turns: each is
+ *              to be rebuilt by fec_next from the parity at the lowered k, instead of waiting
+ *              for a timeout. Retransmissions always get through. Both ends' messages go to a
+ *              temporary file and are counted there.
+ *
+ *              test_fec [loss]
+ *              Exits with 0 if the test passed, a hang is ended by an alarm.
+ *
+ *              Build: gcc -I.. -o test_fec test_fec.c ../GBN*.c -lpthread
+ */
+
+#include "../GBN.h"
+
+
+#define ADAPT_PACKETS 512   /* First transmissions of the first phase */
+#define ADAPT_EVERY 5       /* Of which every ADAPT_EVERY:th is dropped */
+
+static int fds[2];
+static uint8_t* received;
+static size_t len = 8 * 1000 * 1000;
+static ssize_t received_len;
+
+static gbn_transport channel;   /* The sender's end of the simulated channel */
+
+/* What the dropping end saw, only touched by the sender's thread */
+static uint8_t newest;          /* Highest DATA sequence number sent */
+static size_t firsts;           /* First transmissions */
+static int one_each;            /* Second phase, once k has been lowered */
+static int last_k;              /* Size of the last group */
+static int in_group;            /* First transmissions since the last PARITY */
+static int group_drops;         /* Of them dropped */
+static int groups;              /* Groups of the second phase */
+static int single_groups;       /* Of them, groups that lost exactly one member */
+static int small_groups;        /* Of them, groups smaller than FEC_K */
+
+
+/* The sender's sends. First every ADAPT_EVERY:th first transmission is dropped, more than
+ * one parity per FEC_K packets can repair, then one first transmission of each group */
+static ssize_t dropping_sendto(void* ctx, const void* buf, size_t n, const struct sockaddr* to, socklen_t tolen) {
+	const rtp* packet = buf;
+
+	if (packet->flags == PARITY) {
+		if (one_each) {
+			groups++;
+			single_groups += group_drops == 1;
+			small_groups += packet->options < FEC_K;
+		}
+		/* k is lowered once two groups in a row are smaller, one alone may be cut short */
+		if (!one_each && firsts >= ADAPT_PACKETS && packet->options < FEC_K && packet->options == last_k) {
+			one_each = 1;
+			printf("test_fec: one drop per group from here\n");
+		}
+		last_k = packet->options;
+		in_group = 0;
+		group_drops = 0;
+	}
+	else if (packet->flags == DATA && (firsts == 0 || (uint8_t)(packet->seq - newest - 1) < 128)) {
+		int member = in_group++;
+		newest = packet->seq;
+		firsts++;
+
+		if (one_each ? member == groups % 2 : firsts % ADAPT_EVERY == 0) {
+			group_drops++;
+			return n;
+		}
+	}
+	return channel.sendto(ctx, buf, n, to, tolen);
+}
+
+static void* receiver(void* arg) {
+	struct sockaddr_storage client;
+	socklen_t client_len = sizeof(client);
+
+	(void)arg;
+	memset(&client, 0, sizeof(client));
+	receiver_connection(fds[1], (struct sockaddr*)&client, &client_len);
+	received_len = receiver_gbn(fds[1], received, len, GBN_BYTES);
+	receiver_teardown(fds[1], (struct sockaddr*)&client, client_len);
+	gbn_transport_close(fds[1]);
+	return NULL;
+}
+
+/* Lines of the captured output that contain text, after the first line with from */
+static size_t count_lines(FILE* log, const char* text, const char* from) {
+	char line[512];
+	size_t n = 0;
+	int counting = from == NULL;
+
+	fflush(stdout);
+	rewind(log);
+	while (fgets(line, sizeof(line), log) != NULL) {
+		if (counting && strstr(line, text) != NULL) {
+			n++;
+		}
+		counting |= from != NULL && strstr(line, from) != NULL;
+	}
+	fseek(log, 0, SEEK_END);
+	return n;
+}
+
+
+int main(int argc, char** argv) {
+	struct sockaddr_in peer;
+	pthread_t thread;
+
+	double loss = argc > 1 ? atof(argv[1]) : 0;
+	uint8_t* sent = malloc(len);
+	received = calloc(len, 1);
+	if (sent == NULL || received == NULL) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < len; i++) {
+		sent[i] = (uint8_t)(i * 7 + i / 100);
+	}
+
+	/* Random loss on the channel only if asked for, LOSS_PROB of maybe_sendto comes on top */
+	alarm(120);
+	if (gbn_sim_pair(fds, loss, 20 * 1000000LL) < 0) {
+		perror("gbn_sim_pair");
+		return EXIT_FAILURE;
+	}
+	channel = *gbn_transport_get(fds[0]);
+	gbn_transport dropping = channel;
+	dropping.sendto = dropping_sendto;
+	dropping.close = NULL;
+	int sender_fd = gbn_transport_open(&dropping);
+
+	/* Both ends print what they do, keep it to count the rebuilt packets */
+	FILE* log = tmpfile();
+	if (log == NULL) {
+		perror("tmpfile");
+		return EXIT_FAILURE;
+	}
+	fflush(stdout);
+	int saved_stdout = dup(STDOUT_FILENO);
+	dup2(fileno(log), STDOUT_FILENO);
+
+	if (pthread_create(&thread, NULL, receiver, NULL) != 0) {
+		perror("pthread_create");
+		return EXIT_FAILURE;
+	}
+	memset(&peer, 0, sizeof(peer));
+	peer.sin_family = AF_INET;
+	sender_connection(sender_fd, (struct sockaddr*)&peer, sizeof(peer));
+	int fec_k = state.fec_k;
+	ssize_t packets = sender_gbn(sender_fd, sent, len, GBN_BYTES);
+	sender_teardown(sender_fd, (struct sockaddr*)&peer, sizeof(peer));
+	gbn_transport_close(sender_fd);
+	gbn_transport_close(fds[0]);
+	pthread_join(thread, NULL);
+
+	size_t lowered = count_lines(log, "k lowered", NULL);
+	size_t raised = count_lines(log, "k raised", NULL);
+	size_t rebuilt = count_lines(log, "FEC: rebuilt DATA packet", "test_fec: one drop");
+	size_t timeouts = count_lines(log, "TIMEOUT: DATA packet", "test_fec: one drop");
+
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+	fclose(log);
+
+	printf("%zd packets, k %d lowered %zu times and raised %zu; one drop per group: %d groups, "
+		"%d smaller than %d, %d lost one member, %zu rebuilt, %zu timeouts\n",
+		packets, fec_k, lowered, raised, groups, small_groups, FEC_K, single_groups, rebuilt, timeouts);
+
+	if (packets < 0 || received_len != (ssize_t)len || memcmp(sent, received, len) != 0) {
+		printf("FAIL: the data did not arrive intact\n");
+		return EXIT_FAILURE;
+	}
+	if (fec_k != FEC_K) {
+		printf("FAIL: FEC was not negotiated\n");
+		return EXIT_FAILURE;
+	}
+	if (lowered == 0 || groups == 0 || small_groups != groups) {
+		printf("FAIL: the loss did not lower k\n");
+		return EXIT_FAILURE;
+	}
+	/* LOSS_PROB of maybe_sendto takes a second member or the parity of a few groups, those
+	 * wait for a timeout. The rest must be rebuilt */
+	if (rebuilt < (size_t)single_groups * 3 / 4 || timeouts > (size_t)groups / 4) {
+		printf("FAIL: groups that lost one member were not rebuilt\n");
+		return EXIT_FAILURE;
+	}
+	printf("PASS\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+/* File: test_lz.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Test of the LZ payload codec. Segments of different kinds must come back
+ *              unchanged from compress and decompress, random bytes must be left uncompressed,
+ *              and a truncated or malformed input must be refused without writing past the
+ *              output buffer. The buffer is followed by guard bytes that have to stay as they
+ *              were.
+ *
+ *              test_lz [seed]
+ *              Exits with 0 if the test passed.
+ *
+ *              Build: gcc -I.. -o test_lz test_lz.c ../GBN*.c -lpthread
+ */
+
+#include "../GBN.h"
+
+
+#define GUARD 64        /* Bytes after the output buffer that must not change */
+#define GUARD_BYTE 0xa5
+
+static const gbn_codec* codec;
+static int failures;
+
+
+static void fail(const char* what, const char* name) {
+	printf("FAIL: %s (%s)\n", what, name);
+	failures++;
+}
+
+/* Decompress into exactly cap bytes, -2 if the guard bytes behind them were written */
+static ssize_t decompress_guarded(const uint8_t* src, size_t len, uint8_t* out, size_t cap) {
+	memset(out + cap, GUARD_BYTE, GUARD);
+	ssize_t n = codec->decompress(src, len, out, cap);
+
+	for (size_t i = 0; i < GUARD; i++) {
+		if (out[cap + i] != GUARD_BYTE) {
+			return -2;
+		}
+	}
+	return n;
+}
+
+/* Compress and decompress one segment, it must shrink and come back unchanged */
+static void round_trip(const char* name, const uint8_t* seg, size_t n) {
+	uint8_t packed[MAXMSG];
+	uint8_t unpacked[MAXMSG + GUARD];
+
+	size_t c = codec->compress(seg, n, packed, sizeof(packed));
+	if (c == 0 || c >= n) {
+		fail("segment did not shrink", name);
+		return;
+	}
+	ssize_t d = decompress_guarded(packed, c, unpacked, n);
+	if (d != (ssize_t)n || memcmp(unpacked, seg, n) != 0) {
+		fail("segment did not round trip", name);
+		return;
+	}
+
+	/* One byte short of room is refused */
+	d = decompress_guarded(packed, c, unpacked, n - 1);
+	if (d != -1) {
+		fail("output bigger than the buffer was not refused", name);
+	}
+
+	/* Every cut of the compressed input: refused, or less than the whole segment */
+	for (size_t cut = 0; cut < c; cut++) {
+		d = decompress_guarded(packed, cut, unpacked, n);
+		if (d == -2 || d >= (ssize_t)n) {
+			fail("truncated input was taken as the whole segment", name);
+			return;
+		}
+	}
+}
+
+/* A hand-written input that must be refused */
+static void malformed(const char* name, const uint8_t* src, size_t len, size_t cap) {
+	uint8_t out[MAXMSG + GUARD];
+
+	if (decompress_guarded(src, len, out, cap) != -1) {
+		fail("malformed input was not refused", name);
+	}
+}
+
+
+int main(int argc, char** argv) {
+	uint8_t seg[MAXMSG];
+	uint8_t packed[MAXMSG];
+	unsigned int seed = argc > 1 ? (unsigned int)strtoul(argv[1], NULL, 10) : 1;
+
+	codec = gbn_codec_get(OPT_LZ);
+	if (codec == NULL) {
+		printf("FAIL: no codec for OPT_LZ\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Text like data, short matches between literals */
+	for (size_t i = 0; i < BASE_MSS; i++) {
+		seg[i] = "go back n over udp, "[i % 20] + (i / 97 % 3);
+	}
+	round_trip("text", seg, BASE_MSS);
+
+	/* One long run, a match length that needs several 255 bytes */
+	memset(seg, 'x', MAXMSG);
+	round_trip("run", seg, MAXMSG);
+
+	/* Random literals longer than 15 before each repeat, literal counts past 255 */
+	for (size_t i = 0; i < BASE_MSS; i++) {
+		seg[i] = (i % 600) < 300 ? (uint8_t)rand_r(&seed) : seg[i - 300];
+	}
+	round_trip("literals", seg, BASE_MSS);
+
+	/* Matches that overlap what they produce, offset 1 to 3 */
+	for (size_t i = 0; i < 200; i++) {
+		seg[i] = (uint8_t)(i / 50 == 1 ? 'a' : i % 3);
+	}
+	round_trip("overlap", seg, 200);
+
+	/* Random bytes do not shrink and are sent as they are */
+	for (size_t i = 0; i < BASE_MSS; i++) {
+		seg[i] = (uint8_t)rand_r(&seed);
+	}
+	if (codec->compress(seg, BASE_MSS, packed, sizeof(packed)) != 0) {
+		fail("random bytes were compressed", "random");
+	}
+	if (codec->compress(seg, 4, packed, sizeof(packed)) != 0) {
+		fail("a segment no longer than a match was compressed", "short");
+	}
+
+	/* Malformed sequences: token, literals, offset low and high byte */
+	const uint8_t zero_offset[] = { 0x10, 'a', 0x00, 0x00 };
+	malformed("offset 0", zero_offset, sizeof(zero_offset), 64);
+	const uint8_t far_offset[] = { 0x10, 'a', 0x02, 0x00 };
+	malformed("offset before the start", far_offset, sizeof(far_offset), 64);
+	const uint8_t short_literals[] = { 0x50, 'a', 'b' };
+	malformed("literals past the end", short_literals, sizeof(short_literals), 64);
+	const uint8_t open_length[] = { 0xf0, 255, 255 };
+	malformed("literal count without an end", open_length, sizeof(open_length), 64);
+	const uint8_t long_match[] = { 0x1f, 'a', 0x01, 0x00, 255, 255, 255 };
+	malformed("match length without an end", long_match, sizeof(long_match), 64);
+	const uint8_t too_long[] = { 0x1f, 'a', 0x01, 0x00, 100, 0x00 };
+	malformed("match longer than the buffer", too_long, sizeof(too_long), 64);
+	const uint8_t no_last[] = { 0x10, 'a', 0x01, 0x00 };
+	malformed("no literal sequence at the end", no_last, sizeof(no_last), 64);
+	const uint8_t half_offset[] = { 0x10, 'a', 0x01 };
+	malformed("offset cut in half", half_offset, sizeof(half_offset), 64);
+
+	/* Random garbage may decode to anything, but never past the buffer */
+	for (int round = 0; round < 10000; round++) {
+		uint8_t out[256 + GUARD];
+		size_t len = rand_r(&seed) % 64;
+
+		for (size_t i = 0; i < len; i++) {
+			seg[i] = (uint8_t)rand_r(&seed);
+		}
+		ssize_t d = decompress_guarded(seg, len, out, 256);
+		if (d == -2 || d > 256) {
+			fail("garbage was written past the buffer", "garbage");
+			break;
+		}
+	}
+
+	if (failures > 0) {
+		return EXIT_FAILURE;
+	}
+	printf("PASS\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+/* File: test_pmtu_blackhole.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Regression test for a path MTU black hole. A buffer is sent over a simulated
+ *              channel whose sender side, once the segment size has been raised by probing,
+ *              stops passing packets bigger than BASE_MSS. The segments already cut at the big
+ *              size can then never arrive: sender_gbn must fall back to BASE_MSS, cut them
+ *              again from the packet the receiver expects and still deliver the data intact.
+ *              Random loss on top makes some of the receiver's ACKs go missing, so it is at
+ *              times further on than the sender knows. With "pipelined" it is sender_gbn with
+ *              GBN_PIPELINE, whose segments wait built in slots and must be built again.
+ *
+ *              test_pmtu_blackhole [loss] [big packets before the hole] [pipelined]
+ *              Exits with 0 if the test passed, a hang is ended by an alarm.
+ *
+ *              Build: gcc -I.. -o test_pmtu_blackhole test_pmtu_blackhole.c ../GBN*.c -lpthread
+ */
+
+#include "../GBN.h"
+
+
+static int fds[2];
+static uint8_t* received;
+static size_t len = 600 * 1000;
+static ssize_t received_len;
+
+static gbn_transport channel;   /* The sender's end of the simulated channel */
+static int big_packets;         /* Passed before the path shrinks */
+
+
+/* The sender's sends: DATA and probes bigger than BASE_MSS stop getting through */
+static ssize_t shrinking_sendto(void* ctx, const void* buf, size_t n, const struct sockaddr* to, socklen_t tolen) {
+	if (n > offsetof(rtp, data) + BASE_MSS && big_packets-- <= 0) {
+		return n;
+	}
+	return channel.sendto(ctx, buf, n, to, tolen);
+}
+
+static void* receiver(void* arg) {
+	struct sockaddr_storage client;
+	socklen_t client_len = sizeof(client);
+
+	(void)arg;
+	memset(&client, 0, sizeof(client));
+	receiver_connection(fds[1], (struct sockaddr*)&client, &client_len);
+	received_len = receiver_gbn(fds[1], received, len, GBN_BYTES);
+	receiver_teardown(fds[1], (struct sockaddr*)&client, client_len);
+	gbn_transport_close(fds[1]);
+	return NULL;
+}
+
+
+int main(int argc, char** argv) {
+	struct sockaddr_in peer;
+	pthread_t thread;
+
+	double loss = argc > 1 ? atof(argv[1]) : 0.1;
+	big_packets = argc > 2 ? atoi(argv[2]) : 20;
+	int flags = GBN_BYTES | (argc > 3 && strcmp(argv[3], "pipelined") == 0 ? GBN_PIPELINE : 0);
+
+	uint8_t* sent = malloc(len);
+	received = calloc(len, 1);
+	if (sent == NULL || received == NULL) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < len; i++) {
+		sent[i] = (uint8_t)(i * 7 + i / 100);
+	}
+
+	/* Virtual time, the timeouts cost nothing. A sender stuck on segments that can not
+	 * get through waits for ever */
+	alarm(120);
+	if (gbn_sim_pair(fds, loss, 20 * 1000000LL) < 0) {
+		perror("gbn_sim_pair");
+		return EXIT_FAILURE;
+	}
+	channel = *gbn_transport_get(fds[0]);
+	gbn_transport shrinking = channel;
+	shrinking.sendto = shrinking_sendto;
+	shrinking.close = NULL;
+	int sender_fd = gbn_transport_open(&shrinking);
+
+	/* The protocol's messages are not what is tested */
+	fflush(stdout);
+	int saved_stdout = dup(STDOUT_FILENO);
+	if (freopen("/dev/null", "w", stdout) == NULL) {
+		perror("freopen");
+		return EXIT_FAILURE;
+	}
+
+	if (pthread_create(&thread, NULL, receiver, NULL) != 0) {
+		perror("pthread_create");
+		return EXIT_FAILURE;
+	}
+	memset(&peer, 0, sizeof(peer));
+	peer.sin_family = AF_INET;
+	sender_connection(sender_fd, (struct sockaddr*)&peer, sizeof(peer));
+	ssize_t packets = sender_gbn(sender_fd, sent, len, flags);
+	int mss = state.mss;
+	sender_teardown(sender_fd, (struct sockaddr*)&peer, sizeof(peer));
+	gbn_transport_close(sender_fd);
+	gbn_transport_close(fds[0]);
+	pthread_join(thread, NULL);
+
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+
+	printf("%zd packets, segment size %d at the end\n", packets, mss);
+
+	if (packets < 0 || received_len != (ssize_t)len || memcmp(sent, received, len) != 0) {
+		printf("FAIL: the data did not arrive intact\n");
+		return EXIT_FAILURE;
+	}
+	if (mss > BASE_MSS) {
+		printf("FAIL: the segment size was not lowered\n");
+		return EXIT_FAILURE;
+	}
+	printf("PASS\n");
+	return EXIT_SUCCESS;
+}
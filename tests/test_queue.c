@@ -0,0 +1,228 @@
+/* File: test_queue.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Test of the asynchronous send queue over a simulated channel with loss. More
+ *              writes than QUEUE_WRITES are queued with gbn_write_async, so some must fail with
+ *              EAGAIN until earlier ones are done. Every write must be reported to the callback
+ *              once, in the order it was queued and with where it starts in the byte stream, and
+ *              the eventfd must count all of them. The data must arrive intact. On a second
+ *              connection the receiver goes away: the queue gives up, a later write fails with
+ *              EPIPE, gbn_queue_close returns -1 and the write that was never acknowledged is
+ *              never reported.
+ *
+ *              test_queue [loss] [writes]
+ *              Exits with 0 if the test passed, a hang is ended by an alarm.
+ *
+ *              Build: gcc -I.. -o test_queue test_queue.c ../GBN*.c -lpthread
+ */
+
+#include "../GBN.h"
+#include <poll.h>
+
+
+static int fds[2];
+static uint8_t* sent;
+static uint8_t* received;
+static size_t len;
+static ssize_t received_len;
+
+/* Writes reported done, by the queue's sender thread */
+static const void** done_buf;
+static uint64_t* done_offset;
+static size_t* done_len;
+static size_t ndone;
+
+
+static void on_done(void* arg, const void* buf, uint64_t offset, size_t n) {
+	(void)arg;
+	done_buf[ndone] = buf;
+	done_offset[ndone] = offset;
+	done_len[ndone] = n;
+	ndone++;
+}
+
+static void* receiver(void* arg) {
+	struct sockaddr_storage client;
+	socklen_t client_len = sizeof(client);
+
+	(void)arg;
+	memset(&client, 0, sizeof(client));
+	receiver_connection(fds[1], (struct sockaddr*)&client, &client_len);
+	received_len = receiver_gbn(fds[1], received, len, GBN_BYTES);
+	receiver_teardown(fds[1], (struct sockaddr*)&client, client_len);
+	gbn_transport_close(fds[1]);
+	return NULL;
+}
+
+/* Accepts the connection and goes away */
+static void* vanishing_receiver(void* arg) {
+	struct sockaddr_storage client;
+	socklen_t client_len = sizeof(client);
+
+	(void)arg;
+	memset(&client, 0, sizeof(client));
+	receiver_connection(fds[1], (struct sockaddr*)&client, &client_len);
+	gbn_transport_close(fds[1]);
+	return NULL;
+}
+
+/* Writes counted on the queue's descriptor since the last read, waits up to wait_ms for one */
+static uint64_t read_done(gbn_queue* queue, int wait_ms) {
+	struct pollfd p = { gbn_queue_fd(queue), POLLIN, 0 };
+	uint64_t n = 0;
+
+	if (poll(&p, 1, wait_ms) == 1 && read(p.fd, &n, sizeof(n)) != sizeof(n)) {
+		n = 0;
+	}
+	return n;
+}
+
+/* Size of write i, different every time */
+static size_t write_size(size_t i) {
+	return 100 + (i * 977) % 1500;
+}
+
+
+int main(int argc, char** argv) {
+	struct sockaddr_in peer;
+	pthread_t thread;
+
+	double loss = argc > 1 ? atof(argv[1]) : 0.05;
+	size_t writes = argc > 2 ? strtoul(argv[2], NULL, 10) : QUEUE_WRITES + 500;
+
+	len = 0;
+	for (size_t i = 0; i < writes; i++) {
+		len += write_size(i);
+	}
+	sent = malloc(len);
+	received = calloc(len, 1);
+	done_buf = calloc(writes + 1, sizeof(*done_buf));
+	done_offset = calloc(writes + 1, sizeof(*done_offset));
+	done_len = calloc(writes + 1, sizeof(*done_len));
+	if (sent == NULL || received == NULL || done_buf == NULL || done_offset == NULL || done_len == NULL) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < len; i++) {
+		sent[i] = (uint8_t)(i * 7 + i / 100);
+	}
+
+	alarm(120);
+	if (gbn_sim_pair(fds, loss, 20 * 1000000LL) < 0) {
+		perror("gbn_sim_pair");
+		return EXIT_FAILURE;
+	}
+
+	/* The protocol's messages are not what is tested */
+	fflush(stdout);
+	int saved_stdout = dup(STDOUT_FILENO);
+	if (freopen("/dev/null", "w", stdout) == NULL) {
+		perror("freopen");
+		return EXIT_FAILURE;
+	}
+
+	if (pthread_create(&thread, NULL, receiver, NULL) != 0) {
+		perror("pthread_create");
+		return EXIT_FAILURE;
+	}
+	memset(&peer, 0, sizeof(peer));
+	peer.sin_family = AF_INET;
+	sender_connection(fds[0], (struct sockaddr*)&peer, sizeof(peer));
+	gbn_queue* queue = gbn_queue_open(fds[0], on_done, NULL);
+	if (queue == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	/* Queue everything, a full queue is waited out on its descriptor */
+	size_t offset = 0;
+	size_t again = 0;
+	int bad_offset = 0;
+	uint64_t counted = 0;
+	for (size_t i = 0; i < writes; ) {
+		size_t n = write_size(i);
+		int64_t at = gbn_write_async(queue, sent + offset, n);
+
+		if (at < 0) {
+			if (errno != EAGAIN) {
+				perror("gbn_write_async");
+				break;
+			}
+			again++;
+			counted += read_done(queue, 10);
+			continue;
+		}
+		bad_offset |= (size_t)at != offset;
+		offset += n;
+		i++;
+	}
+	while (counted < writes) {
+		counted += read_done(queue, 100);
+	}
+	int closed = gbn_queue_close(queue);
+	sender_teardown(fds[0], (struct sockaddr*)&peer, sizeof(peer));
+	gbn_transport_close(fds[0]);
+	pthread_join(thread, NULL);
+
+	/* Reported once each, in order, where they start */
+	size_t reported = ndone;
+	int in_order = reported == writes;
+	offset = 0;
+	for (size_t i = 0; in_order && i < reported; i++) {
+		in_order = done_offset[i] == offset && done_len[i] == write_size(i) && done_buf[i] == sent + offset;
+		offset += done_len[i];
+	}
+
+	/* A connection whose receiver is gone */
+	ndone = 0;
+	if (gbn_sim_pair(fds, 0, 20 * 1000000LL) < 0) {
+		perror("gbn_sim_pair");
+		return EXIT_FAILURE;
+	}
+	if (pthread_create(&thread, NULL, vanishing_receiver, NULL) != 0) {
+		perror("pthread_create");
+		return EXIT_FAILURE;
+	}
+	sender_connection(fds[0], (struct sockaddr*)&peer, sizeof(peer));
+	queue = gbn_queue_open(fds[0], on_done, NULL);
+	if (queue == NULL) {
+		return EXIT_FAILURE;
+	}
+	int64_t first = gbn_write_async(queue, sent, 1000);
+	while (gbn_write_async(queue, sent, 1000) >= 0 || errno != EPIPE) {
+		usleep(1000);
+	}
+	int given_up = gbn_queue_close(queue);
+	gbn_transport_close(fds[0]);
+	pthread_join(thread, NULL);
+
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+
+	printf("%zu writes, %zu EAGAIN, %zu reported, %llu counted, close %d; "
+		"without a receiver: first write %lld, close %d, %zu reported\n",
+		writes, again, reported, (unsigned long long)counted, closed,
+		(long long)first, given_up, ndone);
+
+	if (received_len != (ssize_t)len || memcmp(sent, received, len) != 0) {
+		printf("FAIL: the data did not arrive intact\n");
+		return EXIT_FAILURE;
+	}
+	if (bad_offset || !in_order) {
+		printf("FAIL: writes were not reported once each, in order, where they start\n");
+		return EXIT_FAILURE;
+	}
+	if (counted != writes || closed != 0) {
+		printf("FAIL: the descriptor did not count every write\n");
+		return EXIT_FAILURE;
+	}
+	if (writes > QUEUE_WRITES && again == 0) {
+		printf("FAIL: more than QUEUE_WRITES writes were queued without EAGAIN\n");
+		return EXIT_FAILURE;
+	}
+	if (first != 0 || given_up != -1 || ndone != 0) {
+		printf("FAIL: a queue without a receiver did not fail its writes\n");
+		return EXIT_FAILURE;
+	}
+	printf("PASS\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,326 @@
+/* File: test_server.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Loopback test of server mode, two workers on one port. Two clients send a
+ *              buffer each with sender_gbn at the same time, both must arrive intact through
+ *              on_data and be closed by their FIN. Other connections are driven packet by
+ *              packet: one sends a FIN and leaves the FINACK unanswered, which the server must
+ *              send again; one stays silent and must be dropped as idle by the timer wheel; and
+ *              one is reached from new ports, whose packets the BPF program must steer to the
+ *              worker in the top byte of the connection id, which challenges the new address.
+ *              The server's messages go to a temporary file and are counted there. Waits out
+ *              SERVER_IDLE, so it takes a little over SERVER_IDLE seconds.
+ *
+ *              test_server [bytes]
+ *              Exits with 0 if the test passed, a hang is ended by an alarm.
+ *
+ *              Build: gcc -I.. -o test_server test_server.c ../GBN*.c -lpthread
+ */
+
+#include "../GBN.h"
+
+
+#define CLIENTS 2
+#define NEW_PORTS 8     /* Ports the moving connection is reached from */
+
+/* A transfer the server finished, on_data appends to it */
+typedef struct transfer_t {
+	uint8_t* data;
+	size_t len;
+} transfer;
+
+/* A connection of a raw client, driven packet by packet */
+typedef struct raw_conn_t {
+	int fd;
+	uint32_t id;
+	int options;
+} raw_conn;
+
+static size_t len;
+static struct sockaddr_in server_address;
+static uint8_t* sent[CLIENTS];
+static ssize_t packets[CLIENTS];
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static transfer* done[16];      /* Closed connections that received data */
+static int ndone;
+
+
+/* Called by the owning worker, a connection's buffer is only touched by it */
+static void on_data(gbn_conn* conn, const void* data, size_t n) {
+	transfer* t = conn->user;
+
+	if (t == NULL) {
+		t = conn->user = calloc(1, sizeof(*t));
+		if (t == NULL || (t->data = malloc(len)) == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (t->len + n <= len) {
+		memcpy(t->data + t->len, data, n);
+	}
+	t->len += n;
+}
+
+static void on_close(gbn_conn* conn) {
+	if (conn->user == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&done_lock);
+	if (ndone < (int)(sizeof(done) / sizeof(done[0]))) {
+		done[ndone++] = conn->user;
+	}
+	pthread_mutex_unlock(&done_lock);
+}
+
+static int udp_socket(void) {
+	struct timeval timeout = { 0, 200 * 1000 };
+	struct sockaddr_in address;
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd < 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static void* client(void* arg) {
+	int i = (int)(intptr_t)arg;
+	int fd = udp_socket();
+
+	sender_connection(fd, (struct sockaddr*)&server_address, sizeof(server_address));
+	packets[i] = sender_gbn(fd, sent[i], len, GBN_BYTES);
+	sender_teardown(fd, (struct sockaddr*)&server_address, sizeof(server_address));
+	close(fd);
+	return NULL;
+}
+
+
+/* Send a packet of the raw connection, checksummed with its options */
+static void raw_send(const raw_conn* c, int fd, int flags, uint8_t seq) {
+	rtp packet;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.flags = flags;
+	packet.seq = seq;
+	packet.conn_id = c->id;
+	state.options = c->options;
+	packet.checksum = checksum(&packet);
+	sendto(fd, &packet, gbn_packet_size(&packet), 0, (struct sockaddr*)&server_address, sizeof(server_address));
+}
+
+/* 1 if a packet with flags comes to fd within seconds */
+static int raw_wait(const raw_conn* c, int fd, int flags, double seconds) {
+	int64_t deadline = gbn_now_ns() + (int64_t)(seconds * 1e9);
+	rtp packet;
+
+	while (gbn_now_ns() < deadline) {
+		if (recv(fd, &packet, sizeof(packet), 0) > 0 && packet.flags == flags) {
+			state.options = c->options;
+			return packet.checksum == checksum(&packet);
+		}
+	}
+	return 0;
+}
+
+/* Handshake of sender_connection, SYN, SYNACK and the ACK echoing it. 0 if unanswered */
+static int raw_connect(raw_conn* c, uint8_t seq) {
+	rtp packet;
+
+	c->fd = udp_socket();
+	memset(&packet, 0, sizeof(packet));
+	packet.flags = SYN;
+	packet.seq = seq;
+	packet.windowsize = windowSize;
+	packet.options = LOCAL_OPTIONS;
+	((syn_params*)packet.data)->mss = BASE_MSS;
+	state.options = 0;
+	packet.checksum = checksum(&packet);
+	sendto(c->fd, &packet, gbn_packet_size(&packet), 0, (struct sockaddr*)&server_address, sizeof(server_address));
+
+	if (recv(c->fd, &packet, sizeof(packet), 0) <= 0 || packet.flags != SYNACK || packet.checksum != checksum(&packet)) {
+		return 0;
+	}
+	c->options = packet.options & LOCAL_OPTIONS;
+	c->id = ((syn_params*)packet.data)->conn_id;
+
+	packet.flags = ACK;
+	packet.seq++;
+	packet.options = c->options;
+	packet.conn_id = c->id;
+	state.options = c->options;
+	packet.checksum = checksum(&packet);
+	sendto(c->fd, &packet, gbn_packet_size(&packet), 0, (struct sockaddr*)&server_address, sizeof(server_address));
+	return 1;
+}
+
+/* Lines of the captured output that contain text */
+static size_t count_lines(FILE* log, const char* text) {
+	char line[512];
+	size_t n = 0;
+
+	fflush(stdout);
+	rewind(log);
+	while (fgets(line, sizeof(line), log) != NULL) {
+		if (strstr(line, text) != NULL) {
+			n++;
+		}
+	}
+	fseek(log, 0, SEEK_END);
+	return n;
+}
+
+
+int main(int argc, char** argv) {
+	pthread_t threads[CLIENTS];
+	char text[64];
+
+	len = argc > 1 ? strtoul(argv[1], NULL, 10) : 200 * 1000;
+	for (int i = 0; i < CLIENTS; i++) {
+		sent[i] = malloc(len);
+		if (sent[i] == NULL) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
+		for (size_t j = 0; j < len; j++) {
+			sent[i][j] = (uint8_t)(j * (7 + 2 * i) + j / 1000 + i);
+		}
+	}
+
+	/* The idle connection alone takes SERVER_IDLE */
+	alarm(SERVER_IDLE + 90);
+
+	/* Both ends print what they do, keep it to count what the server did */
+	FILE* log = tmpfile();
+	if (log == NULL) {
+		perror("tmpfile");
+		return EXIT_FAILURE;
+	}
+	fflush(stdout);
+	int saved_stdout = dup(STDOUT_FILENO);
+	dup2(fileno(log), STDOUT_FILENO);
+
+	/* A free port */
+	int probe = udp_socket();
+	socklen_t address_len = sizeof(server_address);
+	getsockname(probe, (struct sockaddr*)&server_address, &address_len);
+	close(probe);
+
+	gbn_server_config config;
+	memset(&config, 0, sizeof(config));
+	config.port = ntohs(server_address.sin_port);
+	config.workers = 2;
+	config.on_data = on_data;
+	config.on_close = on_close;
+	gbn_server* server = gbn_server_start(&config);
+
+	/* The idle one first, it has the longest to wait */
+	raw_conn idle;
+	int idle_open = raw_connect(&idle, 20);
+	int64_t idle_since = gbn_now_ns();
+
+	/* Two transfers at once */
+	for (int i = 0; i < CLIENTS; i++) {
+		if (pthread_create(&threads[i], NULL, client, (void*)(intptr_t)i) != 0) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+	for (int i = 0; i < CLIENTS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	/* A FIN whose FINACK is not answered gets it again, the server waits 5 s for the ACK */
+	raw_conn closing;
+	int closing_open = raw_connect(&closing, 30);
+	usleep(100 * 1000);
+	raw_send(&closing, closing.fd, FIN, 31);
+	int finack = raw_wait(&closing, closing.fd, FINACK, 1);
+	int finack_again = raw_wait(&closing, closing.fd, FINACK, 5 + 2);
+	raw_send(&closing, closing.fd, ACK, 32);
+
+	/* Packets with the id from new ports go to the owning worker, which challenges them */
+	raw_conn moving;
+	int moving_open = raw_connect(&moving, 40);
+	usleep(100 * 1000);
+	int challenged = 0;
+	for (int i = 0; i < NEW_PORTS; i++) {
+		int fd = udp_socket();
+		raw_send(&moving, fd, KEEPALIVE, 41);
+		challenged += raw_wait(&moving, fd, CHALLENGE, 1);
+		close(fd);
+	}
+
+	/* The idle connection is dropped by the timer wheel */
+	snprintf(text, sizeof(text), "connection %08x closed, idle", idle.id);
+	while (count_lines(log, text) == 0 && gbn_now_ns() - idle_since < (SERVER_IDLE + 5) * 1000000000LL) {
+		sleep(1);
+	}
+	double idle_after = (gbn_now_ns() - idle_since) / 1e9;
+	size_t idle_closed = count_lines(log, text);
+
+	snprintf(text, sizeof(text), "connection %08x closed, finished", closing.id);
+	size_t closing_closed = count_lines(log, text);
+	size_t finished = count_lines(log, "closed, finished");
+
+	gbn_server_stop(server);
+	close(idle.fd);
+	close(closing.fd);
+	close(moving.fd);
+
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+	fclose(log);
+
+	int failures = 0;
+	int intact = 0;
+	for (int i = 0; i < CLIENTS; i++) {
+		for (int j = 0; j < ndone; j++) {
+			if (done[j]->len == len && memcmp(done[j]->data, sent[i], len) == 0) {
+				intact++;
+				break;
+			}
+		}
+	}
+	printf("%d of %d transfers intact, %zu closed by FIN, FINACK %d then again %d, "
+		"%d of %d new ports challenged by worker %u, idle closed %zu after %.1f s\n",
+		intact, CLIENTS, finished, finack, finack_again, challenged, NEW_PORTS, moving.id >> 24,
+		idle_closed, idle_after);
+
+	if (!idle_open || !closing_open || !moving_open) {
+		printf("FAIL: a handshake was not answered\n");
+		failures++;
+	}
+	if (intact != CLIENTS || packets[0] < 0 || packets[1] < 0) {
+		printf("FAIL: the data did not arrive intact\n");
+		failures++;
+	}
+	if (finished != CLIENTS + 1 || closing_closed != 1) {
+		printf("FAIL: a connection was not closed by its FIN\n");
+		failures++;
+	}
+	if (!finack || !finack_again) {
+		printf("FAIL: the unanswered FINACK was not sent again\n");
+		failures++;
+	}
+	if (challenged != NEW_PORTS) {
+		printf("FAIL: packets from a new port did not reach the owning worker\n");
+		failures++;
+	}
+	if (idle_closed != 1 || idle_after < SERVER_IDLE) {
+		printf("FAIL: the idle connection was not dropped after SERVER_IDLE\n");
+		failures++;
+	}
+
+	if (failures > 0) {
+		return EXIT_FAILURE;
+	}
+	printf("PASS\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,351 @@
+/* File: gbn_analyze.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Offline analyzer for captures written by gbn_pcap_open. Packets are grouped
+ *              in connections by socket and peer. For each one it rebuilds the sequence and
+ *              ACK timeline of the sending side: new and retransmitted DATA, bursts of
+ *              retransmissions, RTT samples (Karn, from packets sent once) and goodput per
+ *              interval. Packets lost or corrupted by maybe_sendto are counted.
+ *
+ *              gbn_analyze [-t] [-i interval_ms] capture.pcap
+ *              -t prints every packet as it is read, the timeline, before the summaries.
+ *
+ *              Build: gcc -I.. -o gbn_analyze gbn_analyze.c
+ */
+
+#include "../GBN.h"
+
+
+#define MAX_CONNS 64
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define LINKTYPE_USER0 147
+#define NFLAGS (KEEPALIVEACK + 1)  /* Packet flags there are */
+
+
+/* Per interval, for goodput and RTT over time */
+typedef struct interval_t {
+    uint64_t acked;         /* Payload bytes newly acknowledged */
+    size_t retransmits;
+    int64_t rtt_sum;
+    size_t rtt_samples;
+} interval;
+
+typedef struct conn_t {
+    pcap_gbn key;           /* Socket and peer, event cleared */
+    int64_t first;
+    int64_t last;
+    size_t events[4];       /* By PCAP_ event */
+    size_t by_flags[NFLAGS];    /* Sent or received, by packet flags */
+
+    /* Sending side, packet numbers unwrapped from the 8-bit seq */
+    size_t base;            /* Oldest unacknowledged */
+    size_t next;            /* Next new packet */
+    int64_t sent_at[256];
+    int sent_count[256];
+    uint16_t sent_len[256];
+    size_t new_data;
+    size_t retransmits;
+    size_t dup_acks;
+    uint64_t acked_bytes;
+    int64_t rtt_min;
+    int64_t rtt_max;
+    int64_t rtt_sum;
+    size_t rtt_samples;
+
+    /* Retransmission bursts, back to back retransmissions */
+    int in_burst;
+    size_t bursts;
+    size_t burst_len;
+    size_t burst_max;
+
+    /* Receiving side */
+    size_t data_received;
+    uint64_t bytes_received;
+
+    interval* intervals;
+    size_t nintervals;
+} conn;
+
+static const char* flag_names[NFLAGS] = { "SYN", "SYNACK", "DATA", "ACK", "FIN", "FINACK", "PARITY", "SKIP", "PROBE", "PROBEACK",
+	"CHALLENGE", "RESPONSE", "KEEPALIVE", "KEEPALIVEACK" };
+static const char* event_names[] = { "sent", "recv", "DROP", "CORRUPT" };
+
+static conn conns[MAX_CONNS];
+static int nconns;
+static int64_t interval_ns = 100 * 1000000LL;
+static int64_t capture_start = -1;
+
+
+static conn* conn_get(const pcap_gbn* rec) {
+	pcap_gbn key = *rec;
+	key.event = 0;
+
+	for (int i = 0; i < nconns; i++) {
+		if (memcmp(&conns[i].key, &key, sizeof(key)) == 0) {
+			return &conns[i];
+		}
+	}
+	if (nconns == MAX_CONNS) {
+		return NULL;
+	}
+
+	conn* c = &conns[nconns++];
+	memset(c, 0, sizeof(*c));
+	c->key = key;
+	c->rtt_min = INT64_MAX;
+	return c;
+}
+
+static interval* interval_at(conn* c, int64_t t) {
+	/* Records are not quite in time order, threads write them as they go */
+	size_t i = t > capture_start ? (t - capture_start) / interval_ns : 0;
+
+	if (i >= c->nintervals) {
+		size_t n = i + 1 > 2 * c->nintervals ? i + 1 : 2 * c->nintervals;
+		c->intervals = realloc(c->intervals, n * sizeof(*c->intervals));
+		if (c->intervals == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		memset(c->intervals + c->nintervals, 0, (n - c->nintervals) * sizeof(*c->intervals));
+		c->nintervals = n;
+	}
+	return &c->intervals[i];
+}
+
+static void conn_name(const conn* c, char* name, size_t size) {
+	char addr[INET6_ADDRSTRLEN] = "?";
+
+	if (c->key.family == AF_INET || c->key.family == AF_INET6) {
+		inet_ntop(c->key.family, c->key.addr, addr, sizeof(addr));
+	}
+	snprintf(name, size, "fd %d <-> %s:%d", c->key.sockfd, addr, ntohs(c->key.port));
+}
+
+
+/* A DATA packet leaving (or lost on the way out, the sender does not know) */
+static void track_data(conn* c, const rtp* packet, int64_t t, int timeline) {
+	uint8_t ahead = packet->seq - (uint8_t)c->next;
+	size_t n = ahead < 128 ? c->next + ahead : c->next - (uint8_t)(-ahead);
+	int slot = n % 256;
+
+	if (n >= c->next) {
+		c->next = n + 1;
+		c->new_data++;
+		c->sent_count[slot] = 1;
+		c->sent_len[slot] = packet->len & ~LEN_COMPRESSED;
+		c->in_burst = 0;
+	}
+	else {
+		c->retransmits++;
+		c->sent_count[slot]++;
+		interval_at(c, t)->retransmits++;
+
+		if (!c->in_burst) {
+			c->in_burst = 1;
+			c->bursts++;
+			c->burst_len = 0;
+			if (timeline) {
+				printf("    retransmission burst from packet %zu\n", n);
+			}
+		}
+		if (++c->burst_len > c->burst_max) {
+			c->burst_max = c->burst_len;
+		}
+	}
+	c->sent_at[slot] = t;
+}
+
+/* A cumulative ACK coming back to the sending side */
+static void track_ack(conn* c, const rtp* packet, int64_t t, int timeline) {
+	size_t acked = (uint8_t)(packet->seq - (uint8_t)c->base);
+
+	if (acked == 0 || acked > c->next - c->base) {
+		if (c->next > c->base) {
+			c->dup_acks++;
+		}
+		return;
+	}
+
+	interval* iv = interval_at(c, t);
+	for (size_t n = c->base; n < c->base + acked; n++) {
+		c->acked_bytes += c->sent_len[n % 256];
+		iv->acked += c->sent_len[n % 256];
+	}
+	c->base += acked;
+	c->in_burst = 0;
+
+	/* Karn: only from a packet sent once */
+	int last = (c->base - 1) % 256;
+	if (c->sent_count[last] == 1) {
+		int64_t rtt = t - c->sent_at[last];
+
+		c->rtt_sum += rtt;
+		c->rtt_samples++;
+		c->rtt_min = rtt < c->rtt_min ? rtt : c->rtt_min;
+		c->rtt_max = rtt > c->rtt_max ? rtt : c->rtt_max;
+		iv->rtt_sum += rtt;
+		iv->rtt_samples++;
+		if (timeline) {
+			printf("    rtt %.3f ms\n", rtt / 1e6);
+		}
+	}
+}
+
+static void packet(const pcap_gbn* rec, const rtp* pkt, size_t len, int64_t t, int timeline) {
+	conn* c = conn_get(rec);
+	if (c == NULL) {
+		return;
+	}
+	if (capture_start < 0) {
+		capture_start = t;
+	}
+	if (c->events[0] + c->events[1] + c->events[2] + c->events[3] == 0) {
+		c->first = t;
+	}
+	c->last = t;
+	c->events[rec->event & 3]++;
+
+	if (timeline) {
+		char name[96];
+		conn_name(c, name, sizeof(name));
+		printf("%10.6f %-28s %-7s %-8s seq %3d len %5d\n", (t - capture_start) / 1e9, name,
+			event_names[rec->event & 3], pkt->flags < NFLAGS ? flag_names[pkt->flags] : "?", pkt->seq, pkt->len & ~LEN_COMPRESSED);
+	}
+
+	if (rec->event == PCAP_CORRUPTED || pkt->flags >= NFLAGS) { /* The damaged copy is recorded as sent */
+		return;
+	}
+	c->by_flags[pkt->flags]++;
+
+	if (pkt->flags == SYN && rec->event != PCAP_RECEIVED) { /* New connection from this socket */
+		c->base = c->next = 0;
+	}
+	else if (pkt->flags == DATA && rec->event != PCAP_RECEIVED) {
+		track_data(c, pkt, t, timeline);
+	}
+	else if (pkt->flags == ACK && rec->event == PCAP_RECEIVED) {
+		track_ack(c, pkt, t, timeline);
+	}
+	else if (pkt->flags == DATA) {
+		c->data_received++;
+		c->bytes_received += len - offsetof(rtp, data);
+	}
+}
+
+static void report(const conn* c) {
+	char name[96];
+	double seconds = (c->last - c->first) / 1e9;
+
+	conn_name(c, name, sizeof(name));
+	printf("\n%s\n", name);
+	printf("  %.6f s, %zu sent, %zu received, %zu dropped and %zu corrupted by maybe_sendto\n", seconds,
+		c->events[PCAP_SENT], c->events[PCAP_RECEIVED], c->events[PCAP_DROPPED], c->events[PCAP_CORRUPTED]);
+	printf(" ");
+	for (int f = 0; f < NFLAGS; f++) {
+		if (c->by_flags[f] > 0) {
+			printf(" %s %zu", flag_names[f], c->by_flags[f]);
+		}
+	}
+	printf("\n");
+
+	if (c->new_data > 0) {
+		printf("  sender: %zu DATA packets, %zu retransmitted (%.1f%%) in %zu bursts (longest %zu), %zu duplicate ACKs\n",
+			c->new_data, c->retransmits, 100.0 * c->retransmits / (c->new_data + c->retransmits), c->bursts, c->burst_max, c->dup_acks);
+		printf("  goodput %.3f MB/s, %llu payload bytes acknowledged (compressed ones as sent)\n",
+			seconds > 0 ? c->acked_bytes / 1e6 / seconds : 0.0, (unsigned long long)c->acked_bytes);
+		if (c->rtt_samples > 0) {
+			printf("  rtt min %.3f avg %.3f max %.3f ms (%zu samples)\n", c->rtt_min / 1e6,
+				c->rtt_sum / 1e6 / c->rtt_samples, c->rtt_max / 1e6, c->rtt_samples);
+		}
+
+		printf("  %10s %12s %10s %8s\n", "time (s)", "goodput MB/s", "rtt ms", "retrans");
+		for (size_t i = 0; i < c->nintervals; i++) {
+			const interval* iv = &c->intervals[i];
+			if (iv->acked == 0 && iv->retransmits == 0 && iv->rtt_samples == 0) {
+				continue;
+			}
+			printf("  %10.3f %12.3f ", i * interval_ns / 1e9, iv->acked / 1e6 / (interval_ns / 1e9));
+			if (iv->rtt_samples > 0) {
+				printf("%10.3f", iv->rtt_sum / 1e6 / iv->rtt_samples);
+			}
+			else {
+				printf("%10s", "-");
+			}
+			printf(" %8zu\n", iv->retransmits);
+		}
+	}
+	if (c->data_received > 0) {
+		printf("  receiver: %zu DATA packets, %llu bytes\n", c->data_received, (unsigned long long)c->bytes_received);
+	}
+}
+
+
+int main(int argc, char** argv) {
+	int timeline = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ti:")) != -1) {
+		if (opt == 't') {
+			timeline = 1;
+		}
+		else if (opt == 'i' && atoi(optarg) > 0) {
+			interval_ns = atoi(optarg) * 1000000LL;
+		}
+		else {
+			fprintf(stderr, "Usage: %s [-t] [-i interval_ms] capture.pcap\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-t] [-i interval_ms] capture.pcap\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE* f = fopen(argv[optind], "rb");
+	if (f == NULL) {
+		perror("fopen");
+		return EXIT_FAILURE;
+	}
+
+	uint32_t hdr[6];
+	if (fread(hdr, sizeof(hdr), 1, f) != 1 || (hdr[0] != PCAP_MAGIC_NS && hdr[0] != PCAP_MAGIC_US) || hdr[5] != LINKTYPE_USER0) {
+		fprintf(stderr, "%s: not a GBN capture\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	int64_t frac = hdr[0] == PCAP_MAGIC_NS ? 1 : 1000;
+
+	uint8_t* buf = malloc(sizeof(pcap_gbn) + sizeof(rtp));
+	rtp* pkt = malloc(sizeof(rtp));
+	if (buf == NULL || pkt == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	uint32_t rec[4];
+	while (fread(rec, sizeof(rec), 1, f) == 1) {
+		size_t incl = rec[2];
+		if (incl > sizeof(pcap_gbn) + sizeof(rtp) || fread(buf, 1, incl, f) != incl) {
+			fprintf(stderr, "Truncated or damaged record, stopping\n");
+			break;
+		}
+		if (incl < sizeof(pcap_gbn) + offsetof(rtp, data)) { /* Too short to have an rtp header */
+			continue;
+		}
+
+		/* The packet may be cut at the snaplen, only its header is needed */
+		memcpy(pkt, buf + sizeof(pcap_gbn), incl - sizeof(pcap_gbn));
+
+		int64_t t = rec[0] * 1000000000LL + rec[1] * frac;
+		packet((pcap_gbn*)buf, pkt, rec[3] - sizeof(pcap_gbn), t, timeline);
+	}
+	fclose(f);
+	free(buf);
+	free(pkt);
+
+	for (int i = 0; i < nconns; i++) {
+		report(&conns[i]);
+		free(conns[i].intervals);
+	}
+	return EXIT_SUCCESS;
+}
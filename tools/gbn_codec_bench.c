@@ -0,0 +1,56 @@
+/* File: gbn_codec_bench.c
+ * Authors: Kim Svedberg, Zebastian Thorsén
+ * Description: Runs gbn_codec_benchmark on a file: every codec against the uncompressed
+ *              path, segment by segment as sender_gbn would send it. Prints the ratio and
+ *              the compress and decompress rates of each, so a codec can be picked for the
+ *              data a link carries.
+ *
+ *              gbn_codec_bench file
+ *
+ *              Build: gcc -I.. -o gbn_codec_bench gbn_codec_bench.c ../GBN*.c -lpthread
+ */
+
+#include "../GBN.h"
+
+
+int main(int argc, char** argv) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE* f = fopen(argv[1], "rb");
+	if (f == NULL) {
+		perror("fopen");
+		return EXIT_FAILURE;
+	}
+
+	/* The whole file in memory, so only the codecs are timed */
+	size_t len = 0;
+	size_t cap = 1 << 20;
+	uint8_t* buf = malloc(cap);
+	size_t n;
+
+	while (buf != NULL && (n = fread(buf + len, 1, cap - len, f)) > 0) {
+		len += n;
+		if (len == cap) {
+			cap *= 2;
+			buf = realloc(buf, cap);
+		}
+	}
+	if (buf == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	if (ferror(f)) {
+		perror("fread");
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+
+	printf("%s: %zu bytes, %d byte segments\n", argv[1], len, BASE_MSS);
+	gbn_codec_benchmark(buf, len);
+
+	free(buf);
+	return EXIT_SUCCESS;
+}